@@ -0,0 +1,59 @@
+#!/usr/bin/env node
+// Round-trip latency of the local control API (POST /cmd and /ws).
+// Usage: node bin/bench_local.mjs <lamp-ip[:port]> [iterations]
+// Needs Node 22+ (global fetch and WebSocket).
+
+const host = process.argv[2];
+const iterations = Number(process.argv[3] ?? 200);
+if (!host) {
+  console.error("usage: bench_local.mjs <lamp-ip[:port]> [iterations]");
+  process.exit(1);
+}
+
+const commands = ["COLOR#FF0000", "COLOR#00FF00", "COLOR#0000FF"];
+
+function report(name, samples) {
+  samples.sort((a, b) => a - b);
+  const pct = (p) => samples[Math.min(samples.length - 1, Math.floor(p * samples.length))];
+  const avg = samples.reduce((a, b) => a + b, 0) / samples.length;
+  console.log(
+    `${name.padEnd(5)} n=${samples.length} avg=${avg.toFixed(2)}ms ` +
+      `p50=${pct(0.5).toFixed(2)}ms p90=${pct(0.9).toFixed(2)}ms ` +
+      `p99=${pct(0.99).toFixed(2)}ms max=${samples.at(-1).toFixed(2)}ms`,
+  );
+}
+
+async function benchHttp() {
+  const samples = [];
+  for (let i = 0; i < iterations; i++) {
+    const start = performance.now();
+    const res = await fetch(`http://${host}/cmd`, {
+      method: "POST",
+      body: commands[i % commands.length],
+    });
+    await res.text();
+    samples.push(performance.now() - start);
+  }
+  report("http", samples);
+}
+
+async function benchWs() {
+  const ws = new WebSocket(`ws://${host}/ws`);
+  await new Promise((resolve, reject) => {
+    ws.onopen = resolve;
+    ws.onerror = reject;
+  });
+  const samples = [];
+  for (let i = 0; i < iterations; i++) {
+    const start = performance.now();
+    const reply = new Promise((resolve) => (ws.onmessage = resolve));
+    ws.send(commands[i % commands.length]);
+    await reply;
+    samples.push(performance.now() - start);
+  }
+  ws.close();
+  report("ws", samples);
+}
+
+await benchHttp();
+await benchWs();
@@ -0,0 +1,110 @@
+#!/usr/bin/env node
+// Packs animation clips into an image for the lamp's "clips" partition
+// (main/clips.h). Each clip is a binary PPM, one row per frame and one
+// column per LED, e.g. the output of sim_frames.mjs. Frames are stored in
+// wire format, so --order and --channels must match the strip's menuconfig.
+// Layout (integers LE):
+//   header: "LCLP", u16 version 1, u16 clip count, u32 image size,
+//           u32 CRC-32 of everything after the header
+//   entries, 32 bytes each: name[16] (NUL-padded), u32 data offset,
+//           u16 frames, u16 frame_ms, u16 leds, u8 channels,
+//           u8 order (rgb rbg grb gbr brg bgr), u8 flags (1 = loop), 3 pad
+//   frame data
+// Upload with: curl -H "Authorization: Bearer $LAMP_OTA_TOKEN" \
+//                --data-binary @clips.bin http://<lamp>:<port>/clips
+//          or: mosquitto_pub -r -t esp001/clips -f clips.bin
+// Usage: node bin/clip_pack.mjs out.bin [--order gbr] [--channels 3]
+//          name:frame_ms:file.ppm[:loop] ...
+
+import { readFileSync, writeFileSync } from "node:fs";
+
+const ORDERS = ["rgb", "rbg", "grb", "gbr", "brg", "bgr"];
+const PARTITION_SIZE = 0x10000;
+const HEADER = 16;
+const ENTRY = 32;
+
+const args = process.argv.slice(2);
+const out = args.shift();
+let order = "gbr";
+let channels = 3;
+const specs = [];
+while (args.length) {
+  const a = args.shift();
+  if (a === "--order") order = args.shift();
+  else if (a === "--channels") channels = Number(args.shift());
+  else specs.push(a);
+}
+if (!out || !specs.length || !ORDERS.includes(order) || ![3, 4].includes(channels)) {
+  console.error("usage: clip_pack.mjs out.bin [--order gbr] [--channels 3|4] name:frame_ms:file.ppm[:loop] ...");
+  process.exit(1);
+}
+
+function readPpm(path) {
+  const buf = readFileSync(path);
+  // P6 <ws> width <ws> height <ws> maxval <single ws> pixels; no comments
+  const m = /^P6\s+(\d+)\s+(\d+)\s+(\d+)\s/.exec(buf.toString("latin1", 0, 64));
+  if (!m || m[3] !== "255") throw new Error(`${path}: not an 8-bit binary PPM`);
+  const [width, height] = [Number(m[1]), Number(m[2])];
+  return { width, height, pixels: buf.subarray(m[0].length, m[0].length + width * height * 3) };
+}
+
+// Same as the firmware's pixel writers: wire order, white = min(r, g, b)
+function encodePixel(r, g, b, dst, o) {
+  const w = channels === 4 ? Math.min(r, g, b) : 0;
+  const c = { r: r - w, g: g - w, b: b - w };
+  for (let i = 0; i < 3; i++) dst[o + i] = c[order[i]];
+  if (channels === 4) dst[o + 3] = w;
+}
+
+const clips = specs.map((spec) => {
+  const [name, frameMs, path, loop] = spec.split(":");
+  if (!name || Buffer.byteLength(name) > 15 || !(Number(frameMs) > 0) || !path) {
+    throw new Error(`bad clip spec ${spec}`);
+  }
+  const ppm = readPpm(path);
+  const data = Buffer.alloc(ppm.width * ppm.height * channels);
+  for (let p = 0; p < ppm.width * ppm.height; p++) {
+    encodePixel(ppm.pixels[p * 3], ppm.pixels[p * 3 + 1], ppm.pixels[p * 3 + 2], data, p * channels);
+  }
+  return { name, frameMs: Number(frameMs), loop: loop === "loop", leds: ppm.width, frames: ppm.height, data };
+});
+
+const tableEnd = HEADER + clips.length * ENTRY;
+const size = tableEnd + clips.reduce((n, c) => n + c.data.length, 0);
+if (size > PARTITION_SIZE) {
+  console.error(`${size} bytes does not fit the ${PARTITION_SIZE} byte partition`);
+  process.exit(1);
+}
+
+const image = Buffer.alloc(size);
+image.write("LCLP", 0, "latin1");
+image.writeUInt16LE(1, 4);
+image.writeUInt16LE(clips.length, 6);
+image.writeUInt32LE(size, 8);
+let dataOffset = tableEnd;
+clips.forEach((c, i) => {
+  const e = HEADER + i * ENTRY;
+  image.write(c.name, e, "utf8");
+  image.writeUInt32LE(dataOffset, e + 16);
+  image.writeUInt16LE(c.frames, e + 20);
+  image.writeUInt16LE(c.frameMs, e + 22);
+  image.writeUInt16LE(c.leds, e + 24);
+  image[e + 26] = channels;
+  image[e + 27] = ORDERS.indexOf(order);
+  image[e + 28] = c.loop ? 1 : 0;
+  c.data.copy(image, dataOffset);
+  dataOffset += c.data.length;
+  console.log(`${c.name}: ${c.frames} frames x ${c.leds} LEDs @ ${c.frameMs} ms${c.loop ? ", loop" : ""}`);
+});
+
+const CRC_TABLE = Array.from({ length: 256 }, (_, n) => {
+  let c = n;
+  for (let k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ (c >>> 1) : c >>> 1;
+  return c >>> 0;
+});
+let crc = 0xffffffff;
+for (const byte of image.subarray(HEADER)) crc = CRC_TABLE[(crc ^ byte) & 0xff] ^ (crc >>> 8);
+image.writeUInt32LE((crc ^ 0xffffffff) >>> 0, 12);
+
+writeFileSync(out, image);
+console.log(`${out}: ${size} bytes`);
@@ -0,0 +1,80 @@
+#!/usr/bin/env node
+// UDP load test for the captive-portal DNS server.
+// Keeps --window queries in flight with a phone-like mix of A, AAAA and
+// HTTPS lookups and reports queries/s, timeouts and latency percentiles.
+// Usage: node bin/dns_bench.mjs [host=192.168.4.1] [total=2000] [window=8]
+
+import dgram from "node:dgram";
+
+const host = process.argv[2] ?? "192.168.4.1";
+const total = Number(process.argv[3] ?? 2000);
+const windowSize = Number(process.argv[4] ?? 8);
+const TIMEOUT_MS = 1000;
+
+const names = [
+  "connectivitycheck.gstatic.com",
+  "captive.apple.com",
+  "www.msftconnecttest.com",
+  "clients3.google.com",
+];
+const types = [1, 1, 28, 65]; // A, A, AAAA, HTTPS
+
+function query(id, name, type) {
+  const labels = name.split(".").map((l) => Buffer.concat([Buffer.from([l.length]), Buffer.from(l)]));
+  const header = Buffer.alloc(12);
+  header.writeUInt16BE(id, 0);
+  header.writeUInt16BE(0x0100, 2); // RD
+  header.writeUInt16BE(1, 4);
+  const tail = Buffer.alloc(5);
+  tail.writeUInt16BE(type, 1);
+  tail.writeUInt16BE(1, 3);
+  return Buffer.concat([header, ...labels, tail]);
+}
+
+const socket = dgram.createSocket("udp4");
+const pending = new Map();
+const samples = [];
+let sent = 0;
+let timeouts = 0;
+let done;
+const finished = new Promise((resolve) => (done = resolve));
+
+function sendNext() {
+  if (sent >= total) {
+    if (pending.size === 0) done();
+    return;
+  }
+  const id = sent & 0xffff;
+  const msg = query(id, names[sent % names.length], types[sent % types.length]);
+  const timer = setTimeout(() => {
+    pending.delete(id);
+    timeouts++;
+    sendNext();
+  }, TIMEOUT_MS);
+  pending.set(id, { start: performance.now(), timer });
+  sent++;
+  socket.send(msg, 53, host);
+}
+
+socket.on("message", (msg) => {
+  const entry = pending.get(msg.readUInt16BE(0));
+  if (!entry) return;
+  clearTimeout(entry.timer);
+  pending.delete(msg.readUInt16BE(0));
+  samples.push(performance.now() - entry.start);
+  sendNext();
+});
+
+const start = performance.now();
+for (let i = 0; i < windowSize; i++) sendNext();
+await finished;
+const elapsed = (performance.now() - start) / 1000;
+socket.close();
+
+samples.sort((a, b) => a - b);
+const at = (p) => samples[Math.min(samples.length - 1, Math.floor(p * samples.length))] ?? NaN;
+console.log(
+  `sent=${sent} answered=${samples.length} timeouts=${timeouts} ` +
+    `qps=${(samples.length / elapsed).toFixed(0)} ` +
+    `p50=${at(0.5).toFixed(2)}ms p90=${at(0.9).toFixed(2)}ms p99=${at(0.99).toFixed(2)}ms`,
+);
@@ -0,0 +1,246 @@
+#!/usr/bin/env node
+// MQTT load / soak benchmark for the lamp firmware.
+//
+// Talks only to the broker, so the firmware under test can be a board, the
+// Linux host build or QEMU, as long as CONFIG_MQTT_BROKER_URI points at the
+// same broker. Two phases:
+//   load    - publish a weighted mix of commands at --rate for --duration and
+//             count what the lamp reports back on its retained state topic
+//             (everything else was coalesced or dropped)
+//   latency - send unique COLOR probes spaced further apart than the lamp's
+//             state publish interval and time command -> state report
+// Bytes written to the broker are reported per command, to compare MQTT
+// 3.1.1 with 5 (--protocol 5), where commands can carry a message expiry
+// (--expiry, seconds) and go out as topic aliases (--alias 1).
+//
+// Usage: node bin/mqtt_bench.mjs [--url mqtt://localhost:1883] [--rate 50]
+//          [--duration 30] [--mix color:70,pulse:20,chase:5,junk:5]
+//          [--junk-size 64] [--qos 0] [--probes 20] [--probe-interval 1500]
+//          [--timeout 5000] [--phase both|load|latency] [--label name]
+//          [--protocol 4|5] [--expiry 0] [--alias 0] [--out results.json]
+// Needs the mqtt package: (cd bin && npm install)
+
+import { writeFileSync } from "node:fs";
+import mqtt from "mqtt";
+
+const COMMAND_TOPIC = "esp001/state";
+const STATE_TOPIC = "esp001/status";
+
+function parseArgs(argv) {
+  const opts = {
+    url: "mqtt://localhost:1883",
+    rate: 50,
+    duration: 30,
+    mix: "color:70,pulse:20,chase:5,junk:5",
+    "junk-size": 64,
+    qos: 0,
+    probes: 20,
+    "probe-interval": 1500,
+    timeout: 5000,
+    phase: "both",
+    label: "run",
+    protocol: 4,
+    expiry: 0,
+    alias: 0,
+    out: null,
+  };
+  for (let i = 0; i < argv.length; i += 2) {
+    const key = argv[i].replace(/^--/, "");
+    if (!(key in opts)) throw new Error(`unknown option --${key}`);
+    const value = argv[i + 1];
+    opts[key] = typeof opts[key] === "number" ? Number(value) : value;
+  }
+  opts.mix = opts.mix.split(",").map((entry) => {
+    const [kind, weight] = entry.split(":");
+    return { kind, weight: Number(weight) };
+  });
+  return opts;
+}
+
+const hex = (n) => n.toString(16).padStart(2, "0").toUpperCase();
+const randomRgb = () =>
+  `#${hex((Math.random() * 256) | 0)}${hex((Math.random() * 256) | 0)}${hex((Math.random() * 256) | 0)}`;
+
+function makeCommand(kind, junkSize) {
+  switch (kind) {
+    case "color":
+      return `COLOR${randomRgb()}`;
+    case "pulse":
+      return `PULSE${randomRgb()}`;
+    case "chase":
+      return "CHASE";
+    case "junk":
+      return Buffer.alloc(junkSize, "x");
+    default:
+      throw new Error(`unknown command kind ${kind}`);
+  }
+}
+
+function pickKind(mix) {
+  const total = mix.reduce((sum, m) => sum + m.weight, 0);
+  let r = Math.random() * total;
+  for (const m of mix) {
+    if ((r -= m.weight) < 0) return m.kind;
+  }
+  return mix[mix.length - 1].kind;
+}
+
+function percentiles(samples) {
+  if (samples.length === 0) return null;
+  const sorted = [...samples].sort((a, b) => a - b);
+  const at = (p) => sorted[Math.min(sorted.length - 1, Math.floor(p * sorted.length))];
+  return {
+    n: sorted.length,
+    p50: at(0.5),
+    p90: at(0.9),
+    p99: at(0.99),
+    max: sorted[sorted.length - 1],
+  };
+}
+
+const sleep = (ms) => new Promise((resolve) => setTimeout(resolve, ms));
+
+function publishOptions(opts) {
+  const publish = { qos: opts.qos };
+  // Stale commands are dropped by the broker instead of queued for a lamp
+  // that is offline
+  if (opts.protocol === 5 && opts.expiry > 0) {
+    publish.properties = { messageExpiryInterval: opts.expiry };
+  }
+  return publish;
+}
+
+async function runLoad(client, opts, states) {
+  const sent = { color: 0, pulse: 0, chase: 0, junk: 0 };
+  let publishErrors = 0;
+  let inFlight = 0;
+  const statesBefore = states.count;
+  const start = performance.now();
+  const end = start + opts.duration * 1000;
+  const intervalMs = 1000 / opts.rate;
+  let next = start;
+  let lastReport = start;
+  const bytesBefore = client.stream.bytesWritten;
+  const publish = publishOptions(opts);
+
+  while (performance.now() < end) {
+    const kind = pickKind(opts.mix);
+    inFlight++;
+    client.publish(COMMAND_TOPIC, makeCommand(kind, opts["junk-size"]), publish, (err) => {
+      inFlight--;
+      if (err) publishErrors++;
+    });
+    sent[kind]++;
+
+    next += intervalMs;
+    const now = performance.now();
+    if (now - lastReport >= 10000) {
+      const total = Object.values(sent).reduce((a, b) => a + b, 0);
+      console.log(
+        `[load] t=${((now - start) / 1000).toFixed(0)}s sent=${total} ` +
+          `state_reports=${states.count - statesBefore} errors=${publishErrors}`,
+      );
+      lastReport = now;
+    }
+    if (next > now) await sleep(next - now);
+  }
+  while (inFlight > 0) await sleep(10);
+  // Let the trailing coalesced state report arrive
+  await sleep(opts.timeout);
+
+  const elapsedS = (performance.now() - start - opts.timeout) / 1000;
+  const total = Object.values(sent).reduce((a, b) => a + b, 0);
+  const valid = total - sent.junk;
+  const stateReports = states.count - statesBefore;
+  // Includes PUBACKs at QoS 1 and pings, which are the same for both
+  // protocols
+  const bytesOut = client.stream.bytesWritten - bytesBefore;
+  return {
+    sent,
+    sent_total: total,
+    throughput_msg_s: total / elapsedS,
+    publish_errors: publishErrors,
+    bytes_out: bytesOut,
+    bytes_per_command: bytesOut / total,
+    state_reports: stateReports,
+    // Valid commands that never showed up as their own state report
+    coalesced_or_dropped: Math.max(0, valid - stateReports),
+  };
+}
+
+async function runLatency(client, opts, states) {
+  const samples = [];
+  let dropped = 0;
+  for (let i = 0; i < opts.probes; i++) {
+    // Unique colour per probe so the report can't be confused with another
+    const probe = `COLOR#${hex(i & 0xff)}${hex((i >> 8) & 0xff)}${hex(0xa5)}`;
+    const start = performance.now();
+    const seen = states.waitFor(probe, opts.timeout);
+    client.publish(COMMAND_TOPIC, probe, publishOptions(opts));
+    if (await seen) {
+      samples.push(performance.now() - start);
+    } else {
+      dropped++;
+    }
+    await sleep(opts["probe-interval"]);
+  }
+  return { probes: opts.probes, dropped, latency_ms: percentiles(samples) };
+}
+
+function trackStates(client) {
+  const waiters = new Map();
+  const states = {
+    count: 0,
+    waitFor(payload, timeoutMs) {
+      return new Promise((resolve) => {
+        const timer = setTimeout(() => {
+          waiters.delete(payload);
+          resolve(false);
+        }, timeoutMs);
+        waiters.set(payload, () => {
+          clearTimeout(timer);
+          resolve(true);
+        });
+      });
+    },
+  };
+  let first = true;
+  client.on("message", (topic, message, packet) => {
+    if (topic !== STATE_TOPIC) return;
+    // The retained copy delivered on subscribe is not a reaction to us
+    if (first && packet.retain) {
+      first = false;
+      return;
+    }
+    first = false;
+    states.count++;
+    const waiter = waiters.get(message.toString());
+    if (waiter) {
+      waiters.delete(message.toString());
+      waiter();
+    }
+  });
+  return states;
+}
+
+const opts = parseArgs(process.argv.slice(2));
+const client = await mqtt.connectAsync(opts.url, {
+  clientId: `bench-${process.pid}`,
+  protocolVersion: opts.protocol,
+  // Sends the topic once per connection, then only its alias
+  autoAssignTopicAlias: opts.protocol === 5 && opts.alias === 1,
+});
+await client.subscribeAsync(STATE_TOPIC, { qos: 1 });
+const states = trackStates(client);
+
+const result = { label: opts.label, date: new Date().toISOString(), options: opts };
+if (opts.phase === "both" || opts.phase === "load") {
+  result.load = await runLoad(client, opts, states);
+}
+if (opts.phase === "both" || opts.phase === "latency") {
+  result.latency = await runLatency(client, opts, states);
+}
+await client.endAsync();
+
+console.log(JSON.stringify(result, null, 2));
+if (opts.out) writeFileSync(opts.out, JSON.stringify(result, null, 2) + "\n");
@@ -0,0 +1,89 @@
+#!/usr/bin/env node
+// Packs a firmware image for the lamp's streaming OTA updater.
+// Always writes <out>.zlib, the full image deflated. With a base image (the
+// exact .bin the lamps are running) also writes <out>.delta.zlib: a deflated
+// op stream that copies unchanged runs out of the running slot and carries
+// only the changed bytes. Layout of the inflated delta (integers LE):
+//   "LDLT", 32-byte SHA-256 appended to the base image,
+//   ops: 0x01 COPY u32 base_offset u32 len | 0x02 ADD u32 len bytes | 0x00 END
+// Usage: node bin/ota_pack.mjs build/beep-boop-lamp.bin out [base.bin]
+
+import { readFileSync, writeFileSync } from "node:fs";
+import { deflateSync } from "node:zlib";
+
+const [imagePath, out = "firmware", basePath] = process.argv.slice(2);
+if (!imagePath) {
+  console.error("usage: ota_pack.mjs image.bin out [base.bin]");
+  process.exit(1);
+}
+
+const BLOCK = 32; // shortest run worth a 9-byte COPY
+const INDEX_STEP = 8; // base offsets indexed; every new offset is probed
+
+const image = readFileSync(imagePath);
+const full = deflateSync(image, { level: 9 });
+writeFileSync(`${out}.zlib`, full);
+console.log(`${out}.zlib: ${image.length} -> ${full.length} bytes`);
+
+if (basePath) {
+  const base = readFileSync(basePath);
+  // esp_image_header_t.hash_appended; the digest is the device's base id
+  if (base[0] !== 0xe9 || base[23] !== 1) {
+    console.error(`${basePath}: not an app image with an appended SHA-256`);
+    process.exit(1);
+  }
+  const baseSha = base.subarray(base.length - 32);
+
+  const index = new Map();
+  for (let i = 0; i + BLOCK <= base.length; i += INDEX_STEP) {
+    const key = base.toString("latin1", i, i + BLOCK);
+    if (!index.has(key)) index.set(key, i);
+  }
+
+  const ops = [Buffer.from("LDLT"), baseSha];
+  let copied = 0;
+  let literalStart = 0;
+  const u32 = (v) => {
+    const b = Buffer.alloc(4);
+    b.writeUInt32LE(v);
+    return b;
+  };
+  const flushLiteral = (end) => {
+    if (end > literalStart) {
+      ops.push(Buffer.from([0x02]), u32(end - literalStart), image.subarray(literalStart, end));
+    }
+  };
+
+  let i = 0;
+  while (i + BLOCK <= image.length) {
+    const at = index.get(image.toString("latin1", i, i + BLOCK));
+    if (at === undefined) {
+      i++;
+      continue;
+    }
+    let start = i;
+    let src = at;
+    // Grow the match backwards into pending literals, then forwards
+    while (start > literalStart && src > 0 && image[start - 1] === base[src - 1]) {
+      start--;
+      src--;
+    }
+    let end = i + BLOCK;
+    while (end < image.length && src + (end - start) < base.length && image[end] === base[src + (end - start)]) {
+      end++;
+    }
+    flushLiteral(start);
+    ops.push(Buffer.from([0x01]), u32(src), u32(end - start));
+    copied += end - start;
+    literalStart = i = end;
+  }
+  flushLiteral(image.length);
+  ops.push(Buffer.from([0x00]));
+
+  const delta = deflateSync(Buffer.concat(ops), { level: 9 });
+  writeFileSync(`${out}.delta.zlib`, delta);
+  console.log(
+    `${out}.delta.zlib: ${delta.length} bytes (${((100 * copied) / image.length).toFixed(1)}% copied from base, ` +
+      `${((100 * delta.length) / full.length).toFixed(1)}% of the full .zlib)`,
+  );
+}
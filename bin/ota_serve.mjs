@@ -0,0 +1,73 @@
+#!/usr/bin/env node
+// Serves packed OTA images (see ota_pack.mjs) from a directory and, given
+// lamp addresses, asks each lamp to update from it via POST /ota, then
+// polls GET /ota until it reboots or fails. The lamps' OTA token
+// (CONFIG_LAMP_OTA_TOKEN) is read from LAMP_OTA_TOKEN.
+// Usage: LAMP_OTA_TOKEN=... node bin/ota_serve.mjs dir file [port=8070]
+//          [lamp-ip ...]
+
+import { createReadStream, statSync } from "node:fs";
+import { createServer } from "node:http";
+import { networkInterfaces } from "node:os";
+import { join, normalize } from "node:path";
+
+const [dir, file, portArg, ...lamps] = process.argv.slice(2);
+if (!dir || !file) {
+  console.error("usage: ota_serve.mjs dir file [port] [lamp-ip ...]");
+  process.exit(1);
+}
+const port = Number(portArg ?? 8070);
+
+const server = createServer((req, res) => {
+  const path = join(dir, normalize(decodeURIComponent(req.url)).replace(/^(\.\.[/\\])+/, ""));
+  let size;
+  try {
+    size = statSync(path).size;
+  } catch {
+    res.writeHead(404).end();
+    return;
+  }
+  console.log(`${req.socket.remoteAddress} GET ${req.url} (${size} bytes)`);
+  res.writeHead(200, { "Content-Type": "application/octet-stream", "Content-Length": size });
+  createReadStream(path).pipe(res);
+});
+
+function localAddress() {
+  for (const addrs of Object.values(networkInterfaces())) {
+    for (const a of addrs ?? []) if (a.family === "IPv4" && !a.internal) return a.address;
+  }
+  return "127.0.0.1";
+}
+
+async function updateLamp(ip, url) {
+  const start = Date.now();
+  const r = await fetch(`http://${ip}/ota`, {
+    method: "POST",
+    headers: { Authorization: `Bearer ${process.env.LAMP_OTA_TOKEN ?? ""}` },
+    body: url,
+  });
+  if (!r.ok) throw new Error(`POST /ota: ${r.status} ${await r.text()}`);
+  for (;;) {
+    await new Promise((res) => setTimeout(res, 1000));
+    let s;
+    try {
+      s = await (await fetch(`http://${ip}/ota`)).json();
+    } catch {
+      console.log(`${ip}: gone, rebooting after ${Date.now() - start} ms`);
+      return;
+    }
+    console.log(`${ip}: ${s.state} ${s.received} received, ${s.written} written`);
+    if (s.state === "failed") throw new Error(s.error);
+  }
+}
+
+server.listen(port, async () => {
+  const url = `http://${localAddress()}:${port}/${file}`;
+  console.log(`serving ${url}`);
+  if (!lamps.length) return;
+  const results = await Promise.allSettled(lamps.map((ip) => updateLamp(ip, url)));
+  results.forEach((r, i) => {
+    if (r.status === "rejected") console.error(`${lamps[i]}: ${r.reason.message}`);
+  });
+  server.close();
+});
@@ -0,0 +1,40 @@
+#!/usr/bin/env node
+// Concurrent-client load test for the provisioning portal.
+// Each simulated phone loops over the requests a real one makes on join
+// (OS connectivity probe -> redirect, then the portal page).
+// Usage: node bin/portal_bench.mjs [host=192.168.4.1] [clients=8] [seconds=10]
+
+const host = process.argv[2] ?? "192.168.4.1";
+const clients = Number(process.argv[3] ?? 8);
+const seconds = Number(process.argv[4] ?? 10);
+const paths = ["/generate_204", "/hotspot-detect.html", "/"];
+
+let ok = 0;
+let failed = 0;
+const samples = [];
+const end = performance.now() + seconds * 1000;
+
+async function phone() {
+  for (let i = 0; performance.now() < end; i++) {
+    const start = performance.now();
+    try {
+      const res = await fetch(`http://${host}${paths[i % paths.length]}`, {
+        redirect: "manual",
+        signal: AbortSignal.timeout(5000),
+      });
+      await res.arrayBuffer();
+      ok++;
+      samples.push(performance.now() - start);
+    } catch {
+      failed++;
+    }
+  }
+}
+
+await Promise.all(Array.from({ length: clients }, phone));
+samples.sort((a, b) => a - b);
+const at = (p) => samples[Math.min(samples.length - 1, Math.floor(p * samples.length))] ?? NaN;
+console.log(
+  `clients=${clients} ok=${ok} failed=${failed} req/s=${(ok / seconds).toFixed(1)} ` +
+    `p50=${at(0.5).toFixed(1)}ms p99=${at(0.99).toFixed(1)}ms`,
+);
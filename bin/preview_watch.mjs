@@ -0,0 +1,98 @@
+#!/usr/bin/env node
+// Shows a lamp's live preview (CONFIG_LAMP_PREVIEW) in the terminal: one
+// row of coloured blocks per message, with its size and kind. Messages are
+// delta-coded against the previous one (see main/frame_delta.h); after a
+// lost message the row is held until the next keyframe.
+// Usage: node bin/preview_watch.mjs [--url mqtt://localhost:1883]
+//          [--topic esp001/preview]
+// Needs the mqtt package: (cd bin && npm install)
+
+import mqtt from "mqtt";
+
+const OP_SKIP = 0x00;
+const OP_COPY = 0x40;
+const OP_FILL = 0x80;
+const FLAG_KEYFRAME = 0x01;
+
+const opts = { url: "mqtt://localhost:1883", topic: "esp001/preview" };
+const argv = process.argv.slice(2);
+for (let i = 0; i < argv.length; i += 2) {
+  const key = argv[i].replace(/^--/, "");
+  if (!(key in opts)) throw new Error(`unknown option --${key}`);
+  opts[key] = argv[i + 1];
+}
+
+// Returns false for a malformed message
+function apply(msg, frame) {
+  if (msg.length < 4 || msg.readUInt16LE(2) !== frame.length / 3) return false;
+  if (msg[0] & FLAG_KEYFRAME) frame.fill(0);
+  let i = 0;
+  for (let p = 4; p < msg.length; ) {
+    const op = msg[p++];
+    const run = (op & 0x3f) + 1;
+    if (i + run > frame.length / 3) return false;
+    switch (op & 0xc0) {
+      case OP_SKIP:
+        break;
+      case OP_COPY:
+        msg.copy(frame, i * 3, p, p + run * 3);
+        p += run * 3;
+        break;
+      case OP_FILL:
+        for (let k = 0; k < run; k++) msg.copy(frame, (i + k) * 3, p, p + 3);
+        p += 3;
+        break;
+      default:
+        return false;
+    }
+    i += run;
+  }
+  return true;
+}
+
+function render(frame) {
+  let row = "";
+  for (let i = 0; i < frame.length; i += 3) {
+    row += `\x1b[48;2;${frame[i]};${frame[i + 1]};${frame[i + 2]}m  `;
+  }
+  return row + "\x1b[0m";
+}
+
+let frame = null;
+let lastSeq = null;
+let totalBytes = 0;
+let messages = 0;
+
+const client = await mqtt.connectAsync(opts.url, {
+  clientId: `preview-${process.pid}`,
+  protocolVersion: 5,
+  properties: { topicAliasMaximum: 4 },
+});
+client.on("message", (topic, msg) => {
+  if (msg.length < 4) return;
+  const keyframe = (msg[0] & FLAG_KEYFRAME) !== 0;
+  const seq = msg[1];
+  const count = msg.readUInt16LE(2);
+  totalBytes += msg.length;
+  messages++;
+
+  const inSequence = lastSeq !== null && seq === ((lastSeq + 1) & 0xff);
+  lastSeq = seq;
+  if (!keyframe && !(frame && inSequence)) {
+    console.log(`seq ${seq}: missed a message, waiting for a keyframe`);
+    frame = null;
+    return;
+  }
+  if (!frame || frame.length !== count * 3) frame = Buffer.alloc(count * 3);
+  if (!apply(msg, frame)) {
+    console.log(`seq ${seq}: malformed`);
+    frame = null;
+    return;
+  }
+  console.log(
+    `${render(frame)} ${keyframe ? "key  " : "delta"} ${String(msg.length).padStart(4)} B` +
+      ` (avg ${(totalBytes / messages).toFixed(1)} B)`,
+  );
+});
+await client.subscribeAsync(opts.topic, { qos: 0 });
+console.log(`watching ${opts.topic} on ${opts.url}`);
@@ -0,0 +1,72 @@
+#!/usr/bin/env node
+// Reads a frame log recorded by the linux simulator (sim/).
+// Prints frame count, frame interval and command-to-frame latency, a digest
+// of the distinct frame contents (timestamps excluded) for golden tests, and
+// optionally renders the run as a PPM, one row per frame.
+// Usage: node bin/sim_frames.mjs frames.bin [out.ppm]
+
+import { createHash } from "node:crypto";
+import { readFileSync, writeFileSync } from "node:fs";
+
+const path = process.argv[2] ?? "frames.bin";
+const ppmPath = process.argv[3];
+
+const buf = readFileSync(path);
+if (buf.subarray(0, 8).toString() !== "LAMPSIM1") {
+  console.error(`${path}: not a simulator frame log`);
+  process.exit(1);
+}
+
+const frames = [];
+const commands = [];
+for (let off = 8; off + 11 <= buf.length; ) {
+  const type = String.fromCharCode(buf[off]);
+  const t = Number(buf.readBigUInt64LE(off + 1));
+  const len = buf.readUInt16LE(off + 9);
+  const data = buf.subarray(off + 11, off + 11 + len);
+  off += 11 + len;
+  if (type === "F") frames.push({ t, data });
+  else if (type === "C") commands.push({ t, text: data.toString() });
+}
+
+function pct(sorted, p) {
+  if (!sorted.length) return NaN;
+  return sorted[Math.min(sorted.length - 1, Math.floor((sorted.length * p) / 100))];
+}
+
+const intervals = frames.slice(1).map((f, i) => (f.t - frames[i].t) / 1000).sort((a, b) => a - b);
+console.log(`frames ${frames.length}, interval ms p50 ${pct(intervals, 50)} p99 ${pct(intervals, 99)}`);
+
+// Latency: command until the first frame that differs from the one before it
+for (const c of commands) {
+  let j = frames.findIndex((f) => f.t >= c.t);
+  const before = j > 0 ? frames[j - 1].data : undefined;
+  while (before && j < frames.length && frames[j].data.equals(before)) j++;
+  const ms = j >= 0 && j < frames.length ? ((frames[j].t - c.t) / 1000).toFixed(2) : "n/a";
+  console.log(`command ${c.text}: first changed frame after ${ms} ms`);
+}
+
+const hash = createHash("sha256");
+let prev;
+for (const f of frames) {
+  if (prev && f.data.equals(prev)) continue;
+  hash.update(f.data);
+  prev = f.data;
+}
+console.log(`digest ${hash.digest("hex")}`);
+
+if (ppmPath && frames.length) {
+  // Strip bytes are in the default G, B, R order of a 3-channel chipset
+  const width = Math.max(...frames.map((f) => f.data.length)) / 3;
+  const pixels = Buffer.alloc(width * frames.length * 3);
+  frames.forEach((f, row) => {
+    for (let x = 0; x < f.data.length / 3; x++) {
+      const o = (row * width + x) * 3;
+      pixels[o] = f.data[x * 3 + 2];
+      pixels[o + 1] = f.data[x * 3];
+      pixels[o + 2] = f.data[x * 3 + 1];
+    }
+  });
+  writeFileSync(ppmPath, Buffer.concat([Buffer.from(`P6\n${width} ${frames.length}\n255\n`), pixels]));
+  console.log(`wrote ${ppmPath} (${width}x${frames.length})`);
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Run the MQTT benchmark against a local mosquitto and keep the result for
+# comparing firmware builds.
+# Usage: bin/soak.sh <label> [mqtt_bench.mjs options...]
+# e.g.   bin/soak.sh before-change --rate 200 --duration 600
+set -euo pipefail
+
+BIN_DIR="$(cd "$(dirname "$0")" && pwd)"
+RESULTS_DIR="$BIN_DIR/../bench-results"
+LABEL="${1:?usage: soak.sh <label> [options...]}"
+shift
+
+mkdir -p "$RESULTS_DIR"
+[ -d "$BIN_DIR/node_modules/mqtt" ] || (cd "$BIN_DIR" && npm install --silent)
+
+BROKER_PID=""
+if ! nc -z localhost 1883 2>/dev/null; then
+  mosquitto -c "$BIN_DIR/mosquitto.conf" &
+  BROKER_PID=$!
+  trap '[ -n "$BROKER_PID" ] && kill "$BROKER_PID"' EXIT
+  sleep 1
+fi
+
+node "$BIN_DIR/mqtt_bench.mjs" --label "$LABEL" \
+  --out "$RESULTS_DIR/$LABEL-$(date +%Y%m%d-%H%M%S).json" "$@"
@@ -0,0 +1,91 @@
+#!/usr/bin/env node
+// Decodes a lamp trace dump (see main/trace.h) into time-ordered text.
+// Input is either the binary MQTT payload
+//   mosquitto_sub -t esp001/trace -C 1 > trace.bin
+// or a serial log containing the TRACE: hex lines TRACE SERIAL prints.
+// Usage: node bin/trace_decode.mjs trace.bin|monitor.log
+
+import { readFileSync } from "node:fs";
+
+const path = process.argv[2];
+if (!path) {
+  console.error("usage: trace_decode.mjs trace.bin|monitor.log");
+  process.exit(1);
+}
+
+let buf = readFileSync(path);
+if (buf.subarray(0, 4).toString() !== "LTRC") {
+  // Serial log: the last complete TRACE: block wins
+  const hex = [];
+  let block = [];
+  for (const line of buf.toString().split(/\r?\n/)) {
+    const m = line.match(/TRACE:([0-9a-fEND]+)\s*$/);
+    if (!m) continue;
+    if (m[1] === "END") {
+      hex.splice(0, hex.length, ...block);
+      block = [];
+    } else {
+      block.push(m[1]);
+    }
+  }
+  buf = Buffer.from(hex.join(""), "hex");
+}
+if (buf.subarray(0, 4).toString() !== "LTRC" || buf[4] !== 1) {
+  console.error(`${path}: no version 1 trace dump found`);
+  process.exit(1);
+}
+
+const cores = buf[5];
+const perCore = buf.readUInt16LE(6);
+const now = buf.readUInt32LE(8);
+const EVENT_SIZE = 16;
+
+const LED_STATES = ["COLOR", "CHASE", "PULSE", "CLIP"];
+const BUTTON = ["NONE", "PRESS", "RELEASE", "LONG_PRESS", "DOUBLE_PRESS"];
+const METHODS = ["GET", "POST"];
+const rgb = (v) => "#" + v.toString(16).padStart(6, "0").toUpperCase();
+const i32 = (v) => v | 0;
+
+const FORMATS = {
+  1: (a0, a1, a2) => `mqtt rx topic ${a0} B, data ${a1} B, msg id ${a2}`,
+  2: (a0, a1) => `command ${LED_STATES[a0] ?? a0} ${rgb(a1)}`,
+  3: (a0) => `command rejected (${a0} B)`,
+  4: (a0, a1) => `led state ${LED_STATES[a0] ?? a0} ${rgb(a1)}`,
+  5: (a0, a1) => `state published ${LED_STATES[a0] ?? a0} ${rgb(a1)}`,
+  6: (a0) => `button ${BUTTON[a0] ?? a0}`,
+  7: (a0, a1) => `dns query ${a0} B -> ${i32(a1) < 0 ? "dropped" : i32(a1) ? `${a1} B reply` : "no reply"}`,
+  8: (a0, a1) => `http ${METHODS[a0] ?? a0} ${i32(a1) < 0 ? "fallback" : `route ${a1}`}`,
+  9: (a0, a1) => `command scheduled (${a0} B) for clock ms ${a1}`,
+};
+
+const events = [];
+let off = 12;
+for (let core = 0; core < cores; core++) {
+  const head = buf.readUInt32LE(off);
+  off += 4;
+  const count = Math.min(head, perCore);
+  // Oldest first: the slot after the newest, or 0 if the ring never wrapped
+  for (let k = 0; k < count; k++) {
+    const slot = (head - count + k) % perCore;
+    const e = off + slot * EVENT_SIZE;
+    const id = buf.readUInt16LE(e + 4);
+    if (!id) continue;
+    events.push({
+      core,
+      // Age relative to the dump; unsigned arithmetic handles the 32-bit wrap
+      age: (now - buf.readUInt32LE(e)) >>> 0,
+      id,
+      a0: buf.readUInt16LE(e + 6),
+      a1: buf.readUInt32LE(e + 8),
+      a2: buf.readUInt32LE(e + 12),
+    });
+  }
+  off += perCore * EVENT_SIZE;
+}
+
+events.sort((x, y) => y.age - x.age);
+for (const e of events) {
+  const text = FORMATS[e.id]?.(e.a0, e.a1, e.a2) ?? `id ${e.id} ${e.a0} ${e.a1} ${e.a2}`;
+  console.log(`-${(e.age / 1000).toFixed(3).padStart(10)} ms  cpu${e.core}  ${text}`);
+}
+console.log(`${events.length} events, ${cores} core(s) x ${perCore}`);
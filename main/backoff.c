@@ -0,0 +1,35 @@
+#include "backoff.h"
+
+static uint32_t xorshift32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+void backoff_init(backoff_t *b, uint32_t base_ms, uint32_t max_ms,
+                  uint32_t seed) {
+  b->base_ms = base_ms ? base_ms : 1;
+  b->max_ms = max_ms < b->base_ms ? b->base_ms : max_ms;
+  b->attempt = 0;
+  b->rng = seed ? seed : 0x9E3779B9;
+}
+
+void backoff_reset(backoff_t *b) { b->attempt = 0; }
+
+uint32_t backoff_next_ms(backoff_t *b) {
+  // base * 2^attempt without overflowing, clamped to the cap
+  uint32_t step = b->base_ms;
+  for (uint32_t i = 0; i < b->attempt && step < b->max_ms; i++) {
+    step <<= 1;
+  }
+  if (step > b->max_ms) {
+    step = b->max_ms;
+  } else {
+    b->attempt++;
+  }
+
+  uint32_t half = step / 2;
+  return half + xorshift32(&b->rng) % (step - half + 1);
+}
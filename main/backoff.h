@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// Exponential backoff with "equal jitter": each delay is half the
+// exponential step plus a random amount up to the other half, capped at
+// max_ms. Pure logic (no clock, no RTOS) so it can be exercised on the host.
+typedef struct {
+  uint32_t base_ms;
+  uint32_t max_ms;
+  uint32_t attempt;
+  uint32_t rng; // xorshift32 state, never 0
+} backoff_t;
+
+// WiFi's reconnect schedule (wifi.c): 500 ms doubling to a 60 s cap. Here
+// so the sim's backoffcheck replays the values the lamp actually uses.
+#define WIFI_RECONNECT_BASE_MS 500
+#define WIFI_RECONNECT_MAX_MS 60000
+
+void backoff_init(backoff_t *b, uint32_t base_ms, uint32_t max_ms,
+                  uint32_t seed);
+void backoff_reset(backoff_t *b);
+uint32_t backoff_next_ms(backoff_t *b);
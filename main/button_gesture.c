@@ -0,0 +1,130 @@
+#include "button_gesture.h"
+#include <stddef.h>
+
+static void emit(button_gesture_output_t *out, button_event_t event) {
+  if (out->count < BUTTON_GESTURE_MAX_EVENTS) {
+    out->events[out->count++] = event;
+  }
+}
+
+static void start_press(button_gesture_t *bg, int64_t now_us,
+                        button_gesture_output_t *out) {
+  emit(out, BUTTON_EVENT_PRESS);
+  if (bg->click_pending &&
+      now_us - bg->release_us <= bg->cfg.double_press_us) {
+    emit(out, BUTTON_EVENT_DOUBLE_PRESS);
+    // A third press starts a new sequence rather than another double
+    bg->click_pending = false;
+    bg->press_us = INT64_MIN;
+  } else {
+    bg->press_us = now_us;
+  }
+  bg->long_fired = false;
+  bg->phase = BUTTON_PRESS_LOCKOUT;
+  bg->deadline_us = now_us + bg->cfg.debounce_us;
+}
+
+static void start_release(button_gesture_t *bg, int64_t now_us,
+                          button_gesture_output_t *out) {
+  emit(out, BUTTON_EVENT_RELEASE);
+  // Only a short press that didn't already complete a double counts as the
+  // first half of a double press
+  bg->click_pending = !bg->long_fired && bg->press_us != INT64_MIN;
+  bg->release_us = now_us;
+  bg->phase = BUTTON_RELEASE_LOCKOUT;
+  bg->deadline_us = now_us + bg->cfg.debounce_us;
+}
+
+void button_gesture_init(button_gesture_t *bg,
+                         const button_gesture_config_t *cfg) {
+  *bg = (button_gesture_t){
+      .cfg = *cfg,
+      .phase = BUTTON_IDLE,
+      .deadline_us = BUTTON_GESTURE_NO_DEADLINE,
+  };
+}
+
+void button_gesture_edge(button_gesture_t *bg, bool pressed, int64_t now_us,
+                         button_gesture_output_t *out) {
+  out->count = 0;
+  bg->raw_pressed = pressed;
+
+  switch (bg->phase) {
+  case BUTTON_IDLE:
+    if (pressed) {
+      start_press(bg, now_us, out);
+    }
+    break;
+  case BUTTON_PRESSED:
+    if (!pressed) {
+      start_release(bg, now_us, out);
+    }
+    break;
+  case BUTTON_PRESS_LOCKOUT:
+  case BUTTON_RELEASE_LOCKOUT:
+    // Contact bounce: only the level at the end of the lockout matters
+    break;
+  }
+}
+
+void button_gesture_timeout(button_gesture_t *bg, int64_t now_us,
+                            button_gesture_output_t *out) {
+  out->count = 0;
+  if (now_us < bg->deadline_us) {
+    return;
+  }
+
+  switch (bg->phase) {
+  case BUTTON_PRESS_LOCKOUT:
+    if (bg->raw_pressed) {
+      bg->phase = BUTTON_PRESSED;
+      bg->deadline_us = bg->press_us == INT64_MIN
+                            ? BUTTON_GESTURE_NO_DEADLINE
+                            : bg->press_us + bg->cfg.long_press_us;
+      // The lockout may already have outlasted a very short long-press time
+      if (bg->deadline_us <= now_us) {
+        button_gesture_timeout(bg, now_us, out);
+      }
+    } else {
+      // Released during the lockout: a tap shorter than the debounce time
+      start_release(bg, now_us, out);
+    }
+    break;
+  case BUTTON_PRESSED:
+    emit(out, BUTTON_EVENT_LONG_PRESS);
+    bg->long_fired = true;
+    bg->deadline_us = BUTTON_GESTURE_NO_DEADLINE;
+    break;
+  case BUTTON_RELEASE_LOCKOUT:
+    bg->phase = BUTTON_IDLE;
+    bg->deadline_us = BUTTON_GESTURE_NO_DEADLINE;
+    if (bg->raw_pressed) {
+      // Pressed again before the bounce settled
+      start_press(bg, now_us, out);
+    }
+    break;
+  case BUTTON_IDLE:
+    bg->deadline_us = BUTTON_GESTURE_NO_DEADLINE;
+    break;
+  }
+}
+
+int64_t button_gesture_deadline(const button_gesture_t *bg) {
+  return bg->deadline_us;
+}
+
+const char *button_event_name(button_event_t event) {
+  switch (event) {
+  case BUTTON_EVENT_PRESS:
+    return "PRESS";
+  case BUTTON_EVENT_RELEASE:
+    return "RELEASE";
+  case BUTTON_EVENT_LONG_PRESS:
+    return "LONG_PRESS";
+  case BUTTON_EVENT_DOUBLE_PRESS:
+    return "DOUBLE_PRESS";
+  case BUTTON_EVENT_NONE:
+    break;
+  }
+  return "NONE";
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Debounce + gesture state machine for an active-low push button. Pure
+// logic: the caller feeds raw edges and deadline expiries with timestamps,
+// so it runs the same on the device and against synthetic edge timelines on
+// the host.
+//
+// PRESS is reported on the very first falling edge (leading-edge debounce),
+// after which edges are ignored for debounce_us and the level is re-sampled.
+typedef enum {
+  BUTTON_EVENT_NONE = 0,
+  BUTTON_EVENT_PRESS,
+  BUTTON_EVENT_RELEASE,
+  BUTTON_EVENT_LONG_PRESS,
+  BUTTON_EVENT_DOUBLE_PRESS,
+} button_event_t;
+
+// The lamp button's timings (main.c), shared with the sim's gesturecheck
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_LONG_PRESS_MS 800
+#define BUTTON_DOUBLE_PRESS_MS 300
+
+#define BUTTON_GESTURE_MAX_EVENTS 2
+#define BUTTON_GESTURE_NO_DEADLINE INT64_MAX
+
+typedef struct {
+  int64_t debounce_us;
+  int64_t long_press_us;
+  int64_t double_press_us; // max gap between a release and the next press
+} button_gesture_config_t;
+
+typedef enum {
+  BUTTON_IDLE,
+  BUTTON_PRESS_LOCKOUT,
+  BUTTON_PRESSED,
+  BUTTON_RELEASE_LOCKOUT,
+} button_phase_t;
+
+typedef struct {
+  button_gesture_config_t cfg;
+  button_phase_t phase;
+  bool raw_pressed; // last level seen from the ISR
+  bool long_fired;
+  bool click_pending; // a short press was released, waiting for a second
+  int64_t press_us;
+  int64_t release_us;
+  int64_t deadline_us;
+} button_gesture_t;
+
+typedef struct {
+  uint8_t count;
+  button_event_t events[BUTTON_GESTURE_MAX_EVENTS];
+} button_gesture_output_t;
+
+void button_gesture_init(button_gesture_t *bg,
+                         const button_gesture_config_t *cfg);
+// Raw edge from the ISR: pressed is the level after the edge
+void button_gesture_edge(button_gesture_t *bg, bool pressed, int64_t now_us,
+                         button_gesture_output_t *out);
+// Call once now_us >= button_gesture_deadline()
+void button_gesture_timeout(button_gesture_t *bg, int64_t now_us,
+                            button_gesture_output_t *out);
+int64_t button_gesture_deadline(const button_gesture_t *bg);
+const char *button_event_name(button_event_t event);
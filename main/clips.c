@@ -0,0 +1,289 @@
+#include "clips.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_TAG "CLIPS"
+#define CLIPS_PARTITION_LABEL "clips"
+#define CLIPS_MAGIC "LCLP"
+#define CLIPS_VERSION 1
+#define CLIPS_FLAG_LOOP 0x01
+#define FLASH_SECTOR_SIZE 4096
+
+// All fields little-endian, read in place from the mapping
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint16_t version;
+  uint16_t count;
+  uint32_t size; // whole image, header included
+  uint32_t crc;  // CRC-32 of everything after the header
+} clips_header_t;
+
+typedef struct __attribute__((packed)) {
+  char name[CLIPS_NAME_LEN];
+  uint32_t offset; // first frame, from the start of the image
+  uint16_t frames;
+  uint16_t frame_ms;
+  uint16_t leds;
+  uint8_t channels;
+  uint8_t order; // led_color_order_t
+  uint8_t flags;
+  uint8_t reserved[3];
+} clips_entry_t;
+
+_Static_assert(sizeof(clips_header_t) == 16, "clips header layout");
+_Static_assert(sizeof(clips_entry_t) == 32, "clips entry layout");
+
+static const esp_partition_t *partition = NULL;
+// Held by the LED loop while a mapped frame is on the wire, and by uploads
+// while they swap the mapping
+static SemaphoreHandle_t map_lock = NULL;
+static StaticSemaphore_t map_lock_buf;
+static esp_partition_mmap_handle_t map_handle;
+static const uint8_t *image = NULL; // NULL: nothing valid mapped
+// Held by the task sending an upload, from its first chunk to its end, and
+// guarding the upload_* state below
+static SemaphoreHandle_t upload_lock = NULL;
+static StaticSemaphore_t upload_lock_buf;
+static size_t upload_next = 0;      // offset the next upload chunk must have
+static size_t upload_total = 0;     // 0: no upload in progress
+static bool upload_same = false;    // image already stored, nothing to write
+
+static const clips_header_t *header(void) {
+  return (const clips_header_t *)image;
+}
+
+static const clips_entry_t *entry(uint8_t index) {
+  return (const clips_entry_t *)(image + sizeof(clips_header_t)) + index;
+}
+
+static bool image_valid(const uint8_t *data, size_t space) {
+  const clips_header_t *h = (const clips_header_t *)data;
+  if (memcmp(h->magic, CLIPS_MAGIC, 4) != 0 || h->version != CLIPS_VERSION ||
+      h->size > space ||
+      sizeof(*h) + (size_t)h->count * sizeof(clips_entry_t) > h->size) {
+    return false;
+  }
+  if (esp_rom_crc32_le(0, data + sizeof(*h), h->size - sizeof(*h)) != h->crc) {
+    ESP_LOGW(MODULE_TAG, "Image CRC mismatch");
+    return false;
+  }
+  const clips_entry_t *e = (const clips_entry_t *)(data + sizeof(*h));
+  for (int i = 0; i < h->count; i++, e++) {
+    size_t frame_len = (size_t)e->leds * e->channels;
+    if (memchr(e->name, '\0', sizeof(e->name)) == NULL || e->frames == 0 ||
+        e->frame_ms == 0 || e->leds == 0 ||
+        (e->channels != 3 && e->channels != 4) ||
+        e->order >= LED_ORDER_COUNT || e->offset > h->size ||
+        (size_t)e->frames * frame_len > h->size - e->offset) {
+      ESP_LOGW(MODULE_TAG, "Clip %d is malformed", i);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Caller holds map_lock
+static void map_image(void) {
+  const void *ptr;
+  esp_err_t err = esp_partition_mmap(partition, 0, partition->size,
+                                     ESP_PARTITION_MMAP_DATA, &ptr,
+                                     &map_handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(MODULE_TAG, "mmap failed: %s", esp_err_to_name(err));
+    return;
+  }
+  if (!image_valid(ptr, partition->size)) {
+    esp_partition_munmap(map_handle);
+    ESP_LOGI(MODULE_TAG, "No clips stored");
+    return;
+  }
+  image = ptr;
+  ESP_LOGI(MODULE_TAG, "%d clips, %" PRIu32 " bytes", header()->count,
+           header()->size);
+}
+
+// Caller holds map_lock
+static void unmap_image(void) {
+  if (image) {
+    esp_partition_munmap(map_handle);
+    image = NULL;
+  }
+}
+
+void clips_init(void) {
+  map_lock = xSemaphoreCreateMutexStatic(&map_lock_buf);
+  upload_lock = xSemaphoreCreateMutexStatic(&upload_lock_buf);
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                       ESP_PARTITION_SUBTYPE_ANY,
+                                       CLIPS_PARTITION_LABEL);
+  if (!partition) {
+    ESP_LOGW(MODULE_TAG, "No \"%s\" partition", CLIPS_PARTITION_LABEL);
+    return;
+  }
+  xSemaphoreTake(map_lock, portMAX_DELAY);
+  map_image();
+  xSemaphoreGive(map_lock);
+}
+
+int clips_find(const char *name, size_t len) {
+  int found = -1;
+  if (!map_lock || len >= CLIPS_NAME_LEN) {
+    return -1;
+  }
+  xSemaphoreTake(map_lock, portMAX_DELAY);
+  for (int i = 0; image && i < header()->count; i++) {
+    if (strncmp(entry(i)->name, name, len) == 0 &&
+        entry(i)->name[len] == '\0') {
+      found = i;
+      break;
+    }
+  }
+  xSemaphoreGive(map_lock);
+  return found;
+}
+
+bool clips_name(uint8_t index, char *buf, size_t len) {
+  bool ok = false;
+  if (!map_lock) {
+    return false;
+  }
+  xSemaphoreTake(map_lock, portMAX_DELAY);
+  if (image && index < header()->count) {
+    snprintf(buf, len, "%s", entry(index)->name);
+    ok = true;
+  }
+  xSemaphoreGive(map_lock);
+  return ok;
+}
+
+bool clips_frame_begin(uint8_t index, uint32_t elapsed_ms,
+                       const led_chipset_t *chipset, uint16_t num_leds,
+                       clips_frame_t *frame) {
+  if (!map_lock) {
+    return false;
+  }
+  xSemaphoreTake(map_lock, portMAX_DELAY);
+  if (!image || index >= header()->count) {
+    xSemaphoreGive(map_lock);
+    return false;
+  }
+  const clips_entry_t *e = entry(index);
+  if (e->leds != num_leds || e->channels != chipset->channels ||
+      e->order != chipset->order) {
+    xSemaphoreGive(map_lock);
+    return false;
+  }
+
+  uint32_t n = elapsed_ms / e->frame_ms;
+  frame->frame_ms = e->frame_ms;
+  if (e->flags & CLIPS_FLAG_LOOP) {
+    n %= e->frames;
+  } else if (n >= e->frames) {
+    // One-shot clips hold their last frame
+    n = e->frames - 1;
+    frame->frame_ms = 0;
+  }
+  frame->len = (size_t)e->leds * e->channels;
+  frame->data = image + e->offset + n * frame->len;
+  return true;
+}
+
+void clips_frame_done(void) { xSemaphoreGive(map_lock); }
+
+static bool upload_owned(void) {
+  return xSemaphoreGetMutexHolder(upload_lock) == xTaskGetCurrentTaskHandle();
+}
+
+// Caller owns the upload
+static void upload_end(void) {
+  upload_total = 0;
+  xSemaphoreGive(upload_lock);
+}
+
+static esp_err_t upload_fail(esp_err_t err, const char *what) {
+  ESP_LOGW(MODULE_TAG, "Upload failed: %s (%s)", what, esp_err_to_name(err));
+  upload_end();
+  return err;
+}
+
+esp_err_t clips_upload_chunk(size_t offset, const void *data, size_t len,
+                             size_t total) {
+  esp_err_t err;
+  if (!partition) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  // A first chunk from the owner restarts its upload; anyone else waits for
+  // the current one to end
+  if (!upload_owned() &&
+      (offset != 0 || xSemaphoreTake(upload_lock, 0) != pdTRUE)) {
+    ESP_LOGW(MODULE_TAG, "Upload refused: %s",
+             offset ? "no upload started" : "another upload in progress");
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  if (offset == 0) {
+    if (total < sizeof(clips_header_t) || total > partition->size) {
+      return upload_fail(ESP_ERR_INVALID_SIZE, "image size");
+    }
+    upload_total = total;
+    upload_next = 0;
+    // Same size and CRC as the stored image (a retained message delivered
+    // again): keep the flash as it is
+    upload_same = image && len >= sizeof(clips_header_t) &&
+                  memcmp(data, image, sizeof(clips_header_t)) == 0;
+  }
+  if (offset == 0 && !upload_same) {
+    // Playback must be off the old image before it is erased
+    xSemaphoreTake(map_lock, portMAX_DELAY);
+    unmap_image();
+    xSemaphoreGive(map_lock);
+    size_t erase = (total + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    err = esp_partition_erase_range(partition, 0, erase);
+    if (err != ESP_OK) {
+      return upload_fail(err, "erase");
+    }
+    ESP_LOGI(MODULE_TAG, "Receiving %u byte image", (unsigned)total);
+  }
+
+  if (upload_total == 0 || total != upload_total || offset != upload_next ||
+      len > upload_total - offset) {
+    return upload_fail(ESP_ERR_INVALID_STATE, "chunk out of sequence");
+  }
+  if (!upload_same) {
+    err = esp_partition_write(partition, offset, data, len);
+    if (err != ESP_OK) {
+      return upload_fail(err, "write");
+    }
+  }
+  upload_next += len;
+
+  if (upload_next < upload_total) {
+    return ESP_OK;
+  }
+  if (upload_same) {
+    upload_end();
+    return ESP_OK;
+  }
+  xSemaphoreTake(map_lock, portMAX_DELAY);
+  map_image();
+  bool ok = image != NULL;
+  xSemaphoreGive(map_lock);
+  if (!ok) {
+    return upload_fail(ESP_ERR_INVALID_CRC, "image check");
+  }
+  upload_end();
+  return ESP_OK;
+}
+
+void clips_upload_abort(void) {
+  if (partition && upload_owned()) {
+    upload_fail(ESP_ERR_INVALID_STATE, "aborted");
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "esp_err.h"
+#include "led_chipset.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Prebaked animations in the "clips" data partition, memory-mapped once and
+// played by handing the mapped frames straight to the RMT transmit. Frames
+// are stored in wire format (the strip's color order and channel count), so
+// playback copies nothing. Image format: see bin/clip_pack.mjs.
+//
+// The RMT ISR reads the frames through the flash cache: keep
+// CONFIG_RMT_ISR_IRAM_SAFE off so it waits out flash writes instead.
+
+#define CLIPS_NAME_LEN 16 // including the terminator
+
+typedef struct {
+  const uint8_t *data; // mapped flash, valid until clips_frame_done()
+  size_t len;
+  uint32_t frame_ms; // until the next frame, 0 once a one-shot clip ended
+} clips_frame_t;
+
+// Maps the partition and checks the image; an empty or invalid one just
+// leaves no clips to play
+void clips_init(void);
+// Index of the named clip, -1 if there is none
+int clips_find(const char *name, size_t len);
+// False if there is no clip at index
+bool clips_name(uint8_t index, char *buf, size_t len);
+
+// Looks up the frame due elapsed_ms into the clip and holds the mapping until
+// clips_frame_done(). False (nothing held) if the clip is gone or was baked
+// for a different strip.
+bool clips_frame_begin(uint8_t index, uint32_t elapsed_ms,
+                       const led_chipset_t *chipset, uint16_t num_leds,
+                       clips_frame_t *frame);
+void clips_frame_done(void);
+
+// Streams a new image into the partition. Chunks must arrive in order: the
+// one at offset 0 unmaps the current image and erases, the one ending at
+// total checks and maps the new image. Anything out of order aborts the
+// upload and leaves no clips until the next complete one. The task that
+// sent the first chunk owns the upload until it ends; chunks from any other
+// task get ESP_ERR_INVALID_STATE meanwhile.
+esp_err_t clips_upload_chunk(size_t offset, const void *data, size_t len,
+                             size_t total);
+// Gives up the calling task's upload, if it owns one, when the rest of the
+// image will not come
+void clips_upload_abort(void);
@@ -0,0 +1,365 @@
+#include "command.h"
+#include "clips.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "lamp_clock.h"
+#include "led.h"
+#include "schedule.h"
+#include "settings.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define MODULE_TAG "COMMAND"
+// Sanity limit on execute-at times; anything later is more likely a bad
+// timestamp than a plan
+#define SCHEDULE_MAX_AHEAD_MS (24 * 60 * 60 * 1000ULL)
+
+static inline int hex_nibble(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool parse_rgb24(const char *data, size_t len, uint8_t *r, uint8_t *g,
+                 uint8_t *b) {
+
+  if (!data || !r || !g || !b) {
+    ESP_LOGI("RGB_PARSE", "Missing params");
+    return false;
+  }
+
+  // Must be exactly "#RRGGBB"
+  if (len != 7) {
+    ESP_LOGI("RGB_PARSE", "Len was %zu, not 7", len);
+    return false;
+  }
+  if (data[0] != '#') {
+    ESP_LOGI("RGB_PARSE", "Data started with %c, not #", data[0]);
+    return false;
+  }
+
+  uint32_t value = 0;
+
+  for (int i = 1; i < 7; i++) {
+    int nibble = hex_nibble(data[i]);
+    if (nibble < 0) {
+      return false;
+    }
+    value = (value << 4) | (uint32_t)nibble;
+  }
+
+  *r = (value >> 16) & 0xFF;
+  *g = (value >> 8) & 0xFF;
+  *b = value & 0xFF;
+
+  return true;
+}
+
+#define COLOR_MSG "COLOR#"
+#define COLOR_MSG_PREFIX_LEN sizeof(COLOR_MSG) - 1
+#define PULSE_MSG "PULSE#"
+#define PULSE_MSG_PREFIX_LEN sizeof(PULSE_MSG) - 1
+#define CHASE_MSG "CHASE"
+#define CHASE_MSG_PREFIX_LEN sizeof(CHASE_MSG) - 1
+#define CLIP_MSG "CLIP#"
+#define CLIP_MSG_PREFIX_LEN sizeof(CLIP_MSG) - 1
+#define LAYER_MSG "LAYER"
+#define LAYER_MSG_PREFIX_LEN sizeof(LAYER_MSG) - 1
+
+// Parses the effect part of a command: COLOR#RRGGBB, PULSE#RRGGBB or CHASE
+static bool parse_effect(const char *data, size_t len, led_command_t *cmd) {
+  uint8_t r, g, b;
+
+  // ---------- COLOR#RRGGBB ----------
+  if (len > COLOR_MSG_PREFIX_LEN &&
+      memcmp(data, COLOR_MSG, COLOR_MSG_PREFIX_LEN) == 0) {
+    size_t offset = COLOR_MSG_PREFIX_LEN - 1;
+    const char *data_start = data + offset;
+    size_t data_len = len - offset;
+    ESP_LOGD(MODULE_TAG, "RGB segment received using offset %zu: %.*s",
+             offset, (int)data_len, data_start);
+
+    if (parse_rgb24(data_start, data_len, &r, &g, &b)) {
+      *cmd = (led_command_t){STATE_COLOR, r, g, b};
+      return true;
+    }
+    ESP_LOGW(MODULE_TAG, "Invalid ON color payload");
+    return false;
+  }
+
+  // ---------- PULSE#RRGGBB ----------
+  if (len > PULSE_MSG_PREFIX_LEN &&
+      memcmp(data, PULSE_MSG, PULSE_MSG_PREFIX_LEN) == 0) {
+    size_t offset = PULSE_MSG_PREFIX_LEN - 1;
+    const char *data_start = data + offset;
+    size_t data_len = len - offset;
+    ESP_LOGD(MODULE_TAG, "RGB segment received using offset %zu: %.*s",
+             offset, (int)data_len, data_start);
+
+    if (parse_rgb24(data_start, data_len, &r, &g, &b)) {
+      *cmd = (led_command_t){STATE_PULSE_WAVE, r, g, b};
+      return true;
+    }
+    ESP_LOGW(MODULE_TAG, "Invalid PULSE color payload");
+    return false;
+  }
+
+  // ---------- CHASE ----------
+  if (len == CHASE_MSG_PREFIX_LEN &&
+      memcmp(data, CHASE_MSG, CHASE_MSG_PREFIX_LEN) == 0) {
+    *cmd = (led_command_t){STATE_RAINBOW_CHASE, 0, 0, 0};
+    return true;
+  }
+
+  return false;
+}
+
+static bool parse_blend_mode(const char *name, blend_mode_t *mode) {
+  static const struct {
+    const char *name;
+    blend_mode_t mode;
+  } modes[] = {
+      {"REPLACE", BLEND_REPLACE},
+      {"ADD", BLEND_ADD},
+      {"MULTIPLY", BLEND_MULTIPLY},
+      {"ALPHA", BLEND_ALPHA},
+  };
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+    if (strcmp(name, modes[i].name) == 0) {
+      *mode = modes[i].mode;
+      return true;
+    }
+  }
+  return false;
+}
+
+// LAYER<n> <start> <count> <mode> <opacity> <effect> | LAYER<n> OFF
+static bool handle_layer(const char *data, size_t len, uint32_t start_ms) {
+  char buf[64];
+  if (len >= sizeof(buf)) {
+    return false;
+  }
+  memcpy(buf, data, len);
+  buf[len] = '\0';
+
+  unsigned index;
+  int consumed = 0;
+  if (sscanf(buf, LAYER_MSG "%u %n", &index, &consumed) != 1 || !consumed) {
+    return false;
+  }
+  const char *rest = buf + consumed;
+
+  led_layer_t layer = {0};
+  if (strcmp(rest, "OFF") != 0) {
+    unsigned start, count, opacity;
+    char mode[10];
+    int effect_at = 0;
+    if (sscanf(rest, "%u %u %9s %u %n", &start, &count, mode, &opacity,
+               &effect_at) != 4 ||
+        !effect_at || start > UINT16_MAX || count > UINT16_MAX ||
+        opacity > 255 || !parse_blend_mode(mode, &layer.mode) ||
+        !parse_effect(rest + effect_at, strlen(rest + effect_at),
+                      &layer.effect)) {
+      ESP_LOGW(MODULE_TAG, "Invalid LAYER payload");
+      return false;
+    }
+    layer.enabled = true;
+    layer.start = start;
+    layer.count = count;
+    layer.opacity = opacity;
+    layer.start_ms = start_ms;
+  }
+
+  if (index > UINT8_MAX || !set_led_layer(index, &layer)) {
+    ESP_LOGW(MODULE_TAG, "LAYER index or range out of bounds");
+    return false;
+  }
+  const led_command_t *cmd = &layer.effect;
+  trace_event(TRACE_COMMAND, cmd->state, cmd->r << 16 | cmd->g << 8 | cmd->b,
+              index);
+  return true;
+}
+
+// Only reaches the RAM cache; the flash write happens later, once for a
+// burst of commands
+static void remember(const char *data, size_t len) {
+#ifdef CONFIG_LAMP_RESTORE_LAST_COMMAND
+  settings_set_str(SETTING_LAST_COMMAND, data, len);
+#endif
+}
+
+// Runs a command now, its effect timed from start_ms on the lamp clock
+static bool run_command(const char *data, size_t len, uint32_t start_ms) {
+  led_command_t cmd;
+  if (parse_effect(data, len, &cmd)) {
+    trace_event(TRACE_COMMAND, cmd.state, cmd.r << 16 | cmd.g << 8 | cmd.b, 0);
+    set_led_cmd_at(cmd, start_ms);
+    remember(data, len);
+    return true;
+  }
+
+  // ---------- CLIP#name ----------
+  if (len > CLIP_MSG_PREFIX_LEN &&
+      memcmp(data, CLIP_MSG, CLIP_MSG_PREFIX_LEN) == 0) {
+    int index = clips_find(data + CLIP_MSG_PREFIX_LEN,
+                           len - CLIP_MSG_PREFIX_LEN);
+    if (index < 0) {
+      ESP_LOGW(MODULE_TAG, "No clip %.*s", (int)(len - CLIP_MSG_PREFIX_LEN),
+               data + CLIP_MSG_PREFIX_LEN);
+      trace_event(TRACE_COMMAND_REJECTED, len, 0, 0);
+      return false;
+    }
+    cmd = (led_command_t){STATE_CLIP, index, 0, 0};
+    trace_event(TRACE_COMMAND, cmd.state, cmd.r << 16, 0);
+    set_led_cmd_at(cmd, start_ms);
+    remember(data, len);
+    return true;
+  }
+
+  // ---------- LAYER<n> ... ----------
+  if (len > LAYER_MSG_PREFIX_LEN &&
+      memcmp(data, LAYER_MSG, LAYER_MSG_PREFIX_LEN) == 0) {
+    if (handle_layer(data, len, start_ms)) {
+      return true;
+    }
+    trace_event(TRACE_COMMAND_REJECTED, len, 0, 0);
+    return false;
+  }
+
+  // ---------- TRACE / TRACE SERIAL ----------
+  if (len == 5 && memcmp(data, "TRACE", 5) == 0) {
+    return trace_publish();
+  }
+  if (len == 12 && memcmp(data, "TRACE SERIAL", 12) == 0) {
+    trace_print();
+    return true;
+  }
+
+  trace_event(TRACE_COMMAND_REJECTED, len, 0, 0);
+  ESP_LOGW(MODULE_TAG, "Unknown command");
+  return false;
+}
+
+// ---------- @<epoch_ms> <command> ----------
+// Held until due, then run with its effect timed from the due time rather
+// than from whenever it actually ran: lamps given the same timestamp start
+// in phase, and one that ran late jumps to where the others already are.
+
+// Commands arrive from the MQTT and httpd tasks and due ones run on the
+// esp_timer task; the lock covers the queue and the timer together
+static SemaphoreHandle_t schedule_lock = NULL;
+static StaticSemaphore_t schedule_lock_buf;
+static schedule_t schedule;
+static esp_timer_handle_t schedule_timer = NULL;
+
+// Re-arms the timer for the earliest entry. Called with schedule_lock held,
+// so a push can't land between the peek and the start and be overridden by
+// a later deadline.
+static void schedule_arm(void) {
+  uint64_t due_ms;
+  bool pending = schedule_next_due(&schedule, &due_ms);
+
+  esp_timer_stop(schedule_timer);
+  if (pending) {
+    uint64_t now_ms = lamp_clock_epoch_ms();
+    uint64_t delay_ms = due_ms > now_ms ? due_ms - now_ms : 0;
+    esp_timer_start_once(schedule_timer, delay_ms * 1000);
+  }
+}
+
+static void schedule_timer_cb(void *arg) {
+  schedule_entry_t entry;
+  for (;;) {
+    xSemaphoreTake(schedule_lock, portMAX_DELAY);
+    bool due = schedule_pop_due(&schedule, lamp_clock_epoch_ms(), &entry);
+    if (!due) {
+      // Also reached when the clock was slewed and the timer fired a little
+      // early: anything not yet due stays queued for this re-arm
+      schedule_arm();
+      xSemaphoreGive(schedule_lock);
+      break;
+    }
+    xSemaphoreGive(schedule_lock);
+    run_command(entry.cmd, entry.len, (uint32_t)entry.due_ms);
+  }
+}
+
+static bool handle_scheduled(const char *data, size_t len) {
+  char stamp[24];
+  const char *space = memchr(data, ' ', len);
+  size_t stamp_len = space ? (size_t)(space - data) - 1 : 0;
+  if (!space || stamp_len == 0 || stamp_len >= sizeof(stamp)) {
+    ESP_LOGW(MODULE_TAG, "Invalid schedule payload");
+    return false;
+  }
+  memcpy(stamp, data + 1, stamp_len);
+  stamp[stamp_len] = '\0';
+  char *end;
+  uint64_t due_ms = strtoull(stamp, &end, 10);
+  const char *cmd = space + 1;
+  size_t cmd_len = len - (cmd - data);
+  if (*end != '\0' || cmd_len == 0 || cmd[0] == '@') {
+    ESP_LOGW(MODULE_TAG, "Invalid schedule payload");
+    return false;
+  }
+  // Due commands run on the esp_timer task, which a dump would hold up for
+  // every other timer
+  if (cmd_len >= 5 && memcmp(cmd, "TRACE", 5) == 0) {
+    ESP_LOGW(MODULE_TAG, "TRACE cannot be scheduled");
+    return false;
+  }
+
+  // Until SNTP has set the clock, "when" means nothing
+  if (!lamp_clock_synced()) {
+    ESP_LOGW(MODULE_TAG, "Clock not synced, cannot schedule");
+    return false;
+  }
+  if (due_ms > lamp_clock_epoch_ms() + SCHEDULE_MAX_AHEAD_MS) {
+    ESP_LOGW(MODULE_TAG, "Scheduled too far ahead");
+    return false;
+  }
+
+  if (!schedule_timer) {
+    ESP_LOGW(MODULE_TAG, "Scheduling not initialized");
+    return false;
+  }
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  bool queued = schedule_push(&schedule, due_ms, cmd, cmd_len);
+  if (queued) {
+    schedule_arm();
+  }
+  xSemaphoreGive(schedule_lock);
+  if (!queued) {
+    ESP_LOGW(MODULE_TAG, "Schedule full");
+    return false;
+  }
+  trace_event(TRACE_COMMAND_SCHEDULED, cmd_len, (uint32_t)due_ms, 0);
+  return true;
+}
+
+void command_init(void) {
+  schedule_lock = xSemaphoreCreateMutexStatic(&schedule_lock_buf);
+  const esp_timer_create_args_t args = {
+      .callback = schedule_timer_cb,
+      .name = "cmd_schedule",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&args, &schedule_timer));
+}
+
+bool handle_command(const char *data, size_t len) {
+  if (len > 0 && data[0] == '@') {
+    if (handle_scheduled(data, len)) {
+      return true;
+    }
+    trace_event(TRACE_COMMAND_REJECTED, len, 0, 0);
+    return false;
+  }
+  return run_command(data, len, lamp_clock_ms());
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Creates the timer and lock behind "@<epoch_ms>" commands; call once before
+// any transport can deliver a command
+void command_init(void);
+bool parse_rgb24(const char *data, size_t len, uint8_t *r, uint8_t *g,
+                 uint8_t *b);
+// Parses a text command (COLOR#RRGGBB, PULSE#RRGGBB, CHASE) and hands it to
+// the LED loop as the base layer. LAYER<n> <start> <count> <mode> <opacity>
+// <effect> stacks an effect over part of the strip (mode is REPLACE, ADD,
+// MULTIPLY or ALPHA), LAYER<n> OFF removes it. CLIP#name plays a stored clip
+// (see clips.h) in place of all layers. TRACE publishes the event trace
+// instead, TRACE SERIAL prints it (slowly) on the console. Any but the
+// TRACE ones prefixed with "@<epoch_ms> " is held until that time on the
+// SNTP-synced lamp clock and then runs with its effect timed from it, so
+// lamps sent the same timestamp change together and stay in phase. Base
+// layer commands are remembered for the next boot (settings.h). Shared by
+// every transport (MQTT, local HTTP/WebSocket, ...). Does not assume
+// null-termination. Returns false for unknown or malformed commands.
+bool handle_command(const char *data, size_t len);
@@ -0,0 +1,87 @@
+#include "compositor.h"
+#include "wave.h"
+#include <string.h>
+
+static inline uint8_t add_sat8(uint8_t a, uint8_t b) {
+  uint16_t s = a + b;
+  return s > 255 ? 255 : s;
+}
+
+static void blend_span(rgb8_t *dst, const rgb8_t *src, int n,
+                       blend_mode_t mode, uint8_t op) {
+  switch (mode) {
+  case BLEND_REPLACE:
+    for (int i = 0; i < n; i++) {
+      dst[i].r = scale8(src[i].r, op);
+      dst[i].g = scale8(src[i].g, op);
+      dst[i].b = scale8(src[i].b, op);
+    }
+    break;
+  case BLEND_ADD:
+    for (int i = 0; i < n; i++) {
+      dst[i].r = add_sat8(dst[i].r, scale8(src[i].r, op));
+      dst[i].g = add_sat8(dst[i].g, scale8(src[i].g, op));
+      dst[i].b = add_sat8(dst[i].b, scale8(src[i].b, op));
+    }
+    break;
+  case BLEND_MULTIPLY:
+    for (int i = 0; i < n; i++) {
+      dst[i].r = scale8(dst[i].r, 255 - scale8(255 - src[i].r, op));
+      dst[i].g = scale8(dst[i].g, 255 - scale8(255 - src[i].g, op));
+      dst[i].b = scale8(dst[i].b, 255 - scale8(255 - src[i].b, op));
+    }
+    break;
+  case BLEND_ALPHA:
+    for (int i = 0; i < n; i++) {
+      dst[i].r = scale8(src[i].r, op) + scale8(dst[i].r, 255 - op);
+      dst[i].g = scale8(src[i].g, op) + scale8(dst[i].g, 255 - op);
+      dst[i].b = scale8(src[i].b, op) + scale8(dst[i].b, 255 - op);
+    }
+    break;
+  }
+}
+
+void compositor_blend(const compositor_layer_t *layers, int num_layers,
+                      rgb8_t *out, uint16_t num_leds) {
+  uint16_t edges[2 * COMPOSITOR_MAX_LAYERS + 2];
+  int num_edges = 0;
+
+  if (num_layers > COMPOSITOR_MAX_LAYERS) {
+    num_layers = COMPOSITOR_MAX_LAYERS;
+  }
+  memset(out, 0, num_leds * sizeof(*out));
+
+  // Span boundaries: the frame ends and every layer edge, sorted
+  edges[num_edges++] = 0;
+  edges[num_edges++] = num_leds;
+  for (int l = 0; l < num_layers; l++) {
+    uint32_t end = layers[l].start + layers[l].count;
+    edges[num_edges++] =
+        layers[l].start < num_leds ? layers[l].start : num_leds;
+    edges[num_edges++] = end < num_leds ? end : num_leds;
+  }
+  for (int i = 1; i < num_edges; i++) {
+    uint16_t e = edges[i];
+    int j = i;
+    for (; j > 0 && edges[j - 1] > e; j--) {
+      edges[j] = edges[j - 1];
+    }
+    edges[j] = e;
+  }
+
+  for (int e = 0; e + 1 < num_edges; e++) {
+    uint16_t a = edges[e];
+    uint16_t b = edges[e + 1];
+    if (a == b) {
+      continue;
+    }
+    for (int l = 0; l < num_layers; l++) {
+      const compositor_layer_t *layer = &layers[l];
+      if (a < layer->start || a >= layer->start + layer->count) {
+        continue;
+      }
+      blend_span(out + a, layer->pixels + (a - layer->start), b - a,
+                 layer->mode, layer->opacity);
+    }
+  }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+
+typedef struct {
+  uint8_t r;
+  uint8_t g;
+  uint8_t b;
+} rgb8_t;
+
+typedef enum {
+  BLEND_REPLACE,  // layer hides what is below, dimmed by opacity
+  BLEND_ADD,      // saturating add
+  BLEND_MULTIPLY, // darkens; opacity fades towards no effect
+  BLEND_ALPHA,    // cross-fade by opacity
+} blend_mode_t;
+
+#define COMPOSITOR_MAX_LAYERS 4
+
+typedef struct {
+  uint16_t start;
+  uint16_t count;
+  blend_mode_t mode;
+  uint8_t opacity;      // 0-255
+  const rgb8_t *pixels; // count pixels, already rendered
+} compositor_layer_t;
+
+// Merges layers bottom (index 0) to top over black into out[num_leds], in
+// 8-bit fixed point. One pass over the frame, split into spans where the set
+// of covering layers is constant, so there are no per-pixel range checks and
+// the blend mode is resolved once per span and layer.
+void compositor_blend(const compositor_layer_t *layers, int num_layers,
+                      rgb8_t *out, uint16_t num_leds);
@@ -10,21 +10,28 @@
 #include <sys/param.h>
 
 #include "esp_check.h"
+#include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_system.h"
 
 #include "dns_server.h"
+#include "trace.h"
 #include "lwip/err.h"
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 
 #define DNS_PORT (53)
-#define DNS_MAX_LEN (256)
-
-#define OPCODE_MASK (0x7800)
-#define QR_FLAG (1 << 7)
+#define DNS_MAX_QUESTIONS (4)
+#define DNS_RULE_SLOTS (DNS_SERVER_MAX_ITEMS * 2)
+
+// Header flags, host byte order
+#define FLAG_QR (0x8000)
+#define FLAG_AA (0x0400)
+#define OPCODE_SHIFT (11)
+#define OPCODE_MASK (0xF)
+#define RCODE_NXDOMAIN (3)
 #define QD_TYPE_A (0x0001)
 #define ANS_TTL_SEC (300)
 
@@ -41,7 +48,7 @@ typedef struct __attribute__((__packed__)) {
 } dns_header_t;
 
 // DNS Question Packet
-typedef struct {
+typedef struct __attribute__((__packed__)) {
   uint16_t type;
   uint16_t class;
 } dns_question_t;
@@ -56,249 +63,322 @@ typedef struct __attribute__((__packed__)) {
   uint32_t ip_addr;
 } dns_answer_t;
 
+// A configured rule, precompiled: name hash for the lookup table and the
+// answer IP, cached (for if_key rules it is refreshed on IP events)
+typedef struct {
+  uint32_t hash;
+  const char *name;
+  esp_netif_t *netif;
+  esp_ip4_addr_t ip;
+} dns_rule_t;
+
 // DNS server handle
 struct dns_server_handle {
-  bool started;
-  TaskHandle_t task;
+  esp_event_handler_instance_t ip_event;
+  int wildcard;                 // index of the "*" rule, -1 if none
+  int8_t slot[DNS_RULE_SLOTS];  // open-addressed hash -> rule index, -1 empty
   int num_of_entries;
-  dns_entry_pair_t entry[];
+  dns_rule_t rule[DNS_SERVER_MAX_ITEMS];
 };
 
+// Only the captive portal runs a DNS server, one at a time, from its own
+// socket loop, so its state lives in static memory
+static struct dns_server_handle server_storage;
+static bool server_in_use = false;
+
+static inline uint8_t lower(uint8_t c) {
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a over the lower-cased, dot-separated name
+#define FNV_OFFSET (2166136261u)
+#define FNV_PRIME (16777619u)
+
+static uint32_t hash_name(const char *name) {
+  uint32_t hash = FNV_OFFSET;
+  for (; *name; name++) {
+    hash = (hash ^ lower(*name)) * FNV_PRIME;
+  }
+  return hash;
+}
+
 /*
-    Parse the name from the packet from the DNS name format to a regular
-   .-seperated name returns the pointer to the next part of the packet
+    Walks the wire-format QNAME at `label`, hashing it exactly like
+    hash_name() would hash its dotted form, without copying it anywhere.
+    Returns the pointer to the first byte after the name, or NULL if the name
+    is malformed, compressed or runs past `end`.
 */
-static char *parse_dns_name(char *raw_name, char *parsed_name,
-                            size_t parsed_name_max_len) {
-
-  char *label = raw_name;
-  char *name_itr = parsed_name;
-  int name_len = 0;
-
-  do {
-    int sub_name_len = *label;
-    // (len + 1) since we are adding  a '.'
-    name_len += (sub_name_len + 1);
-    if (name_len > parsed_name_max_len) {
+static const uint8_t *hash_dns_name(const uint8_t *label, const uint8_t *end,
+                                    uint32_t *hash) {
+  uint32_t h = FNV_OFFSET;
+  bool first = true;
+
+  while (label < end && *label != 0) {
+    uint8_t len = *label++;
+    if (len > 63 || label + len >= end) {
       return NULL;
     }
-
-    // Copy the sub name that follows the the label
-    memcpy(name_itr, label + 1, sub_name_len);
-    name_itr[sub_name_len] = '.';
-    name_itr += (sub_name_len + 1);
-    label += sub_name_len + 1;
-  } while (*label != 0);
-
-  // Terminate the final string, replacing the last '.'
-  parsed_name[name_len - 1] = '\0';
-  // Return pointer to first char after the name
+    if (!first) {
+      h = (h ^ '.') * FNV_PRIME;
+    }
+    first = false;
+    for (const uint8_t *c = label; c < label + len; c++) {
+      h = (h ^ lower(*c)) * FNV_PRIME;
+    }
+    label += len;
+  }
+  if (label >= end) {
+    return NULL;
+  }
+  *hash = h;
   return label + 1;
 }
 
-// Parses the DNS request and prepares a DNS response with the IP of the softAP
-static int parse_dns_request(char *req, size_t req_len, char *dns_reply,
-                             size_t dns_reply_max_len, dns_server_handle_t h) {
-  if (req_len > dns_reply_max_len) {
-    return -1;
+// Compares an already bounds-checked wire-format name with a dotted name
+static bool dns_name_equals(const uint8_t *label, const char *name) {
+  bool first = true;
+  while (*label != 0) {
+    if (!first && *name++ != '.') {
+      return false;
+    }
+    first = false;
+    for (uint8_t len = *label++; len; len--, label++, name++) {
+      if (*name == '\0' || lower(*label) != lower(*name)) {
+        return false;
+      }
+    }
   }
+  return *name == '\0';
+}
 
-  // Prepare the reply
-  memset(dns_reply, 0, dns_reply_max_len);
-  memcpy(dns_reply, req, req_len);
+static void refresh_rule_ip(dns_rule_t *rule) {
+  esp_netif_ip_info_t ip_info;
+  if (rule->netif && esp_netif_get_ip_info(rule->netif, &ip_info) == ESP_OK) {
+    rule->ip.addr = ip_info.ip.addr;
+  }
+}
 
-  // Endianess of NW packet different from chip
-  dns_header_t *header = (dns_header_t *)dns_reply;
-  ESP_LOGD(TAG, "DNS query with header id: 0x%X, flags: 0x%X, qd_count: %d",
-           ntohs(header->id), ntohs(header->flags), ntohs(header->qd_count));
+static void dns_ip_event_handler(void *arg, esp_event_base_t base,
+                                 int32_t event_id, void *event_data) {
+  dns_server_handle_t h = arg;
+  for (int i = 0; i < h->num_of_entries; i++) {
+    refresh_rule_ip(&h->rule[i]);
+  }
+}
 
-  // Not a standard query
-  if ((header->flags & OPCODE_MASK) != 0) {
-    return 0;
+static dns_rule_t *find_rule(dns_server_handle_t h, const uint8_t *qname,
+                             uint32_t hash) {
+  for (int n = 0, s = hash % DNS_RULE_SLOTS; n < DNS_RULE_SLOTS;
+       n++, s = (s + 1) % DNS_RULE_SLOTS) {
+    int idx = h->slot[s];
+    if (idx < 0) {
+      break;
+    }
+    if (h->rule[idx].hash == hash &&
+        dns_name_equals(qname, h->rule[idx].name)) {
+      return &h->rule[idx];
+    }
   }
+  return h->wildcard >= 0 ? &h->rule[h->wildcard] : NULL;
+}
 
-  // Set question response flag
-  header->flags |= QR_FLAG;
+/*
+    Turns the DNS request in `buf` into the reply, in place: the question
+    section is kept, anything after it (EDNS etc.) is dropped and the answers
+    are written from there on. Returns the reply length, 0 if the packet
+    should be ignored, or -1 if it doesn't fit / is malformed.
+*/
+static int build_dns_reply(uint8_t *buf, size_t len, size_t cap,
+                           dns_server_handle_t h) {
+  if (len < sizeof(dns_header_t)) {
+    return -1;
+  }
 
+  dns_header_t *header = (dns_header_t *)buf;
+  uint16_t flags = ntohs(header->flags);
   uint16_t qd_count = ntohs(header->qd_count);
-  header->an_count = htons(qd_count);
 
-  int reply_len = qd_count * sizeof(dns_answer_t) + req_len;
-  if (reply_len > dns_reply_max_len) {
+  // Not a standard query, or not a query at all
+  if ((flags & FLAG_QR) || ((flags >> OPCODE_SHIFT) & OPCODE_MASK) != 0) {
+    return 0;
+  }
+  if (qd_count == 0 || qd_count > DNS_MAX_QUESTIONS) {
     return -1;
   }
 
-  // Pointer to current answer and question
-  char *cur_ans_ptr = dns_reply + req_len;
-  char *cur_qd_ptr = dns_reply + sizeof(dns_header_t);
-  char name[128];
-
-  // Respond to all questions based on configured rules
-  for (int qd_i = 0; qd_i < qd_count; qd_i++) {
-    char *name_end_ptr = parse_dns_name(cur_qd_ptr, name, sizeof(name));
-    if (name_end_ptr == NULL) {
-      ESP_LOGE(TAG, "Failed to parse DNS question: %s", cur_qd_ptr);
+  // Resolve every question before writing, since the answers overwrite
+  // whatever followed the question section
+  const uint8_t *end = buf + len;
+  const uint8_t *qd_ptr = buf + sizeof(dns_header_t);
+  const uint8_t *qname[DNS_MAX_QUESTIONS];
+  const dns_rule_t *match[DNS_MAX_QUESTIONS];
+  uint16_t qd_type[DNS_MAX_QUESTIONS];
+  bool any_match = false;
+
+  for (int i = 0; i < qd_count; i++) {
+    uint32_t hash;
+    const uint8_t *name_end = hash_dns_name(qd_ptr, end, &hash);
+    if (name_end == NULL || name_end + sizeof(dns_question_t) > end) {
       return -1;
     }
+    dns_question_t question;
+    memcpy(&question, name_end, sizeof(question));
+
+    qname[i] = qd_ptr;
+    qd_type[i] = ntohs(question.type);
+    match[i] = find_rule(h, qd_ptr, hash);
+    any_match |= match[i] != NULL;
+    qd_ptr = name_end + sizeof(dns_question_t);
+  }
 
-    dns_question_t *question = (dns_question_t *)(name_end_ptr);
-    uint16_t qd_type = ntohs(question->type);
-    uint16_t qd_class = ntohs(question->class);
-
-    ESP_LOGD(TAG, "Received type: %d | Class: %d | Question for: %s", qd_type,
-             qd_class, name);
-
-    if (qd_type == QD_TYPE_A) {
-      esp_ip4_addr_t ip = {.addr = IPADDR_ANY};
-      // Check the configured rules to decide whether to answer this question or
-      // not
-      for (int i = 0; i < h->num_of_entries; ++i) {
-        // check if the name either corresponds to the entry, or if we should
-        // answer to all queries ("*")
-        if (strcmp(h->entry[i].name, "*") == 0 ||
-            strcmp(h->entry[i].name, name) == 0) {
-          if (h->entry[i].if_key) {
-            esp_netif_ip_info_t ip_info;
-            esp_netif_get_ip_info(
-                esp_netif_get_handle_from_ifkey(h->entry[i].if_key), &ip_info);
-            ip.addr = ip_info.ip.addr;
-            break;
-          } else if (h->entry->ip.addr != IPADDR_ANY) {
-            ip.addr = h->entry[i].ip.addr;
-            break;
-          }
-        }
-      }
-      if (ip.addr ==
-          IPADDR_ANY) { // no rule applies, continue with another question
+  uint8_t *ans_ptr = buf + (qd_ptr - buf);
+  uint16_t an_count = 0;
+  flags |= FLAG_QR | FLAG_AA;
+  if (!any_match) {
+    // Nothing here answers for this name: NXDOMAIN, no answer section
+    flags |= RCODE_NXDOMAIN;
+  }
+
+  for (int i = 0; i < qd_count; i++) {
+    // Matching names get an empty NOERROR for AAAA, HTTPS etc. so clients
+    // fall back to the A record straight away instead of timing out
+    if (!match[i] || qd_type[i] != QD_TYPE_A) {
+      continue;
+    }
+    dns_rule_t *rule = (dns_rule_t *)match[i];
+    if (rule->ip.addr == IPADDR_ANY) {
+      refresh_rule_ip(rule);
+      if (rule->ip.addr == IPADDR_ANY) {
         continue;
       }
-      dns_answer_t *answer = (dns_answer_t *)cur_ans_ptr;
+    }
+    if (ans_ptr + sizeof(dns_answer_t) > buf + cap) {
+      return -1;
+    }
 
-      answer->ptr_offset = htons(0xC000 | (cur_qd_ptr - dns_reply));
-      answer->type = htons(qd_type);
-      answer->class = htons(qd_class);
-      answer->ttl = htonl(ANS_TTL_SEC);
+    dns_answer_t answer = {
+        .ptr_offset = htons(0xC000 | (qname[i] - buf)),
+        .type = htons(QD_TYPE_A),
+        .class = htons(1),
+        .ttl = htonl(ANS_TTL_SEC),
+        .addr_len = htons(sizeof(rule->ip.addr)),
+        .ip_addr = rule->ip.addr,
+    };
+    memcpy(ans_ptr, &answer, sizeof(answer));
+    ans_ptr += sizeof(answer);
+    an_count++;
+  }
 
-      ESP_LOGD(TAG, "Answer with PTR offset: 0x%" PRIX16 " and IP 0x%" PRIX32,
-               ntohs(answer->ptr_offset), ip.addr);
+  header->flags = htons(flags);
+  header->an_count = htons(an_count);
+  header->ns_count = 0;
+  header->ar_count = 0;
+  return ans_ptr - buf;
+}
 
-      answer->addr_len = htons(sizeof(ip.addr));
-      answer->ip_addr = ip.addr;
-    }
+int dns_server_open_socket(void) {
+  struct sockaddr_in dest_addr;
+  dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  dest_addr.sin_family = AF_INET;
+  dest_addr.sin_port = htons(DNS_PORT);
+
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  if (sock < 0) {
+    ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+    return -1;
+  }
+
+  int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+  if (err < 0) {
+    ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+    close(sock);
+    return -1;
   }
-  return reply_len;
+  ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
+  return sock;
 }
 
-/*
-    Sets up a socket and listen for DNS queries,
-    replies to all type A queries with the IP of the softAP
-*/
-void dns_server_task(void *pvParameters) {
-  char rx_buffer[256];
-  char addr_str[128];
-  int addr_family;
-  int ip_protocol;
-  dns_server_handle_t handle = pvParameters;
-
-  while (handle->started) {
-
-    struct sockaddr_in dest_addr;
-    dest_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    dest_addr.sin_family = AF_INET;
-    dest_addr.sin_port = htons(DNS_PORT);
-    addr_family = AF_INET;
-    ip_protocol = IPPROTO_IP;
-    inet_ntoa_r(dest_addr.sin_addr, addr_str, sizeof(addr_str) - 1);
-
-    int sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-    if (sock < 0) {
-      ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-      break;
+int dns_server_handle_request(dns_server_handle_t handle, int sock,
+                              uint8_t *buffer, size_t buffer_len) {
+  struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
+  socklen_t socklen = sizeof(source_addr);
+  int len = recvfrom(sock, buffer, buffer_len, 0,
+                     (struct sockaddr *)&source_addr, &socklen);
+
+  // Error occurred during receiving
+  if (len < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
     }
-    ESP_LOGI(TAG, "Socket created");
+    ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+    return -1;
+  }
 
-    int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+  // No per-packet logging: phones send bursts of queries on join
+  int reply_len = build_dns_reply(buffer, len, buffer_len, handle);
+  trace_event(TRACE_DNS_QUERY, len, reply_len, 0);
+  if (reply_len < 0) {
+    ESP_LOGD(TAG, "Dropping malformed DNS request (%d bytes)", len);
+  } else if (reply_len > 0) {
+    int err = sendto(sock, buffer, reply_len, 0,
+                     (struct sockaddr *)&source_addr, socklen);
     if (err < 0) {
-      ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
-    }
-    ESP_LOGI(TAG, "Socket bound, port %d", DNS_PORT);
-
-    while (handle->started) {
-      ESP_LOGI(TAG, "Waiting for data");
-      struct sockaddr_in6 source_addr; // Large enough for both IPv4 or IPv6
-      socklen_t socklen = sizeof(source_addr);
-      int len = recvfrom(sock, rx_buffer, sizeof(rx_buffer) - 1, 0,
-                         (struct sockaddr *)&source_addr, &socklen);
-
-      // Error occurred during receiving
-      if (len < 0) {
-        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-        close(sock);
-        break;
-      }
-      // Data received
-      else {
-        // Get the sender's ip address as string
-        if (source_addr.sin6_family == PF_INET) {
-          inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr.s_addr,
-                      addr_str, sizeof(addr_str) - 1);
-        } else if (source_addr.sin6_family == PF_INET6) {
-          inet6_ntoa_r(source_addr.sin6_addr, addr_str, sizeof(addr_str) - 1);
-        }
-
-        // Null-terminate whatever we received and treat like a string...
-        rx_buffer[len] = 0;
-
-        char reply[DNS_MAX_LEN];
-        int reply_len =
-            parse_dns_request(rx_buffer, len, reply, DNS_MAX_LEN, handle);
-
-        ESP_LOGI(TAG, "Received %d bytes from %s | DNS reply with len: %d", len,
-                 addr_str, reply_len);
-        if (reply_len <= 0) {
-          ESP_LOGE(TAG, "Failed to prepare a DNS reply");
-        } else {
-          int err =
-              sendto(sock, reply, reply_len, 0, (struct sockaddr *)&source_addr,
-                     sizeof(source_addr));
-          if (err < 0) {
-            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-            break;
-          }
-        }
-      }
-    }
-
-    if (sock != -1) {
-      ESP_LOGE(TAG, "Shutting down socket");
-      shutdown(sock, 0);
-      close(sock);
+      ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+      return -1;
     }
   }
-  vTaskDelete(NULL);
+  return 1;
 }
 
-dns_server_handle_t start_dns_server(dns_server_config_t *config) {
-  dns_server_handle_t handle =
-      calloc(1, sizeof(struct dns_server_handle) +
-                    config->num_of_entries * sizeof(dns_entry_pair_t));
-  ESP_RETURN_ON_FALSE(handle, NULL, TAG,
-                      "Failed to allocate dns server handle");
+dns_server_handle_t dns_server_create(dns_server_config_t *config) {
+  ESP_RETURN_ON_FALSE(config->num_of_entries <= DNS_SERVER_MAX_ITEMS, NULL,
+                      TAG, "Too many DNS rules");
+  ESP_RETURN_ON_FALSE(!server_in_use, NULL, TAG,
+                      "DNS server already running");
+  dns_server_handle_t handle = &server_storage;
+  memset(handle, 0, sizeof(*handle));
+  server_in_use = true;
 
-  handle->started = true;
   handle->num_of_entries = config->num_of_entries;
-  memcpy(handle->entry, config->item,
-         config->num_of_entries * sizeof(dns_entry_pair_t));
+  handle->wildcard = -1;
+  memset(handle->slot, -1, sizeof(handle->slot));
+
+  // Compile the rules: wildcard kept aside, exact names into the hash table
+  for (int i = 0; i < config->num_of_entries; i++) {
+    const dns_entry_pair_t *item = &config->item[i];
+    dns_rule_t *rule = &handle->rule[i];
+
+    rule->name = item->name;
+    rule->ip = item->ip;
+    if (item->if_key) {
+      rule->netif = esp_netif_get_handle_from_ifkey(item->if_key);
+      refresh_rule_ip(rule);
+    }
+
+    if (strcmp(item->name, "*") == 0) {
+      if (handle->wildcard < 0) {
+        handle->wildcard = i;
+      }
+      continue;
+    }
+    rule->hash = hash_name(item->name);
+    int s = rule->hash % DNS_RULE_SLOTS;
+    while (handle->slot[s] >= 0) {
+      s = (s + 1) % DNS_RULE_SLOTS;
+    }
+    handle->slot[s] = i;
+  }
 
-  xTaskCreate(dns_server_task, "dns_server", 4096, handle, 5, &handle->task);
+  esp_event_handler_instance_register(IP_EVENT, ESP_EVENT_ANY_ID,
+                                      dns_ip_event_handler, handle,
+                                      &handle->ip_event);
   return handle;
 }
 
-void stop_dns_server(dns_server_handle_t handle) {
+void dns_server_destroy(dns_server_handle_t handle) {
   if (handle) {
-    handle->started = false;
-    vTaskDelete(handle->task);
-    free(handle);
+    esp_event_handler_instance_unregister(IP_EVENT, ESP_EVENT_ANY_ID,
+                                          handle->ip_event);
+    server_in_use = false;
   }
 }
@@ -7,6 +7,8 @@
 #pragma once
 
 #include "esp_netif_ip_addr.h"
+#include <stddef.h>
+#include <stdint.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -52,7 +54,7 @@ typedef struct dns_entry_pair {
  *   .item = { {.name = "my-esp32.com", .ip = { .addr = ESP_IP4TOADDR( 192, 168,
  * 4, 1) } } ,
  *             {.name = "my-utils.com", .ip = { .addr = ESP_IP4TOADDR( 192, 168,
- * 4, 100) } } } }; start_dns_server(&config); \endcode
+ * 4, 100) } } } }; dns_server_create(&config); \endcode
  */
 typedef struct dns_server_config {
   int num_of_entries; /**<! Number of rules specified in the config struct */
@@ -65,21 +67,36 @@ typedef struct dns_server_config {
 typedef struct dns_server_handle *dns_server_handle_t;
 
 /**
- * @brief Set ups and starts a simple DNS server that will respond to all A
- * queries (IPv4) based on configured rules, pairs of name and either IPv4
- * address or a netif ID (to respond by it's IPv4 add)
+ * @brief Compiles the rules into a DNS server handle that answers A
+ * queries (IPv4) by name, with a fixed IPv4 address or a netif's. The caller
+ * runs the socket loop (see dns_server_handle_request()).
  *
  * @param config Configuration structure listing the pairs of (name,
  * IP/netif-id)
  * @return dns_server's handle on success, NULL on failure
  */
-dns_server_handle_t start_dns_server(dns_server_config_t *config);
+dns_server_handle_t dns_server_create(dns_server_config_t *config);
 
 /**
- * @brief Stops and destroys DNS server's task and structs
- * @param handle DNS server's handle to destroy
+ * @brief Releases a handle from dns_server_create()
  */
-void stop_dns_server(dns_server_handle_t handle);
+void dns_server_destroy(dns_server_handle_t handle);
+
+/**
+ * @brief Creates the UDP socket bound to port 53
+ * @return socket fd, or -1 on failure
+ */
+int dns_server_open_socket(void);
+
+/**
+ * @brief Receives one query from `sock` and sends the reply, built in place
+ * in `buffer`
+ *
+ * @return 1 if a packet was processed, 0 if none was pending (non-blocking
+ * socket), -1 on socket error
+ */
+int dns_server_handle_request(dns_server_handle_t handle, int sock,
+                              uint8_t *buffer, size_t buffer_len);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,140 @@
+#include "effects.h"
+#include <string.h>
+
+#define CHASE_STEP_MS 10
+#define PULSE_STEP_MS 30
+// Pulse: 8 doubling steps up to 128, then halving every 6 steps until dark
+#define PULSE_RISE_STEPS 8
+#define PULSE_END_STEP 48
+
+/**
+ * @brief Simple helper function, converting HSV color space to RGB color space
+ *
+ * Wiki: https://en.wikipedia.org/wiki/HSL_and_HSV
+ *
+ */
+void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t *r,
+                       uint32_t *g, uint32_t *b) {
+  h %= 360; // h -> [0,360]
+  uint32_t rgb_max = v * 2.55f;
+  uint32_t rgb_min = rgb_max * (100 - s) / 100.0f;
+
+  uint32_t i = h / 60;
+  uint32_t diff = h % 60;
+
+  // RGB adjustment amount by hue
+  uint32_t rgb_adj = (rgb_max - rgb_min) * diff / 60;
+
+  switch (i) {
+  case 0:
+    *r = rgb_max;
+    *g = rgb_min + rgb_adj;
+    *b = rgb_min;
+    break;
+  case 1:
+    *r = rgb_max - rgb_adj;
+    *g = rgb_max;
+    *b = rgb_min;
+    break;
+  case 2:
+    *r = rgb_min;
+    *g = rgb_max;
+    *b = rgb_min + rgb_adj;
+    break;
+  case 3:
+    *r = rgb_min;
+    *g = rgb_max - rgb_adj;
+    *b = rgb_max;
+    break;
+  case 4:
+    *r = rgb_min + rgb_adj;
+    *g = rgb_min;
+    *b = rgb_max;
+    break;
+  default:
+    *r = rgb_max;
+    *g = rgb_min;
+    *b = rgb_max - rgb_adj;
+    break;
+  }
+}
+
+void effect_start(effect_t *fx, const led_command_t *cmd, uint32_t start_ms) {
+  fx->cmd = *cmd;
+  fx->start_ms = start_ms;
+}
+
+static void fill(rgb8_t *out, uint16_t count, uint8_t r, uint8_t g,
+                 uint8_t b) {
+  for (int i = 0; i < count; i++) {
+    out[i] = (rgb8_t){r, g, b};
+  }
+}
+
+// Every third pixel lit with a rainbow, alternating with an all-dark frame;
+// the lit third moves each step and the hues rotate by 60 degrees per round
+static void render_chase(rgb8_t *out, uint16_t count, uint32_t elapsed_ms) {
+  uint32_t step = elapsed_ms / CHASE_STEP_MS;
+  uint32_t sub = step % 6;
+
+  memset(out, 0, count * sizeof(*out));
+  if (sub & 1) {
+    return;
+  }
+  uint32_t hue_offset = (step / 6) * 60 % 360;
+  for (int j = sub / 2; j < count; j += 3) {
+    uint32_t red, green, blue;
+    led_strip_hsv2rgb(j * 360 / count + hue_offset, 100, 100, &red, &green,
+                      &blue);
+    out[j] = (rgb8_t){red, green, blue};
+  }
+}
+
+static uint8_t pulse_intensity(uint32_t elapsed_ms) {
+  uint32_t step = elapsed_ms / PULSE_STEP_MS;
+  if (step < PULSE_RISE_STEPS) {
+    return 1 << step;
+  }
+  return step < PULSE_END_STEP ? 255 >> (step / 6) : 0;
+}
+
+void effect_render(const effect_t *fx, rgb8_t *out, uint16_t count,
+                   uint32_t now_ms) {
+  const led_command_t *cmd = &fx->cmd;
+  uint32_t elapsed_ms = effect_elapsed_ms(fx, now_ms);
+
+  switch (cmd->state) {
+  case STATE_COLOR:
+    fill(out, count, cmd->r, cmd->g, cmd->b);
+    break;
+  case STATE_RAINBOW_CHASE:
+    render_chase(out, count, elapsed_ms);
+    break;
+  case STATE_PULSE_WAVE: {
+    uint8_t intensity = pulse_intensity(elapsed_ms);
+    fill(out, count, (uint16_t)cmd->r * intensity / 255,
+         (uint16_t)cmd->g * intensity / 255,
+         (uint16_t)cmd->b * intensity / 255);
+    break;
+  }
+  case STATE_CLIP:
+    // Clips go to the strip straight from flash (see led.c); as far as the
+    // compositor is concerned they are black
+    fill(out, count, 0, 0, 0);
+    break;
+  }
+}
+
+uint32_t effect_frame_ms(const effect_t *fx, uint32_t now_ms) {
+  uint32_t elapsed_ms = effect_elapsed_ms(fx, now_ms);
+  switch (fx->cmd.state) {
+  case STATE_RAINBOW_CHASE:
+    return CHASE_STEP_MS - elapsed_ms % CHASE_STEP_MS;
+  case STATE_PULSE_WAVE:
+    return elapsed_ms < PULSE_END_STEP * PULSE_STEP_MS
+               ? PULSE_STEP_MS - elapsed_ms % PULSE_STEP_MS
+               : 0;
+  default:
+    return 0;
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "compositor.h"
+#include "led.h"
+#include <stdint.h>
+
+// An effect is a command plus the time it started; rendering is a pure
+// function of the time since, so any number of layers can run one each.
+typedef struct {
+  led_command_t cmd;
+  uint32_t start_ms;
+} effect_t;
+
+// start_ms is on the lamp clock (lamp_clock.h), so lamps given the same
+// start render the same frame at the same time
+void effect_start(effect_t *fx, const led_command_t *cmd, uint32_t start_ms);
+// Time into the effect; 0 until start_ms, which may lie slightly ahead when
+// the clock is slewed back
+static inline uint32_t effect_elapsed_ms(const effect_t *fx, uint32_t now_ms) {
+  int32_t elapsed = now_ms - fx->start_ms;
+  return elapsed > 0 ? elapsed : 0;
+}
+// Renders count pixels; positions are relative to the start of the layer
+void effect_render(const effect_t *fx, rgb8_t *out, uint16_t count,
+                   uint32_t now_ms);
+// Time until the effect's next step, 0 once it is static. Waking on step
+// boundaries keeps lamps sharing a start time changing frames together.
+uint32_t effect_frame_ms(const effect_t *fx, uint32_t now_ms);
+
+void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t *r,
+                       uint32_t *g, uint32_t *b);
@@ -0,0 +1,123 @@
+#include "frame_delta.h"
+#include <string.h>
+
+#define OP_SKIP 0x00
+#define OP_COPY 0x40
+#define OP_FILL 0x80
+#define OP_KIND_MASK 0xC0
+#define OP_MAX_RUN 64
+
+static inline bool rgb_eq(rgb8_t a, rgb8_t b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static inline uint8_t *put_rgb(uint8_t *p, rgb8_t c) {
+  p[0] = c.r;
+  p[1] = c.g;
+  p[2] = c.b;
+  return p + 3;
+}
+
+size_t frame_delta_encode(const rgb8_t *prev, const rgb8_t *cur,
+                          uint16_t count, uint8_t seq, uint8_t *out) {
+  static const rgb8_t black = {0, 0, 0};
+  uint8_t *p = out;
+  *p++ = prev ? 0 : FRAME_DELTA_FLAG_KEYFRAME;
+  *p++ = seq;
+  *p++ = count & 0xFF;
+  *p++ = count >> 8;
+
+#define UNCHANGED(k) rgb_eq(cur[k], prev ? prev[k] : black)
+  uint16_t i = 0;
+  while (i < count) {
+    if (UNCHANGED(i)) {
+      uint16_t j = i;
+      while (j < count && UNCHANGED(j)) {
+        j++;
+      }
+      if (j == count) {
+        break;
+      }
+      for (uint16_t left = j - i; left; ) {
+        uint16_t run = left < OP_MAX_RUN ? left : OP_MAX_RUN;
+        *p++ = OP_SKIP | (run - 1);
+        left -= run;
+      }
+      i = j;
+      continue;
+    }
+
+    // A run of one colour, changed or not, is a FILL once it covers two
+    // pixels: 4 bytes against 6 or more
+    uint16_t run = 1;
+    while (i + run < count && run < OP_MAX_RUN &&
+           rgb_eq(cur[i + run], cur[i])) {
+      run++;
+    }
+    if (run >= 2) {
+      *p++ = OP_FILL | (run - 1);
+      p = put_rgb(p, cur[i]);
+      i += run;
+      continue;
+    }
+
+    // Literal pixels up to the next unchanged one or the start of a fill
+    uint16_t j = i + 1;
+    while (j < count && j - i < OP_MAX_RUN && !UNCHANGED(j) &&
+           !(j + 1 < count && rgb_eq(cur[j], cur[j + 1]))) {
+      j++;
+    }
+    *p++ = OP_COPY | (j - i - 1);
+    for (; i < j; i++) {
+      p = put_rgb(p, cur[i]);
+    }
+  }
+#undef UNCHANGED
+  return p - out;
+}
+
+bool frame_delta_apply(const uint8_t *msg, size_t len, rgb8_t *frame,
+                       uint16_t count) {
+  if (len < FRAME_DELTA_HEADER_LEN || (msg[2] | msg[3] << 8) != count) {
+    return false;
+  }
+  if (msg[0] & FRAME_DELTA_FLAG_KEYFRAME) {
+    memset(frame, 0, count * sizeof(rgb8_t));
+  }
+
+  const uint8_t *p = msg + FRAME_DELTA_HEADER_LEN;
+  const uint8_t *end = msg + len;
+  uint16_t i = 0;
+  while (p < end) {
+    uint8_t kind = *p & OP_KIND_MASK;
+    uint16_t run = (*p++ & ~OP_KIND_MASK) + 1;
+    if (run > count - i) {
+      return false;
+    }
+    switch (kind) {
+    case OP_SKIP:
+      break;
+    case OP_COPY:
+      if (end - p < 3 * run) {
+        return false;
+      }
+      for (uint16_t k = 0; k < run; k++, p += 3) {
+        frame[i + k] = (rgb8_t){p[0], p[1], p[2]};
+      }
+      break;
+    case OP_FILL:
+      if (end - p < 3) {
+        return false;
+      }
+      for (uint16_t k = 0; k < run; k++) {
+        frame[i + k] = (rgb8_t){p[0], p[1], p[2]};
+      }
+      p += 3;
+      break;
+    default:
+      return false;
+    }
+    i += run;
+  }
+  return true;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "compositor.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Preview stream coding: each message carries only what changed since the
+// previous one.
+//
+//   header  flags (bit 0: keyframe), seq (+1 per message, wraps),
+//           pixel count (uint16 LE)
+//   ops     one byte each: kind in the top two bits, pixel count - 1 in the
+//           low six, so a run covers 1-64 pixels
+//             00 SKIP  unchanged
+//             01 COPY  followed by count RGB triplets
+//             10 FILL  followed by one RGB triplet for all of them
+//
+// A keyframe is coded against an all-black frame: the receiver clears its
+// copy first. Trailing unchanged pixels take no op, so an unchanged frame
+// is the header alone.
+
+#define FRAME_DELTA_HEADER_LEN 4
+#define FRAME_DELTA_FLAG_KEYFRAME 0x01
+// Worst case: every pixel a COPY of its own between one-pixel SKIPs
+#define FRAME_DELTA_MAX_LEN(count) (FRAME_DELTA_HEADER_LEN + 4 * (count))
+
+// Codes cur against prev, or as a keyframe when prev is NULL. out must hold
+// FRAME_DELTA_MAX_LEN(count). Returns the message length.
+size_t frame_delta_encode(const rgb8_t *prev, const rgb8_t *cur,
+                          uint16_t count, uint8_t seq, uint8_t *out);
+// Applies a message to frame; false if it is malformed or for another
+// pixel count. Checking seq for lost messages is up to the caller.
+bool frame_delta_apply(const uint8_t *msg, size_t len, rgb8_t *frame,
+                       uint16_t count);
@@ -0,0 +1,61 @@
+#include "lamp_clock.h"
+#include "esp_log.h"
+#include "esp_netif_sntp.h"
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include <sys/time.h>
+
+#define MODULE_TAG "CLOCK"
+
+static bool started = false;
+static volatile bool synced = false;
+static lamp_clock_step_cb_t step_cb = NULL;
+// Clock minus esp_timer time before the first sync; the clock runs off the
+// same timer until then, so this stays put however late the sync comes
+static int64_t unsynced_offset_ms = 0;
+
+static int64_t timer_ms(void) { return esp_timer_get_time() / 1000; }
+
+static void on_time_sync(struct timeval *tv) {
+  if (!synced) {
+    int64_t synced_ms = (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    int64_t step_ms = synced_ms - timer_ms() - unsynced_offset_ms;
+    ESP_LOGI(MODULE_TAG, "Clock synced, stepped by %lld ms",
+             (long long)step_ms);
+    if (step_cb) {
+      step_cb(step_ms);
+    }
+  }
+  synced = true;
+}
+
+void lamp_clock_on_step(lamp_clock_step_cb_t cb) { step_cb = cb; }
+
+void lamp_clock_start_sync(void) {
+  if (started) {
+    return;
+  }
+  started = true;
+  unsynced_offset_ms = (int64_t)lamp_clock_epoch_ms() - timer_ms();
+
+  esp_sntp_config_t config =
+      ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_LAMP_SNTP_SERVER);
+  config.sync_cb = on_time_sync;
+  // Corrections after the first sync are slewed rather than stepped, so a
+  // running effect never jumps; the first one, from 1970, is stepped
+  config.smooth_sync = true;
+  esp_sntp_set_sync_interval(CONFIG_LAMP_SNTP_SYNC_INTERVAL_S * 1000);
+  esp_err_t err = esp_netif_sntp_init(&config);
+  if (err != ESP_OK) {
+    ESP_LOGE(MODULE_TAG, "SNTP init failed: %s", esp_err_to_name(err));
+    started = false;
+  }
+}
+
+bool lamp_clock_synced(void) { return synced; }
+
+uint64_t lamp_clock_epoch_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
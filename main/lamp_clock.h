@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shared time base for effects and scheduled commands: wall-clock time,
+// disciplined by SNTP once the network is up. Lamps synced to the same
+// server agree on it to within a few ms, so effects that are pure functions
+// of it stay in phase across the fleet.
+
+// Starts SNTP; call once the network is up. Repeated calls are no-ops.
+void lamp_clock_start_sync(void);
+// True once SNTP has set the clock at least once
+bool lamp_clock_synced(void);
+// The first sync steps the clock from time since boot to wall time; cb is
+// then called once, from the SNTP task, with the size of the step so that
+// anything timed on the old clock can move with it
+typedef void (*lamp_clock_step_cb_t)(int64_t step_ms);
+void lamp_clock_on_step(lamp_clock_step_cb_t cb);
+// Milliseconds since the epoch
+uint64_t lamp_clock_epoch_ms(void);
+// The low 32 bits, which is what effect times are kept in: they are only
+// ever subtracted, so the wrap every 49 days is harmless
+static inline uint32_t lamp_clock_ms(void) {
+  return (uint32_t)lamp_clock_epoch_ms();
+}
@@ -4,15 +4,23 @@
  * SPDX-License-Identifier: Unlicense OR CC0-1.0
  */
 #include "led.h"
+#include "clips.h"
 #include "driver/rmt_tx.h"
 #include "driver/rmt_types.h"
+#include "effects.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
 #include "freertos/task.h"
+#include "lamp_clock.h"
 #include "led_strip_encoder.h"
+#include "power.h"
+#include "state_publisher.h"
+#include "trace.h"
 #include <stdint.h>
 #include <string.h>
+#if CONFIG_PM_ENABLE
+#include "driver/gpio.h"
+#endif
 
 #define RMT_LED_STRIP_RESOLUTION_HZ                                            \
   10000000 // 10MHz resolution, 1 tick = 0.1us (led strip needs a high
@@ -20,71 +28,28 @@
 #define RMT_LED_STRIP_GPIO_NUM 13
 
 #define EXAMPLE_LED_NUMBERS 24
-#define EXAMPLE_CHASE_SPEED_MS 10
-#define EXAMPLE_PULSE_WAVE_SPEED_MS 50
-#define EXAMPLE_PULSE_WAVE_AMPLITUDE 255
+// Frame period while nothing animates: the strip is still refreshed so a
+// glitched frame does not stick
+#define LED_IDLE_REFRESH_MS 100
 
 static const char *TAG = "led_control";
 
-static uint8_t led_strip_pixels[EXAMPLE_LED_NUMBERS * 3];
-static QueueHandle_t led_command_queue = NULL;
-typedef struct {
-  uint8_t r;
-  uint8_t g;
-  uint8_t b;
-} rgb8_t;
+static uint8_t
+    led_strip_pixels[EXAMPLE_LED_NUMBERS * LED_CHIPSET_MAX_CHANNELS];
+static size_t led_strip_bytes;
+static const led_chipset_t *chipset;
+static led_pixel_writer_t write_pixels;
+static rgb8_t frame[EXAMPLE_LED_NUMBERS]; // last sent, under frame_lock
+static portMUX_TYPE frame_lock = portMUX_INITIALIZER_UNLOCKED;
+static rgb8_t layer_pixels[LED_MAX_LAYERS][EXAMPLE_LED_NUMBERS];
 
-/**
- * @brief Simple helper function, converting HSV color space to RGB color space
- *
- * Wiki: https://en.wikipedia.org/wiki/HSL_and_HSV
- *
- */
-void led_strip_hsv2rgb(uint32_t h, uint32_t s, uint32_t v, uint32_t *r,
-                       uint32_t *g, uint32_t *b) {
-  h %= 360; // h -> [0,360]
-  uint32_t rgb_max = v * 2.55f;
-  uint32_t rgb_min = rgb_max * (100 - s) / 100.0f;
-
-  uint32_t i = h / 60;
-  uint32_t diff = h % 60;
-
-  // RGB adjustment amount by hue
-  uint32_t rgb_adj = (rgb_max - rgb_min) * diff / 60;
-
-  switch (i) {
-  case 0:
-    *r = rgb_max;
-    *g = rgb_min + rgb_adj;
-    *b = rgb_min;
-    break;
-  case 1:
-    *r = rgb_max - rgb_adj;
-    *g = rgb_max;
-    *b = rgb_min;
-    break;
-  case 2:
-    *r = rgb_min;
-    *g = rgb_max;
-    *b = rgb_min + rgb_adj;
-    break;
-  case 3:
-    *r = rgb_min;
-    *g = rgb_max - rgb_adj;
-    *b = rgb_max;
-    break;
-  case 4:
-    *r = rgb_min + rgb_adj;
-    *g = rgb_min;
-    *b = rgb_max;
-    break;
-  default:
-    *r = rgb_max;
-    *g = rgb_min;
-    *b = rgb_max - rgb_adj;
-    break;
-  }
-}
+// Written by any task, picked up by the LED loop at the start of a frame
+static portMUX_TYPE pending_lock = portMUX_INITIALIZER_UNLOCKED;
+static led_layer_t pending_layers[LED_MAX_LAYERS];
+static uint32_t pending_mask = 0;
+// Sum of clock steps the loop has yet to apply to the running effects
+static uint32_t pending_step_ms = 0;
+static TaskHandle_t led_task = NULL;
 
 static rmt_encoder_handle_t led_encoder = NULL;
 static rmt_channel_handle_t led_chan = NULL;
@@ -103,143 +68,234 @@ void init_led_strip(void) {
   };
   ESP_ERROR_CHECK(rmt_new_tx_channel(&tx_chan_config, &led_chan));
 
-  ESP_LOGI(TAG, "Install led strip encoder");
+  chipset = led_chipset_configured();
+  ESP_LOGI(TAG, "Install led strip encoder for %s", chipset->name);
   led_strip_encoder_config_t encoder_config = {
       .resolution = RMT_LED_STRIP_RESOLUTION_HZ,
+      .chipset = chipset,
   };
   ESP_ERROR_CHECK(rmt_new_led_strip_encoder(&encoder_config, &led_encoder));
+  write_pixels = led_pixel_writer(chipset);
+  led_strip_bytes = EXAMPLE_LED_NUMBERS * chipset->channels;
+#if CONFIG_PM_ENABLE
+  // Hold the line low through light sleep rather than switching the pad to
+  // its sleep config, which the strip could read as data
+  gpio_sleep_sel_dis(RMT_LED_STRIP_GPIO_NUM);
+#endif
+}
 
-  ESP_LOGI(TAG, "Enable RMT TX channel");
-  ESP_ERROR_CHECK(rmt_enable(led_chan));
+uint16_t led_count(void) { return EXAMPLE_LED_NUMBERS; }
+
+void led_snapshot(rgb8_t *out) {
+  taskENTER_CRITICAL(&frame_lock);
+  memcpy(out, frame, sizeof(frame));
+  taskEXIT_CRITICAL(&frame_lock);
 }
 
-static led_command_t led_command = {
-    .state = STATE_COLOR,
-    .r = 0,
-    .g = 0,
-    .b = 0,
-};
+static void queue_layer(uint8_t index, const led_layer_t *layer) {
+  taskENTER_CRITICAL(&pending_lock);
+  pending_layers[index] = *layer;
+  pending_mask |= 1u << index;
+  taskEXIT_CRITICAL(&pending_lock);
+  if (led_task) {
+    // Cuts the current frame wait short
+    xTaskNotifyGive(led_task);
+  }
+}
 
-void set_led_cmd(led_command_t command) {
-  // Thread-safe: send state change via queue (overwrite for size-1 queue)
-  if (led_command_queue != NULL) {
-    xQueueOverwrite(led_command_queue,
-                    &command); // Always succeeds for size-1 queue
-  } else {
-    // Fallback if queue not initialized (shouldn't happen in normal operation)
-    ESP_LOGW(TAG, "LED state queue not initialized, setting directly");
-    led_command = command;
+// The first clock sync moves the clock by decades; effects started before it
+// would jump by as much, so their start times move with the clock instead
+static void on_clock_step(int64_t step_ms) {
+  taskENTER_CRITICAL(&pending_lock);
+  for (int l = 0; l < LED_MAX_LAYERS; l++) {
+    if (pending_mask & (1u << l)) {
+      pending_layers[l].start_ms += (uint32_t)step_ms;
+    }
+  }
+  pending_step_ms += (uint32_t)step_ms;
+  taskEXIT_CRITICAL(&pending_lock);
+  if (led_task) {
+    xTaskNotifyGive(led_task);
   }
 }
-void start_led_loop() {
-  // Create queue for thread-safe state updates (size 1 - we only need latest
-  // state)
-  led_command_queue = xQueueCreate(1, sizeof(led_command_t));
-  if (led_command_queue == NULL) {
-    ESP_LOGE(TAG, "Failed to create LED state queue");
-    return;
+
+void set_led_cmd(led_command_t command) {
+  set_led_cmd_at(command, lamp_clock_ms());
+}
+
+void set_led_cmd_at(led_command_t command, uint32_t start_ms) {
+  state_publisher_notify(&command);
+  led_layer_t base = {
+      .enabled = true,
+      .start = 0,
+      .count = EXAMPLE_LED_NUMBERS,
+      .mode = BLEND_REPLACE,
+      .opacity = 255,
+      .effect = command,
+      .start_ms = start_ms,
+  };
+  queue_layer(0, &base);
+}
+
+bool set_led_layer(uint8_t index, const led_layer_t *layer) {
+  if (index == 0 || index >= LED_MAX_LAYERS ||
+      layer->start >= EXAMPLE_LED_NUMBERS) {
+    return false;
+  }
+  led_layer_t clipped = *layer;
+  if (clipped.count > EXAMPLE_LED_NUMBERS - clipped.start) {
+    clipped.count = EXAMPLE_LED_NUMBERS - clipped.start;
   }
+  queue_layer(index, &clipped);
+  return true;
+}
 
-  uint32_t red = 0;
-  uint32_t green = 0;
-  uint32_t blue = 0;
-  uint16_t hue = 0;
-  uint16_t start_rgb = 0;
-  bool pulse_done = false;
-  bool pulse_rising = true;
-  uint16_t pulse_ticks = 0;
+// Rounded up, so the loop never wakes just short of a step boundary and
+// spins on a zero-tick wait
+static TickType_t wait_ticks(uint32_t ms) {
+  return (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+}
 
+static void transmit(const uint8_t *data, size_t len) {
   rmt_transmit_config_t tx_config = {
       .loop_count = 0, // no transfer loop
   };
   const TickType_t rmt_timeout =
       pdMS_TO_TICKS(100); // 100ms timeout instead of portMAX_DELAY
 
-  ESP_LOGI(TAG, "LED loop task started");
+  // An enabled channel holds a PM lock, so it is only enabled for the
+  // write; the strip latches the frame and needs nothing in between
+  ESP_ERROR_CHECK(rmt_enable(led_chan));
+  ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, data, len, &tx_config));
+  rmt_tx_wait_all_done(led_chan, rmt_timeout);
+  rmt_disable(led_chan);
+}
 
-  while (1) {
-    // Check for state updates from queue (non-blocking)
-    led_command_t new_command;
-    if (xQueueReceive(led_command_queue, &new_command, 0) == pdTRUE) {
-      led_command = new_command;
-      pulse_done = false;
-      ESP_LOGI(TAG, "LED state changed to %d (R:%d, GP%d, B%d)",
-               led_command.state, led_command.r, led_command.g, led_command.b);
-    }
+// Lets the CPU slow down and sleep until the next frame or command
+static void wait_frame(uint32_t ms) {
+  power_release(POWER_LOCK_RENDER);
+  ulTaskNotifyTake(pdTRUE, wait_ticks(ms));
+  power_acquire(POWER_LOCK_RENDER);
+}
 
-    switch (new_command.state) {
-    case STATE_RAINBOW_CHASE:
-      for (int i = 0; i < 3; i++) {
-        for (int j = i; j < EXAMPLE_LED_NUMBERS; j += 3) {
-          // Build RGB pixels
-          hue = j * 360 / EXAMPLE_LED_NUMBERS + start_rgb;
-          led_strip_hsv2rgb(hue, 100, 100, &red, &green, &blue);
-          led_strip_pixels[j * 3 + 0] = green;
-          led_strip_pixels[j * 3 + 1] = blue;
-          led_strip_pixels[j * 3 + 2] = red;
-        }
-        // Flush RGB values to LEDs
-        ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels,
-                                     sizeof(led_strip_pixels), &tx_config));
-        rmt_tx_wait_all_done(
-            led_chan, rmt_timeout); // Use timeout instead of blocking forever
-        vTaskDelay(pdMS_TO_TICKS(EXAMPLE_CHASE_SPEED_MS));
-        memset(led_strip_pixels, 0, sizeof(led_strip_pixels));
-        ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels,
-                                     sizeof(led_strip_pixels), &tx_config));
-        rmt_tx_wait_all_done(led_chan, rmt_timeout);
-        vTaskDelay(pdMS_TO_TICKS(EXAMPLE_CHASE_SPEED_MS));
-      }
-      start_rgb += 60;
-      break;
+void start_led_loop() {
+  led_layer_t layers[LED_MAX_LAYERS] = {
+      [0] = {.enabled = true,
+             .count = EXAMPLE_LED_NUMBERS,
+             .mode = BLEND_REPLACE,
+             .opacity = 255,
+             .effect = {STATE_COLOR, 0, 0, 0}},
+  };
+  effect_t effects[LED_MAX_LAYERS];
+  effect_start(&effects[0], &layers[0].effect, lamp_clock_ms());
+  uint32_t last_tx_ms = 0;
+  bool first_frame = true;
+  const uint8_t *last_clip_frame = NULL;
 
-    case STATE_COLOR:
+  led_task = xTaskGetCurrentTaskHandle();
+  lamp_clock_on_step(on_clock_step);
+  ESP_LOGI(TAG, "LED loop task started");
+  power_acquire(POWER_LOCK_RENDER);
 
-      // Set all LEDs to white in one operation
-      for (int i = 0; i < EXAMPLE_LED_NUMBERS; i++) {
-        led_strip_pixels[i * 3 + 0] = led_command.g; // Green
-        led_strip_pixels[i * 3 + 1] = led_command.b; // Blue
-        led_strip_pixels[i * 3 + 2] = led_command.r; // Red
+  while (1) {
+    uint32_t changed, step_ms;
+    led_layer_t updates[LED_MAX_LAYERS];
+    taskENTER_CRITICAL(&pending_lock);
+    changed = pending_mask;
+    pending_mask = 0;
+    step_ms = pending_step_ms;
+    pending_step_ms = 0;
+    memcpy(updates, pending_layers, sizeof(updates));
+    taskEXIT_CRITICAL(&pending_lock);
+    // Read after taking the step; one landing later wakes the loop again
+    uint32_t now = lamp_clock_ms();
+    // Queued layers were shifted when they were still pending
+    if (step_ms) {
+      for (int l = 0; l < LED_MAX_LAYERS; l++) {
+        if (layers[l].enabled) {
+          layers[l].start_ms += step_ms;
+          effects[l].start_ms += step_ms;
+        }
       }
-      ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels,
-                                   sizeof(led_strip_pixels), &tx_config));
-      rmt_tx_wait_all_done(led_chan, rmt_timeout);
-      vTaskDelay(pdMS_TO_TICKS(100));
-      break;
-    case STATE_PULSE_WAVE: {
-      if (!pulse_done) {
-        pulse_ticks = 0;
-        pulse_done = true;
-        pulse_rising = true;
+      last_tx_ms += step_ms;
+    }
+    for (int l = 0; l < LED_MAX_LAYERS; l++) {
+      if (changed & (1u << l)) {
+        layers[l] = updates[l];
+        effect_start(&effects[l], &layers[l].effect, layers[l].start_ms);
+        const led_command_t *cmd = &layers[l].effect;
+        trace_event(TRACE_LED_STATE, cmd->state,
+                    cmd->r << 16 | cmd->g << 8 | cmd->b, l);
       }
-      uint8_t intensity;
-      if (pulse_rising) {
-        uint8_t shifts = pulse_ticks / 1;
-        if (shifts >= 7) {
-          pulse_rising = false;
-        }
-        intensity = 1 << (shifts);
-      } else {
-        intensity = 255 >> (pulse_ticks / 6);
+    }
+
+    // A clip on the base layer owns the strip: its frames go out straight
+    // from the flash mapping, without overlays or compositing
+    clips_frame_t clip;
+    uint32_t clip_ms = effect_elapsed_ms(&effects[0], now);
+    if (layers[0].effect.state == STATE_CLIP &&
+        clips_frame_begin(layers[0].effect.r, clip_ms, chipset,
+                          EXAMPLE_LED_NUMBERS, &clip)) {
+      if (clip.data != last_clip_frame ||
+          now - last_tx_ms >= LED_IDLE_REFRESH_MS) {
+        transmit(clip.data, clip.len);
+        taskENTER_CRITICAL(&frame_lock);
+        led_pixels_read(chipset, clip.data, frame, EXAMPLE_LED_NUMBERS);
+        taskEXIT_CRITICAL(&frame_lock);
+        last_clip_frame = clip.data;
+        last_tx_ms = now;
       }
+      clips_frame_done();
+      // Whatever follows the clip must be sent even if it matches the last
+      // composited frame
+      first_frame = true;
+      uint32_t wait_ms = clip.frame_ms
+                             ? clip.frame_ms - clip_ms % clip.frame_ms
+                             : LED_IDLE_REFRESH_MS;
+      wait_frame(wait_ms);
+      continue;
+    }
+    last_clip_frame = NULL;
 
-      for (int i = 0; i < EXAMPLE_LED_NUMBERS; i++) {
-        led_strip_pixels[i * 3 + 0] =
-            ((uint16_t)led_command.g * intensity) / 255;
-        led_strip_pixels[i * 3 + 1] =
-            ((uint16_t)led_command.b * intensity) / 255;
-        led_strip_pixels[i * 3 + 2] =
-            ((uint16_t)led_command.r * intensity) / 255;
+    // Render every enabled layer, then merge them into the frame
+    compositor_layer_t stack[LED_MAX_LAYERS];
+    int num_layers = 0;
+    uint32_t frame_ms = LED_IDLE_REFRESH_MS;
+    for (int l = 0; l < LED_MAX_LAYERS; l++) {
+      if (!layers[l].enabled) {
+        continue;
       }
-      if (intensity > 0) {
-        pulse_ticks++;
+      effect_render(&effects[l], layer_pixels[l], layers[l].count, now);
+      stack[num_layers++] = (compositor_layer_t){
+          .start = layers[l].start,
+          .count = layers[l].count,
+          .mode = layers[l].mode,
+          .opacity = layers[l].opacity,
+          .pixels = layer_pixels[l],
+      };
+      uint32_t fx_ms = effect_frame_ms(&effects[l], now);
+      if (fx_ms && fx_ms < frame_ms) {
+        frame_ms = fx_ms;
       }
-      ESP_ERROR_CHECK(rmt_transmit(led_chan, led_encoder, led_strip_pixels,
-                                   sizeof(led_strip_pixels), &tx_config));
-      rmt_tx_wait_all_done(led_chan, rmt_timeout);
-      vTaskDelay(pdMS_TO_TICKS(30));
-      break;
     }
+    rgb8_t next[EXAMPLE_LED_NUMBERS];
+    compositor_blend(stack, num_layers, next, EXAMPLE_LED_NUMBERS);
+
+    // Only unchanged frames are skipped, and never for longer than the idle
+    // refresh
+    if (first_frame || memcmp(next, frame, sizeof(frame)) != 0 ||
+        now - last_tx_ms >= LED_IDLE_REFRESH_MS) {
+      taskENTER_CRITICAL(&frame_lock);
+      memcpy(frame, next, sizeof(frame));
+      taskEXIT_CRITICAL(&frame_lock);
+      write_pixels(led_strip_pixels, frame, EXAMPLE_LED_NUMBERS);
+      transmit(led_strip_pixels, led_strip_bytes);
+      last_tx_ms = now;
+      first_frame = false;
     }
+
+    // Sleeps until the next effect step but wakes as soon as a new command
+    // is queued, so commands don't wait out the remainder of the current frame
+    wait_frame(frame_ms);
   }
 }
@@ -1,9 +1,12 @@
 #pragma once
+#include "compositor.h"
+#include <stdbool.h>
 #include <stdint.h>
 typedef enum {
   STATE_COLOR,
   STATE_RAINBOW_CHASE,
   STATE_PULSE_WAVE,
+  STATE_CLIP, // r is the clip index; base layer only
 } led_state_t;
 typedef struct {
   led_state_t state;
@@ -12,6 +15,28 @@ typedef struct {
   uint8_t b;
 
 } led_command_t;
+
+// Layer 0 is the base effect set by set_led_cmd(), covering the whole strip.
+// Layers above it are composited on top over their own LED range.
+#define LED_MAX_LAYERS COMPOSITOR_MAX_LAYERS
+typedef struct {
+  bool enabled;
+  uint16_t start;
+  uint16_t count;
+  blend_mode_t mode;
+  uint8_t opacity;
+  led_command_t effect;
+  uint32_t start_ms; // lamp clock time the effect starts from
+} led_layer_t;
+
 void init_led_strip();
 void set_led_cmd(led_command_t command);
+// As set_led_cmd(), with the effect timed from start_ms on the lamp clock
+// instead of now
+void set_led_cmd_at(led_command_t command, uint32_t start_ms);
+// index 1..LED_MAX_LAYERS-1; the range is clipped to the strip
+bool set_led_layer(uint8_t index, const led_layer_t *layer);
+uint16_t led_count(void);
+// What the strip is showing; out holds led_count() pixels
+void led_snapshot(rgb8_t *out);
 void start_led_loop();
@@ -0,0 +1,138 @@
+#include "led_chipset.h"
+#include "sdkconfig.h"
+
+// Datasheet typical values; all three tolerate +-150 ns on each phase
+const led_chipset_t led_chipset_ws2812 = {
+    .name = "WS2812",
+    .t0h_ns = 300,
+    .t0l_ns = 900,
+    .t1h_ns = 900,
+    .t1l_ns = 300,
+    .reset_us = 50,
+    .channels = 3,
+    .order = LED_ORDER_GRB,
+};
+
+const led_chipset_t led_chipset_sk6812_rgbw = {
+    .name = "SK6812 RGBW",
+    .t0h_ns = 300,
+    .t0l_ns = 900,
+    .t1h_ns = 600,
+    .t1l_ns = 600,
+    .reset_us = 80,
+    .channels = 4,
+    .order = LED_ORDER_GRB,
+};
+
+const led_chipset_t led_chipset_ws2815 = {
+    .name = "WS2815",
+    .t0h_ns = 300,
+    .t0l_ns = 1000,
+    .t1h_ns = 1000,
+    .t1l_ns = 300,
+    .reset_us = 280,
+    .channels = 3,
+    .order = LED_ORDER_GRB,
+};
+
+const led_chipset_t *led_chipset_configured(void) {
+  static led_chipset_t chipset;
+#if CONFIG_LAMP_LED_CHIPSET_SK6812_RGBW
+  chipset = led_chipset_sk6812_rgbw;
+#elif CONFIG_LAMP_LED_CHIPSET_WS2815
+  chipset = led_chipset_ws2815;
+#else
+  chipset = led_chipset_ws2812;
+#endif
+
+#if CONFIG_LAMP_LED_ORDER_RGB
+  chipset.order = LED_ORDER_RGB;
+#elif CONFIG_LAMP_LED_ORDER_RBG
+  chipset.order = LED_ORDER_RBG;
+#elif CONFIG_LAMP_LED_ORDER_GRB
+  chipset.order = LED_ORDER_GRB;
+#elif CONFIG_LAMP_LED_ORDER_GBR
+  chipset.order = LED_ORDER_GBR;
+#elif CONFIG_LAMP_LED_ORDER_BRG
+  chipset.order = LED_ORDER_BRG;
+#elif CONFIG_LAMP_LED_ORDER_BGR
+  chipset.order = LED_ORDER_BGR;
+#endif
+  return &chipset;
+}
+
+static uint32_t ns_to_ticks(uint32_t ns, uint32_t resolution_hz) {
+  return ((uint64_t)ns * resolution_hz + 500000000u) / 1000000000u;
+}
+
+void led_chipset_bit_ticks(const led_chipset_t *chipset,
+                           uint32_t resolution_hz, led_bit_ticks_t *ticks) {
+  ticks->t0h = ns_to_ticks(chipset->t0h_ns, resolution_hz);
+  ticks->t0l = ns_to_ticks(chipset->t0l_ns, resolution_hz);
+  ticks->t1h = ns_to_ticks(chipset->t1h_ns, resolution_hz);
+  ticks->t1l = ns_to_ticks(chipset->t1l_ns, resolution_hz);
+  ticks->reset = ns_to_ticks(chipset->reset_us * 1000u, resolution_hz);
+}
+
+#define DEFINE_RGB_WRITER(NAME, C0, C1, C2)                                    \
+  static void NAME(uint8_t *dst, const rgb8_t *src, uint16_t count) {          \
+    for (int i = 0; i < count; i++, dst += 3) {                                \
+      dst[0] = src[i].C0;                                                      \
+      dst[1] = src[i].C1;                                                      \
+      dst[2] = src[i].C2;                                                      \
+    }                                                                          \
+  }
+
+#define DEFINE_RGBW_WRITER(NAME, C0, C1, C2)                                   \
+  static void NAME(uint8_t *dst, const rgb8_t *src, uint16_t count) {          \
+    for (int i = 0; i < count; i++, dst += 4) {                                \
+      uint8_t w = src[i].r < src[i].g ? src[i].r : src[i].g;                   \
+      w = w < src[i].b ? w : src[i].b;                                         \
+      dst[0] = src[i].C0 - w;                                                  \
+      dst[1] = src[i].C1 - w;                                                  \
+      dst[2] = src[i].C2 - w;                                                  \
+      dst[3] = w;                                                              \
+    }                                                                          \
+  }
+
+DEFINE_RGB_WRITER(write_rgb, r, g, b)
+DEFINE_RGB_WRITER(write_rbg, r, b, g)
+DEFINE_RGB_WRITER(write_grb, g, r, b)
+DEFINE_RGB_WRITER(write_gbr, g, b, r)
+DEFINE_RGB_WRITER(write_brg, b, r, g)
+DEFINE_RGB_WRITER(write_bgr, b, g, r)
+DEFINE_RGBW_WRITER(write_rgbw, r, g, b)
+DEFINE_RGBW_WRITER(write_rbgw, r, b, g)
+DEFINE_RGBW_WRITER(write_grbw, g, r, b)
+DEFINE_RGBW_WRITER(write_gbrw, g, b, r)
+DEFINE_RGBW_WRITER(write_brgw, b, r, g)
+DEFINE_RGBW_WRITER(write_bgrw, b, g, r)
+
+static const led_pixel_writer_t writers[LED_ORDER_COUNT][2] = {
+    [LED_ORDER_RGB] = {write_rgb, write_rgbw},
+    [LED_ORDER_RBG] = {write_rbg, write_rbgw},
+    [LED_ORDER_GRB] = {write_grb, write_grbw},
+    [LED_ORDER_GBR] = {write_gbr, write_gbrw},
+    [LED_ORDER_BRG] = {write_brg, write_brgw},
+    [LED_ORDER_BGR] = {write_bgr, write_bgrw},
+};
+
+led_pixel_writer_t led_pixel_writer(const led_chipset_t *chipset) {
+  return writers[chipset->order][chipset->channels == 4];
+}
+
+// Wire position of r, g and b for each order
+static const uint8_t read_offsets[LED_ORDER_COUNT][3] = {
+    [LED_ORDER_RGB] = {0, 1, 2}, [LED_ORDER_RBG] = {0, 2, 1},
+    [LED_ORDER_GRB] = {1, 0, 2}, [LED_ORDER_GBR] = {2, 0, 1},
+    [LED_ORDER_BRG] = {1, 2, 0}, [LED_ORDER_BGR] = {2, 1, 0},
+};
+
+void led_pixels_read(const led_chipset_t *chipset, const uint8_t *src,
+                     rgb8_t *dst, uint16_t count) {
+  const uint8_t *at = read_offsets[chipset->order];
+  for (int i = 0; i < count; i++, src += chipset->channels) {
+    uint8_t w = chipset->channels == 4 ? src[3] : 0;
+    dst[i] = (rgb8_t){src[at[0]] + w, src[at[1]] + w, src[at[2]] + w};
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "compositor.h"
+#include <stdint.h>
+
+// Wire order of the color bytes; on RGBW chipsets white follows them
+typedef enum {
+  LED_ORDER_RGB,
+  LED_ORDER_RBG,
+  LED_ORDER_GRB,
+  LED_ORDER_GBR,
+  LED_ORDER_BRG,
+  LED_ORDER_BGR,
+  LED_ORDER_COUNT,
+} led_color_order_t;
+
+#define LED_CHIPSET_MAX_CHANNELS 4
+
+typedef struct {
+  const char *name;
+  // Bit timings: high then low time of a 0 and of a 1
+  uint16_t t0h_ns;
+  uint16_t t0l_ns;
+  uint16_t t1h_ns;
+  uint16_t t1l_ns;
+  uint16_t reset_us; // line held low to latch a frame
+  uint8_t channels;  // 3 (RGB) or 4 (RGBW)
+  led_color_order_t order;
+} led_chipset_t;
+
+extern const led_chipset_t led_chipset_ws2812;
+extern const led_chipset_t led_chipset_sk6812_rgbw;
+extern const led_chipset_t led_chipset_ws2815;
+
+// The chipset picked in menuconfig, with the configured color order applied
+const led_chipset_t *led_chipset_configured(void);
+
+// Timings converted to RMT ticks at resolution_hz, rounded to nearest
+typedef struct {
+  uint16_t t0h;
+  uint16_t t0l;
+  uint16_t t1h;
+  uint16_t t1l;
+  uint32_t reset;
+} led_bit_ticks_t;
+
+void led_chipset_bit_ticks(const led_chipset_t *chipset,
+                           uint32_t resolution_hz, led_bit_ticks_t *ticks);
+
+// Converts count pixels into wire bytes (count * channels). There is one
+// writer per color order and channel count, each with the byte offsets
+// fixed at compile time, so the per-pixel loop has no branches on either.
+// RGBW writers move the common part of r, g and b into the white channel.
+typedef void (*led_pixel_writer_t)(uint8_t *dst, const rgb8_t *src,
+                                   uint16_t count);
+led_pixel_writer_t led_pixel_writer(const led_chipset_t *chipset);
+// The other way, for showing what a strip was sent (clip frames are stored
+// as wire bytes). White goes back into r, g and b. Not on a hot path.
+void led_pixels_read(const led_chipset_t *chipset, const uint8_t *src,
+                     rgb8_t *dst, uint16_t count);
@@ -0,0 +1,264 @@
+#include "local_api.h"
+#include "clips.h"
+#include "command.h"
+#include "esp_http_server.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "ota_update.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_TAG "LOCAL_API"
+// Longest command is "COLOR#RRGGBB"; leave headroom for future ones
+#define LOCAL_API_MAX_CMD_LEN 64
+#define LOCAL_API_MAX_URL_LEN 256
+// Each chunk is one flash write; on the httpd task's stack
+#define LOCAL_API_CLIP_CHUNK 1024
+
+static httpd_handle_t server = NULL;
+
+// Commands and their replies are a handful of bytes: don't let Nagle hold
+// them back waiting for an ACK
+static esp_err_t local_api_open_fn(httpd_handle_t hd, int sockfd) {
+  int one = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return ESP_OK;
+}
+
+static esp_err_t cmd_post_handler(httpd_req_t *req) {
+  char buf[LOCAL_API_MAX_CMD_LEN];
+  int remaining = req->content_len;
+  int offset = 0;
+
+  if (remaining > sizeof(buf)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Command too long");
+    return ESP_FAIL;
+  }
+  while (remaining > 0) {
+    int ret = httpd_req_recv(req, buf + offset, remaining);
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (ret <= 0)
+      return ESP_FAIL;
+    offset += ret;
+    remaining -= ret;
+  }
+
+  if (!handle_command(buf, offset)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown command");
+    return ESP_OK;
+  }
+  httpd_resp_sendstr(req, "OK");
+  return ESP_OK;
+}
+
+// Compares all of the token whatever the input, so response times don't
+// reveal how much of a guess was right
+static bool api_authorized(httpd_req_t *req) {
+  static const char token[] = CONFIG_LAMP_OTA_TOKEN;
+  static const char scheme[] = "Bearer ";
+  char auth[sizeof(scheme) + sizeof(token)];
+
+  if (sizeof(token) == 1 ||
+      httpd_req_get_hdr_value_str(req, "Authorization", auth, sizeof(auth)) !=
+          ESP_OK ||
+      strlen(auth) != sizeof(scheme) - 1 + sizeof(token) - 1 ||
+      strncmp(auth, scheme, sizeof(scheme) - 1) != 0) {
+    return false;
+  }
+  uint8_t diff = 0;
+  const char *given = auth + sizeof(scheme) - 1;
+  for (const char *t = token; *t; t++, given++) {
+    diff |= *given ^ *t;
+  }
+  return diff == 0;
+}
+
+// Body is the image URL; the download runs in the background, poll GET /ota
+static esp_err_t ota_post_handler(httpd_req_t *req) {
+  char url[LOCAL_API_MAX_URL_LEN];
+  int remaining = req->content_len;
+  int offset = 0;
+
+  if (sizeof(CONFIG_LAMP_OTA_TOKEN) == 1) {
+    httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "OTA is disabled");
+    return ESP_FAIL;
+  }
+  if (!api_authorized(req)) {
+    ESP_LOGW(MODULE_TAG, "Refused unauthorized OTA request");
+    httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Bad OTA token");
+    return ESP_FAIL;
+  }
+
+  if (remaining >= sizeof(url)) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "URL too long");
+    return ESP_FAIL;
+  }
+  while (remaining > 0) {
+    int ret = httpd_req_recv(req, url + offset, remaining);
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (ret <= 0)
+      return ESP_FAIL;
+    offset += ret;
+    remaining -= ret;
+  }
+  url[offset] = '\0';
+
+  esp_err_t err = ota_update_start(url);
+  if (err != ESP_OK) {
+    httpd_resp_set_status(req, "409 Conflict");
+    httpd_resp_sendstr(req, esp_err_to_name(err));
+    return ESP_OK;
+  }
+  httpd_resp_set_status(req, "202 Accepted");
+  httpd_resp_sendstr(req, "OK");
+  return ESP_OK;
+}
+
+static esp_err_t ota_get_handler(httpd_req_t *req) {
+  static const char *const state_names[] = {
+      [OTA_UPDATE_IDLE] = "idle",
+      [OTA_UPDATE_RUNNING] = "running",
+      [OTA_UPDATE_FAILED] = "failed",
+      [OTA_UPDATE_DONE] = "done",
+  };
+  ota_update_status_t status;
+  ota_update_get_status(&status);
+
+  char json[160];
+  snprintf(json, sizeof(json),
+           "{\"state\":\"%s\",\"received\":%" PRIu32
+           ",\"written\":%" PRIu32 ",\"error\":\"%s\"}",
+           state_names[status.state], status.bytes_received,
+           status.bytes_written, status.error ? status.error : "");
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_sendstr(req, json);
+  return ESP_OK;
+}
+
+// Body is a clip image (bin/clip_pack.mjs), streamed straight to flash
+static esp_err_t clips_post_handler(httpd_req_t *req) {
+  char buf[LOCAL_API_CLIP_CHUNK];
+  size_t total = req->content_len;
+  size_t offset = 0;
+
+  if (sizeof(CONFIG_LAMP_OTA_TOKEN) == 1) {
+    httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Clip upload is disabled");
+    return ESP_FAIL;
+  }
+  // The upload erases the partition, so it needs the token as OTA does
+  if (!api_authorized(req)) {
+    ESP_LOGW(MODULE_TAG, "Refused unauthorized clip upload");
+    httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, "Bad token");
+    return ESP_FAIL;
+  }
+  if (total == 0) {
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Empty image");
+    return ESP_OK;
+  }
+  while (offset < total) {
+    int ret = httpd_req_recv(req, buf, sizeof(buf));
+    if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+      continue;
+    if (ret <= 0) {
+      clips_upload_abort();
+      return ESP_FAIL;
+    }
+    esp_err_t err = clips_upload_chunk(offset, buf, ret, total);
+    if (err != ESP_OK) {
+      // The rest of the body is dropped with the connection
+      httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, esp_err_to_name(err));
+      return ESP_FAIL;
+    }
+    offset += ret;
+  }
+  httpd_resp_sendstr(req, "OK");
+  return ESP_OK;
+}
+
+static esp_err_t ws_handler(httpd_req_t *req) {
+  if (req->method == HTTP_GET) {
+    // Handshake done, the connection stays open for frames
+    return ESP_OK;
+  }
+
+  uint8_t buf[LOCAL_API_MAX_CMD_LEN];
+  httpd_ws_frame_t frame = {.payload = buf};
+
+  // First call only fills in the frame length
+  esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  if (frame.len > sizeof(buf)) {
+    ESP_LOGW(MODULE_TAG, "WS frame too long: %d", frame.len);
+    return ESP_FAIL;
+  }
+  if (frame.len) {
+    ret = httpd_ws_recv_frame(req, &frame, sizeof(buf));
+    if (ret != ESP_OK) {
+      return ret;
+    }
+  }
+  if (frame.type != HTTPD_WS_TYPE_TEXT) {
+    return ESP_OK;
+  }
+
+  bool ok = handle_command((const char *)buf, frame.len);
+  httpd_ws_frame_t reply = {
+      .final = true,
+      .type = HTTPD_WS_TYPE_TEXT,
+      .payload = (uint8_t *)(ok ? "OK" : "ERR"),
+      .len = ok ? 2 : 3,
+  };
+  return httpd_ws_send_frame(req, &reply);
+}
+
+void start_local_api(void) {
+  if (server) {
+    // Already running from a previous connect; the listening socket
+    // survives WiFi reconnects
+    return;
+  }
+
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.server_port = CONFIG_LAMP_LOCAL_API_PORT;
+  config.lru_purge_enable = true;
+  config.open_fn = local_api_open_fn;
+
+  if (httpd_start(&server, &config) != ESP_OK) {
+    ESP_LOGE(MODULE_TAG, "Failed to start local API server");
+    server = NULL;
+    return;
+  }
+
+  httpd_uri_t cmd_post = {
+      .uri = "/cmd", .method = HTTP_POST, .handler = cmd_post_handler};
+  httpd_uri_t ws = {.uri = "/ws",
+                    .method = HTTP_GET,
+                    .handler = ws_handler,
+                    .is_websocket = true};
+  httpd_uri_t ota_post = {
+      .uri = "/ota", .method = HTTP_POST, .handler = ota_post_handler};
+  httpd_uri_t ota_get = {
+      .uri = "/ota", .method = HTTP_GET, .handler = ota_get_handler};
+  httpd_uri_t clips_post = {
+      .uri = "/clips", .method = HTTP_POST, .handler = clips_post_handler};
+  httpd_register_uri_handler(server, &cmd_post);
+  httpd_register_uri_handler(server, &ota_post);
+  httpd_register_uri_handler(server, &ota_get);
+  httpd_register_uri_handler(server, &clips_post);
+  httpd_register_uri_handler(server, &ws);
+  ESP_LOGI(MODULE_TAG, "Local API listening on port %d",
+           CONFIG_LAMP_LOCAL_API_PORT);
+}
+
+void stop_local_api(void) {
+  if (!server) {
+    return;
+  }
+  httpd_stop(server);
+  server = NULL;
+}
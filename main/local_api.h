@@ -0,0 +1,9 @@
+#pragma once
+
+// LAN control endpoint for station mode. Accepts the same text commands as
+// MQTT, either as the body of POST /cmd or as WebSocket text frames on /ws
+// (each frame is answered with "OK" or "ERR").
+// POST /ota with an image URL as the body starts a firmware update, GET /ota
+// reports its progress as JSON.
+void start_local_api(void);
+void stop_local_api(void);
@@ -1,204 +1,266 @@
+#include "button_gesture.h"
+#include "clips.h"
+#include "command.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#if CONFIG_PM_ENABLE
+#include "esp_sleep.h"
+#endif
 #include "esp_timer.h"
 #include "esp_wifi.h" //esp_wifi_init functions and wifi operations
 #include "freertos/projdefs.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
+#include "lamp_clock.h"
 #include "led.h"
+#include "local_api.h"
+#include "mem_plan.h"
 #include "mqtt.h"
 #include "mqtt_client.h"
 #include "nvs_flash.h"
+#include "ota_update.h"
+#include "power.h"
+#include "preview.h"
+#include "settings.h"
 #include "soc/gpio_num.h"
+#include "state_publisher.h"
+#include "trace.h"
 #include "wifi.h"
 #define MODULE_TAG "MAIN"
 
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
-
-static inline int hex_nibble(char c) {
-  if (c >= '0' && c <= '9')
-    return c - '0';
-  if (c >= 'a' && c <= 'f')
-    return c - 'a' + 10;
-  if (c >= 'A' && c <= 'F')
-    return c - 'A' + 10;
-  return -1;
-}
-
-bool parse_rgb24(const char *data, size_t len, uint8_t *r, uint8_t *g,
-                 uint8_t *b) {
-
-  if (!data || !r || !g || !b) {
-    ESP_LOGI("RGB_PARSE", "Missing params");
-    return false;
-  }
-
-  // Must be exactly "#RRGGBB"
-  if (len != 7) {
-    ESP_LOGI("RGB_PARSE", "Len was %d, not 7", len);
-    return false;
-  }
-  if (data[0] != '#') {
-    ESP_LOGI("RGB_PARSE", "Data started with %s, not #", data[0]);
-    return false;
-  }
-
-  uint32_t value = 0;
-
-  for (int i = 1; i < 7; i++) {
-    int nibble = hex_nibble(data[i]);
-    if (nibble < 0) {
-      return false;
-    }
-    value = (value << 4) | (uint32_t)nibble;
-  }
-
-  *r = (value >> 16) & 0xFF;
-  *g = (value >> 8) & 0xFF;
-  *b = value & 0xFF;
-
-  return true;
-}
-
-#define PREFIX_LEN (sizeof(STRING_LITERAL) - 1)
-#define COLOR_MSG "COLOR#"
-#define COLOR_MSG_PREFIX_LEN sizeof(COLOR_MSG) - 1
-#define PULSE_MSG "PULSE#"
-#define PULSE_MSG_PREFIX_LEN sizeof(PULSE_MSG) - 1
-#define CHASE_MSG "CHASE"
-#define CHASE_MSG_PREFIX_LEN sizeof(CHASE_MSG) - 1
+#include <string.h>
 
 static void on_mqtt_message_handler(void *handler_args, esp_event_base_t base,
                                     int32_t event_id, void *event_data) {
   esp_mqtt_event_handle_t event = event_data;
 
-  ESP_LOGI(MODULE_TAG, "Received on topic: %.*s", event->topic_len,
-           event->topic);
-  ESP_LOGI(MODULE_TAG, "MQTT received: %.*s", event->data_len, event->data);
-
-  // We will NOT assume null-termination in logic
-  const char *data = event->data;
-  size_t len = event->data_len;
-
-  uint8_t r, g, b;
-
-  // ---------- COLOR#RRGGBB ----------
-  if (len > COLOR_MSG_PREFIX_LEN &&
-      memcmp(data, COLOR_MSG, COLOR_MSG_PREFIX_LEN) == 0) {
-    size_t offset = COLOR_MSG_PREFIX_LEN - 1;
-    const char *data_start = data + offset;
-    size_t data_len = len - offset;
-    ESP_LOGD(MODULE_TAG, "RGB segment received using offset %d: %.*s", offset,
-             data_len, data_start);
-
-    if (parse_rgb24(data_start, data_len, &r, &g, &b)) {
-      ESP_LOGI(MODULE_TAG, "ON color: #%02X%02X%02X", r, g, b);
-      led_command_t cmd = {STATE_COLOR, r, g, b};
-
-      set_led_cmd(cmd);
-    } else {
-      ESP_LOGW(MODULE_TAG, "Invalid ON color payload");
+  trace_event(TRACE_MQTT_RX, event->topic_len, event->data_len,
+              event->msg_id);
+  // Messages bigger than the client buffer come in fragments; only the
+  // first one carries the topic
+  static bool clip_upload = false;
+  if (event->current_data_offset == 0) {
+    bool was_upload = clip_upload;
+    clip_upload = event->topic_len == strlen(MQTT_CLIP_TOPIC) &&
+                  memcmp(event->topic, MQTT_CLIP_TOPIC, event->topic_len) == 0;
+    // Held from the first fragment to the last so the rest isn't delayed
+    // by light sleep between them
+    if (clip_upload && !was_upload) {
+      power_acquire(POWER_LOCK_TRANSFER);
+    } else if (!clip_upload && was_upload) {
+      // The rest of the image is not coming
+      clips_upload_abort();
+      power_release(POWER_LOCK_TRANSFER);
     }
-    return;
   }
-
-  // ---------- PULSE#RRGGBB ----------
-  if (len > PULSE_MSG_PREFIX_LEN &&
-      memcmp(data, PULSE_MSG, PULSE_MSG_PREFIX_LEN) == 0) {
-    size_t offset = COLOR_MSG_PREFIX_LEN - 1;
-    const char *data_start = data + offset;
-    size_t data_len = len - offset;
-    ESP_LOGD(MODULE_TAG, "RGB segment received using offset %d: %.*s", offset,
-             data_len, data_start);
-
-    if (parse_rgb24(data_start, data_len, &r, &g, &b)) {
-      ESP_LOGI(MODULE_TAG, "PULSE color: #%02X%02X%02X", r, g, b);
-      led_command_t cmd = {STATE_PULSE_WAVE, r, g, b};
-      set_led_cmd(cmd);
-    } else {
-      ESP_LOGW(MODULE_TAG, "Invalid PULSE color payload");
+  if (clip_upload) {
+    bool last =
+        event->current_data_offset + event->data_len >= event->total_data_len;
+    if (clips_upload_chunk(event->current_data_offset, event->data,
+                           event->data_len, event->total_data_len) != ESP_OK ||
+        last) {
+      clip_upload = false;
+      power_release(POWER_LOCK_TRANSFER);
     }
     return;
   }
-
-  // ---------- CHASE ----------
-  if (len == 5 && memcmp(data, "CHASE", 5) == 0) {
-    ESP_LOGI(MODULE_TAG, "Setting LED CHASE");
-    led_command_t cmd = {STATE_RAINBOW_CHASE, 0, 0, 0};
-    set_led_cmd(cmd);
+  if (event->current_data_offset != 0) {
+    // Tail of an oversized command, already rejected
     return;
   }
 
-  ESP_LOGW(MODULE_TAG, "Unknown MQTT command");
+  ESP_LOGD(MODULE_TAG, "MQTT received on %.*s: %.*s", event->topic_len,
+           event->topic, event->data_len, event->data);
+
+  handle_command(event->data, event->data_len);
 }
 
 static void on_wifi_connected_handler(void) {
   ESP_LOGI(MODULE_TAG, "WiFi connected");
+  lamp_clock_start_sync();
   start_mqtt_client(on_mqtt_message_handler);
+  start_local_api();
 }
 
 #define BUTTON_GPIO GPIO_NUM_32
 
+#define BUTTON_EVENT_TOPIC "device/button"
+// A gesture is news for a minute at most
+#define BUTTON_EVENT_EXPIRY_S 60
+
 static void init_input_button(void) {
   gpio_config_t io_conf = {
       .pin_bit_mask = 1ULL << BUTTON_GPIO,
       .mode = GPIO_MODE_INPUT,
       .pull_up_en = GPIO_PULLUP_ENABLE,
       .pull_down_en = GPIO_PULLDOWN_DISABLE,
-      .intr_type = GPIO_INTR_NEGEDGE // HIGH → LOW (button press)
+#if CONFIG_PM_ENABLE
+      // Edge interrupts can't wake the chip from light sleep, so a level
+      // one is armed for whichever level comes next (see the ISR): press
+      // and release both still feed the FSM
+      .intr_type = GPIO_INTR_LOW_LEVEL,
+#else
+      .intr_type = GPIO_INTR_ANYEDGE // press and release both feed the FSM
+#endif
   };
 
   gpio_config(&io_conf);
+#if CONFIG_PM_ENABLE
+  gpio_wakeup_enable(BUTTON_GPIO, GPIO_INTR_LOW_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+#endif
 }
 
+typedef struct {
+  int64_t time_us;
+  bool pressed;
+  bool timeout; // debounce/long-press deadline rather than an edge
+} button_input_t;
+
 static QueueHandle_t button_evt_queue;
+static StaticQueue_t button_evt_queue_buf;
+static uint8_t button_evt_queue_storage[MEM_PLAN_BUTTON_QUEUE_LEN *
+                                        sizeof(button_input_t)];
+static esp_timer_handle_t button_timer;
+
+static StaticTask_t button_task_tcb;
+static StackType_t button_task_stack[MEM_PLAN_BUTTON_TASK_STACK];
+static StaticTask_t led_task_tcb;
+static StackType_t led_task_stack[MEM_PLAN_LED_TASK_STACK];
 
-extern esp_mqtt_client_handle_t mqtt_client;
 static void IRAM_ATTR button_isr_handler(void *arg) {
   uint32_t gpio_num = (uint32_t)arg;
+  BaseType_t woken = pdFALSE;
+  button_input_t input = {
+      .time_us = esp_timer_get_time(),
+      .pressed = gpio_get_level(gpio_num) == 0, // active low
+  };
+#if CONFIG_PM_ENABLE
+  // Re-armed for the opposite level, or it would fire again at once
+  gpio_wakeup_enable(gpio_num, input.pressed ? GPIO_INTR_HIGH_LEVEL
+                                             : GPIO_INTR_LOW_LEVEL);
+#endif
+
+  xQueueSendFromISR(button_evt_queue, &input, &woken);
+  // Switch straight to button_task instead of waiting for the next tick
+  portYIELD_FROM_ISR(woken);
+}
+
+static void button_timer_cb(void *arg) {
+  button_input_t input = {.time_us = esp_timer_get_time(), .timeout = true};
+  xQueueSend(button_evt_queue, &input, 0);
+}
 
-  xQueueSendFromISR(button_evt_queue, &gpio_num, NULL);
+static void on_button_event(button_event_t event) {
+  switch (event) {
+  case BUTTON_EVENT_PRESS: {
+    led_command_t cmd = {STATE_PULSE_WAVE, 255, 255, 255};
+    set_led_cmd(cmd);
+    break;
+  }
+  case BUTTON_EVENT_DOUBLE_PRESS: {
+    led_command_t cmd = {STATE_RAINBOW_CHASE, 0, 0, 0};
+    set_led_cmd(cmd);
+    break;
+  }
+  case BUTTON_EVENT_LONG_PRESS: {
+    led_command_t cmd = {STATE_COLOR, 0, 0, 0};
+    set_led_cmd(cmd);
+    break;
+  }
+  default:
+    break;
+  }
+  trace_event(TRACE_BUTTON, event, 0, 0);
+#ifdef CONFIG_LAMP_BUTTON_PUBLISH_EVENTS
+  static const mqtt_topic_t topic = {
+      .name = BUTTON_EVENT_TOPIC,
+      .expiry_s = BUTTON_EVENT_EXPIRY_S,
+      .utf8 = true,
+      .alias = true,
+  };
+  const char *name = button_event_name(event);
+  mqtt_enqueue_to(&topic, name, 0, 0, 0);
+#endif
 }
+
 static void button_task(void *arg) {
-  uint32_t io_num;
-  int64_t last_press_time = 0;
+  const button_gesture_config_t cfg = {
+      .debounce_us = BUTTON_DEBOUNCE_MS * 1000,
+      .long_press_us = BUTTON_LONG_PRESS_MS * 1000,
+      .double_press_us = BUTTON_DOUBLE_PRESS_MS * 1000,
+  };
+  button_gesture_t gesture;
+  button_gesture_init(&gesture, &cfg);
 
   while (1) {
-    if (xQueueReceive(button_evt_queue, &io_num, portMAX_DELAY)) {
-
-      int64_t now = esp_timer_get_time(); // µs
-      if (now - last_press_time < 400000) {
-        continue; // debounce: 400ms
-      }
-      last_press_time = now;
-
-      ESP_LOGI("BUTTON", "Button pressed");
-      led_command_t cmd = {STATE_PULSE_WAVE, 255, 255, 255};
-      set_led_cmd(cmd);
-      //   esp_mqtt_client_publish(mqtt_client, "device/button", "PRESSED", 0,
-      //   1, 0);
+    button_input_t input;
+    if (!xQueueReceive(button_evt_queue, &input, portMAX_DELAY)) {
+      continue;
+    }
+
+    button_gesture_output_t out;
+    if (input.timeout) {
+      button_gesture_timeout(&gesture, input.time_us, &out);
+    } else {
+      button_gesture_edge(&gesture, input.pressed, input.time_us, &out);
+    }
+    for (int i = 0; i < out.count; i++) {
+      on_button_event(out.events[i]);
+    }
+
+    // Re-arm for the state machine's next deadline, if any
+    esp_timer_stop(button_timer);
+    int64_t deadline = button_gesture_deadline(&gesture);
+    if (deadline != BUTTON_GESTURE_NO_DEADLINE) {
+      int64_t delay = deadline - esp_timer_get_time();
+      esp_timer_start_once(button_timer, delay > 0 ? delay : 0);
     }
-    vTaskDelay(pdMS_TO_TICKS(2));
   }
 }
 
 void app_main(void) {
   ESP_LOGI(MODULE_TAG, "Starting application");
   // start
+  power_init();
+  state_publisher_init();
   init_led_strip();
   init_input_button();
-  button_evt_queue = xQueueCreate(5, sizeof(uint32_t));
+  button_evt_queue = xQueueCreateStatic(
+      MEM_PLAN_BUTTON_QUEUE_LEN, sizeof(button_input_t),
+      button_evt_queue_storage, &button_evt_queue_buf);
+  const esp_timer_create_args_t button_timer_args = {
+      .callback = button_timer_cb,
+      .name = "button",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&button_timer_args, &button_timer));
   gpio_install_isr_service(0);
   gpio_isr_handler_add(BUTTON_GPIO, button_isr_handler, (void *)BUTTON_GPIO);
 
-  xTaskCreate(button_task, "button_task", 4096, NULL, 10, NULL);
+  xTaskCreateStatic(button_task, "button_task", MEM_PLAN_BUTTON_TASK_STACK,
+                    NULL, MEM_PLAN_BUTTON_TASK_PRIO, button_task_stack,
+                    &button_task_tcb);
   // start a task for led loop with lower priority than WiFi/MQTT
-  // Priority 3 is lower than typical MQTT (5) and WiFi (23) priorities
-  xTaskCreate(start_led_loop, "led_loop", 2048, NULL, 3, NULL);
+  xTaskCreateStatic(start_led_loop, "led_loop", MEM_PLAN_LED_TASK_STACK, NULL,
+                    MEM_PLAN_LED_TASK_PRIO, led_task_stack, &led_task_tcb);
+  preview_start();
   ESP_ERROR_CHECK(nvs_flash_init());
+  settings_init();
+  ota_update_init();
+  clips_init();
+  command_init();
+#ifdef CONFIG_LAMP_RESTORE_LAST_COMMAND
+  // After clips_init(), so a clip can be found by name
+  char last_cmd[SETTINGS_MAX_LEN];
+  settings_get_str(SETTING_LAST_COMMAND, last_cmd, sizeof(last_cmd));
+  if (last_cmd[0] && !handle_command(last_cmd, strlen(last_cmd))) {
+    ESP_LOGW(MODULE_TAG, "Could not restore %s", last_cmd);
+  }
+#endif
   ESP_ERROR_CHECK(esp_netif_init());
   ESP_ERROR_CHECK(esp_event_loop_create_default());
   wifi_init_config_t wifi_initiation =
@@ -214,9 +276,10 @@ void app_main(void) {
 
   char ssid[33], pass[65];
   if (!load_wifi_credentials(ssid, sizeof(ssid), pass, sizeof(pass))) {
-    start_wifi_provisioning();
-    return;
+    start_wifi_provisioning(on_wifi_connected_handler);
+  } else {
+    wifi_connection(ssid, pass, on_wifi_connected_handler);
   }
-
-  wifi_connection(ssid, pass, on_wifi_connected_handler);
+  // Everything long-lived is up; the rest of the heap is the network's
+  mem_plan_report();
 }
@@ -0,0 +1,55 @@
+#include "mem_plan.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+
+#define MODULE_TAG "MEM_PLAN"
+
+// DRAM sections from the linker script
+extern int _data_start, _data_end, _bss_start, _bss_end;
+
+typedef struct {
+  const char *name;
+  uint32_t stack;
+} planned_task_t;
+
+static const planned_task_t planned_tasks[] = {
+    {"button_task", MEM_PLAN_BUTTON_TASK_STACK},
+    {"led_loop", MEM_PLAN_LED_TASK_STACK},
+    {"portal", MEM_PLAN_PORTAL_TASK_STACK},
+    {"preview", MEM_PLAN_PREVIEW_TASK_STACK},
+    {"mqtt_pub", MEM_PLAN_MQTT_PUBLISH_TASK_STACK},
+    {"settings", MEM_PLAN_SETTINGS_TASK_STACK},
+};
+
+void mem_plan_report(void) {
+  uint32_t data = (uint8_t *)&_data_end - (uint8_t *)&_data_start;
+  uint32_t bss = (uint8_t *)&_bss_end - (uint8_t *)&_bss_start;
+  ESP_LOGI(MODULE_TAG, "Static DRAM: .data %" PRIu32 " B, .bss %" PRIu32 " B",
+           data, bss);
+
+  for (int i = 0; i < sizeof(planned_tasks) / sizeof(planned_tasks[0]); i++) {
+    TaskHandle_t task = xTaskGetHandle(planned_tasks[i].name);
+    if (!task) {
+      continue; // not running in this mode (portal vs station)
+    }
+    ESP_LOGI(MODULE_TAG, "Task %-12s stack %5" PRIu32 " B, %5u B never used",
+             planned_tasks[i].name, planned_tasks[i].stack,
+             (unsigned)uxTaskGetStackHighWaterMark(task));
+  }
+
+  uint32_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  ESP_LOGI(MODULE_TAG,
+           "Heap for networking: %" PRIu32 " B free (largest block %u B, "
+           "low-water %u B), reserve %d B",
+           free_heap,
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+           MEM_PLAN_NET_HEAP_RESERVE);
+  if (free_heap < MEM_PLAN_NET_HEAP_RESERVE) {
+    ESP_LOGW(MODULE_TAG, "Networking reserve not met, %" PRIu32 " B short",
+             MEM_PLAN_NET_HEAP_RESERVE - free_heap);
+  }
+}
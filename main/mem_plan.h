@@ -0,0 +1,43 @@
+#pragma once
+
+// Budget for everything long-lived. Owners declare their task stacks, queue
+// storage and buffers static from these numbers (xTaskCreateStatic,
+// xQueueCreateStatic), so boot never touches the heap for them and what is
+// left belongs to WiFi, lwIP, TLS and the MQTT client. Stack sizes are in
+// bytes (StackType_t is uint8_t here); mem_plan_report() prints high-water
+// marks so they can be tuned from real numbers.
+
+#define MEM_PLAN_BUTTON_TASK_STACK 4096
+#define MEM_PLAN_BUTTON_TASK_PRIO 10
+// Lower than MQTT (5) and WiFi (23)
+#define MEM_PLAN_LED_TASK_STACK 2048
+#define MEM_PLAN_LED_TASK_PRIO 3
+#define MEM_PLAN_PORTAL_TASK_STACK 4096
+#define MEM_PLAN_PORTAL_TASK_PRIO 5
+// Below the LED loop
+#define MEM_PLAN_PREVIEW_TASK_STACK 3072
+#define MEM_PLAN_PREVIEW_TASK_PRIO 2
+// Under the MQTT task (5), which it feeds; aliased publishes block here on
+// the socket write
+#define MEM_PLAN_MQTT_PUBLISH_TASK_STACK 3072
+#define MEM_PLAN_MQTT_PUBLISH_TASK_PRIO 4
+// Lowest: it only writes settings back to flash
+#define MEM_PLAN_SETTINGS_TASK_STACK 3072
+#define MEM_PLAN_SETTINGS_TASK_PRIO 1
+
+// Deep enough to absorb a burst of contact bounce
+#define MEM_PLAN_BUTTON_QUEUE_LEN 16
+
+// Publishes waiting for the publish task, copied with a ~40 B header. The
+// largest is a 256-LED preview keyframe (1028 B); a few fit at once.
+#define MEM_PLAN_MQTT_PUBLISH_MAX_MSG 1088
+#define MEM_PLAN_MQTT_PUBLISH_BUFFER (3 * MEM_PLAN_MQTT_PUBLISH_MAX_MSG)
+
+// Free heap that must remain once the static plan is in place: WiFi
+// buffers, lwIP, a TLS handshake and the MQTT outbox. OTA buffers (~48 KB)
+// also come from here, but only while an update runs.
+#define MEM_PLAN_NET_HEAP_RESERVE (100 * 1024)
+
+// Logs static RAM use, planned stacks with their unused headroom and the
+// heap left for networking; warns when the reserve is not met
+void mem_plan_report(void);
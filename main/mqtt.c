@@ -1,7 +1,19 @@
+#include "mqtt.h"
 #include "esp_crt_bundle.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "esp_transport_ssl.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/message_buffer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_plan.h"
 #include "mqtt_client.h"
+#include "ota_update.h"
+#include "state_publisher.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #define LED_GPIO 2
@@ -10,49 +22,160 @@
 #define MQTT_USERNAME CONFIG_MQTT_USERNAME
 #define MQTT_PASSWORD CONFIG_MQTT_PASSWORD
 
+#ifndef CONFIG_MQTT_PROTOCOL_5
+#error "Publish properties need CONFIG_MQTT_PROTOCOL_5"
+#endif
+
 #define MODULE_TAG "MQTT"
+#define MQTT_COMMAND_TOPIC "esp001/state"
 
 static bool mqtt_connected = false;
+static int64_t connect_start_us = 0;
+static mqtt_stats_t stats;
+
+// Publish properties are per client, set just before the publish that
+// consumes them, so only publish_task publishes: the others hand it the
+// message through publish_buffer and never wait for the client, whose API
+// lock the MQTT task holds while it runs our event handlers.
+typedef struct {
+  mqtt_topic_t topic;
+  const char *data; // in place (topic.in_place); otherwise copied after this
+  uint16_t len;
+  uint8_t qos;
+  uint8_t retain;
+} publish_header_t;
+
+static MessageBufferHandle_t publish_buffer = NULL;
+static StaticMessageBuffer_t publish_buffer_struct;
+static uint8_t publish_buffer_storage[MEM_PLAN_MQTT_PUBLISH_BUFFER];
+// Message buffers take one writer at a time; held only for the copy, so
+// even the MQTT task can wait for it
+static SemaphoreHandle_t send_lock = NULL;
+static StaticSemaphore_t send_lock_buf;
+static uint8_t send_staging[MEM_PLAN_MQTT_PUBLISH_MAX_MSG];
+static StaticTask_t publish_task_tcb;
+static StackType_t publish_task_stack[MEM_PLAN_MQTT_PUBLISH_TASK_STACK];
+static void publish_task(void *arg);
+
+// alias_topic[n] is the topic behind our alias n (0 unused), named on its
+// first use; only publish_task touches the alias table.
+static const char *alias_topic[CONFIG_LAMP_MQTT_TOPIC_ALIASES + 1];
+// Aliases only last for one network connection, so what the broker knows is
+// tagged with the connection it learned it on. Bumped by the event handler.
+static volatile uint32_t connection_id = 0;
+static uint32_t alias_defined_on[CONFIG_LAMP_MQTT_TOPIC_ALIASES + 1];
+static uint32_t aliases_refused_on = 0; // broker allows fewer than we use
 
 static void mqtt_connection_event_handler(void *handler_args,
                                           esp_event_base_t base,
                                           int32_t event_id, void *event_data) {
   esp_mqtt_event_handle_t event = event_data;
-  esp_mqtt_client_handle_t client = event->client;
 
   switch (event->event_id) {
+  case MQTT_EVENT_BEFORE_CONNECT:
+    connect_start_us = esp_timer_get_time();
+    break;
   case MQTT_EVENT_CONNECTED:
     ESP_LOGI(MODULE_TAG, "MQTT connected!");
+    connection_id++;
     mqtt_connected = true;
-    printf("MQTT connected, subscribing...\n");
-    esp_mqtt_client_subscribe(event->client, "esp001/state", 1);
-    esp_mqtt_client_publish(client, "devices/connect", "ack!", 0, 0, 0);
+    stats.connects++;
+    if (connect_start_us) {
+      stats.last_connect_ms = (esp_timer_get_time() - connect_start_us) / 1000;
+      ESP_LOGI(MODULE_TAG, "Connect took %" PRIu32 " ms (session %s)",
+               stats.last_connect_ms,
+               event->session_present ? "resumed" : "new");
+    }
+    // The broker still holds our subscription (and any QoS1 commands queued
+    // while we were away) when it resumed the persistent session
+    if (event->session_present) {
+      stats.sessions_resumed++;
+    } else {
+      printf("MQTT connected, subscribing...\n");
+      esp_mqtt_client_subscribe(event->client, MQTT_COMMAND_TOPIC, 1);
+    }
+    // Not in sessions created by older firmware, so subscribed on every
+    // connect. The broker then resends the retained image each time;
+    // clips_upload_chunk() recognizes the stored one and skips the rewrite.
+    esp_mqtt_client_subscribe(event->client, MQTT_CLIP_TOPIC, 1);
+    mqtt_enqueue("devices/connect", "ack!", 0, 0, 0);
+    state_publisher_on_connected();
+    ota_update_confirm();
 
     break;
   case MQTT_EVENT_DISCONNECTED:
     ESP_LOGI(MODULE_TAG, "MQTT disconnected");
     mqtt_connected = false;
+    connection_id++;
     break;
   default:
     break;
   }
 }
 static esp_mqtt_client_handle_t client;
+static char client_id[20];
+
+// Our own SSL transport so TLS session tickets can be enabled on it: the
+// client reuses the same transport for every reconnect, so after the first
+// full handshake a WiFi blip only costs an abbreviated one.
+static esp_transport_handle_t create_ssl_transport(void) {
+  esp_transport_handle_t ssl = esp_transport_ssl_init();
+  if (ssl == NULL) {
+    return NULL;
+  }
+  esp_transport_ssl_crt_bundle_attach(ssl, esp_crt_bundle_attach);
+  esp_transport_ssl_session_tickets_enable(ssl);
+  esp_transport_set_default_port(ssl, 8883);
+  return ssl;
+}
 
 void start_mqtt_client(esp_event_handler_t event_handler) {
+  if (client) {
+    // Already running; esp-mqtt reconnects on its own after WiFi comes back
+    return;
+  }
+
+  // Stable per-device ID so the broker can keep our persistent session
+  uint8_t mac[6];
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  snprintf(client_id, sizeof(client_id), "lamp-%02x%02x%02x%02x%02x%02x",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 
   esp_mqtt_client_config_t mqtt_cfg = {
       .broker.address.uri = MQTT_BROKER_URI,
       .broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
       .credentials.username = MQTT_USERNAME,
+      .credentials.client_id = client_id,
       .credentials.authentication.password = MQTT_PASSWORD,
+      .session.disable_clean_session = true,
+      .session.protocol_ver = MQTT_PROTOCOL_V_5,
   };
+  if (strncmp(MQTT_BROKER_URI, "mqtts://", 8) == 0) {
+    mqtt_cfg.network.transport = create_ssl_transport();
+  }
 
   client = esp_mqtt_client_init(&mqtt_cfg);
   if (client == NULL) {
     ESP_LOGE(MODULE_TAG, "Failed to initialize MQTT client");
     return;
   }
+  send_lock = xSemaphoreCreateMutexStatic(&send_lock_buf);
+  publish_buffer = xMessageBufferCreateStatic(sizeof(publish_buffer_storage),
+                                              publish_buffer_storage,
+                                              &publish_buffer_struct);
+  xTaskCreateStatic(publish_task, "mqtt_pub", MEM_PLAN_MQTT_PUBLISH_TASK_STACK,
+                    NULL, MEM_PLAN_MQTT_PUBLISH_TASK_PRIO, publish_task_stack,
+                    &publish_task_tcb);
+
+  // MQTT 5 ends a session at disconnect unless given an expiry, so this is
+  // what keeps it persistent; it also bounds how stale a queued command can
+  // be when we come back
+  esp_mqtt5_connection_property_config_t connect_props = {
+      .session_expiry_interval = CONFIG_LAMP_MQTT_SESSION_EXPIRY_S,
+      .topic_alias_maximum = CONFIG_LAMP_MQTT_TOPIC_ALIASES,
+  };
+  esp_mqtt5_client_set_connect_property(client, &connect_props);
+
   esp_mqtt_client_register_event(client, MQTT_EVENT_DATA, event_handler, NULL);
   esp_mqtt_client_register_event(client, -1, mqtt_connection_event_handler,
                                  NULL);
@@ -66,3 +189,115 @@ void stop_mqtt_client(void) {
   }
   esp_mqtt_client_stop(client);
 }
+
+void mqtt_get_stats(mqtt_stats_t *out) { *out = stats; }
+
+int mqtt_enqueue(const char *topic, const char *data, int len, int qos,
+                 int retain) {
+  const mqtt_topic_t plain = {.name = topic};
+  return mqtt_enqueue_to(&plain, data, len, qos, retain);
+}
+
+// 0 when out of aliases
+static uint16_t alias_for(const char *name) {
+  for (uint16_t n = 1; n <= CONFIG_LAMP_MQTT_TOPIC_ALIASES; n++) {
+    if (alias_topic[n] == NULL) {
+      alias_topic[n] = name;
+    }
+    if (strcmp(alias_topic[n], name) == 0) {
+      return n;
+    }
+  }
+  return 0;
+}
+
+static void publish(const publish_header_t *msg, const char *data) {
+  const mqtt_topic_t *topic = &msg->topic;
+  esp_mqtt5_publish_property_config_t props = {
+      .payload_format_indicator = topic->utf8,
+      .message_expiry_interval = topic->expiry_s,
+      .content_type = topic->content_type,
+  };
+  uint32_t connection = connection_id;
+  if (topic->alias && msg->qos == 0 && aliases_refused_on != connection) {
+    props.topic_alias = alias_for(topic->name);
+  }
+  if (props.topic_alias == 0) {
+    esp_mqtt5_client_set_publish_property(client, &props);
+    esp_mqtt_client_enqueue(client, topic->name, data, msg->len, msg->qos,
+                            msg->retain, true);
+    return;
+  }
+
+  // Written straight to the socket rather than through the outbox, so the
+  // publish can't outlive the connection that defined its alias. A reconnect
+  // between here and the write still can; the broker then drops the
+  // connection for a protocol error and the next one starts afresh.
+  bool defined = alias_defined_on[props.topic_alias] == connection;
+  esp_mqtt5_client_set_publish_property(client, &props);
+  int msg_id = esp_mqtt_client_publish(client, defined ? "" : topic->name,
+                                       data, msg->len, msg->qos, msg->retain);
+  if (msg_id < 0 && mqtt_connected) {
+    ESP_LOGW(MODULE_TAG, "Broker refused topic alias %u, sending names",
+             props.topic_alias);
+    aliases_refused_on = connection;
+    props.topic_alias = 0;
+    esp_mqtt5_client_set_publish_property(client, &props);
+    esp_mqtt_client_enqueue(client, topic->name, data, msg->len, msg->qos,
+                            msg->retain, true);
+  } else if (msg_id >= 0) {
+    alias_defined_on[props.topic_alias] = connection;
+    if (defined) {
+      stats.alias_publishes++;
+      stats.alias_bytes_saved += strlen(topic->name);
+    }
+  }
+}
+
+// The only caller of the client's publish functions. An aliased publish
+// blocks here for as long as the socket write takes, and nobody else waits.
+static void publish_task(void *arg) {
+  static uint8_t msg[MEM_PLAN_MQTT_PUBLISH_MAX_MSG];
+  while (1) {
+    size_t n = xMessageBufferReceive(publish_buffer, msg, sizeof(msg),
+                                     portMAX_DELAY);
+    if (n < sizeof(publish_header_t)) {
+      continue;
+    }
+    publish_header_t header;
+    memcpy(&header, msg, sizeof(header));
+    publish(&header, header.topic.in_place
+                         ? header.data
+                         : (const char *)msg + sizeof(header));
+  }
+}
+
+int mqtt_enqueue_to(const mqtt_topic_t *topic, const char *data, int len,
+                    int qos, int retain) {
+  if (!client || !mqtt_connected) {
+    return -1;
+  }
+  if (len == 0 && data) {
+    len = strlen(data);
+  }
+  size_t copied = topic->in_place ? 0 : len;
+  if (len > UINT16_MAX || sizeof(publish_header_t) + copied >
+                              sizeof(send_staging)) {
+    return -1;
+  }
+  const publish_header_t header = {
+      .topic = *topic,
+      .data = topic->in_place ? data : NULL,
+      .len = len,
+      .qos = qos,
+      .retain = retain,
+  };
+
+  xSemaphoreTake(send_lock, portMAX_DELAY);
+  memcpy(send_staging, &header, sizeof(header));
+  memcpy(send_staging + sizeof(header), data, copied);
+  size_t sent = xMessageBufferSend(publish_buffer, send_staging,
+                                   sizeof(header) + copied, 0);
+  xSemaphoreGive(send_lock);
+  return sent ? 0 : -1;
+}
@@ -1,4 +1,44 @@
+#pragma once
 #include "esp_event.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Retained clip image (see clips.h); large, so it arrives in several
+// MQTT_EVENT_DATA fragments
+#define MQTT_CLIP_TOPIC "esp001/clips"
+
+// What a topic's messages carry besides the payload (MQTT 5 properties)
+typedef struct {
+  const char *name; // kept, not copied, when aliased
+
+  const char *content_type; // MIME type; NULL to leave it out
+  uint32_t expiry_s;        // broker drops undelivered copies after; 0 never
+  bool utf8;                // payload format indicator: text, not bytes
+  // Send QoS 0 publishes as a topic alias after the first one on each
+  // connection. Not for QoS 1: a resend from the outbox after a reconnect
+  // would refer to an alias the new connection never defined.
+  bool alias;
+  // The payload is static and stays valid: published from where it is
+  // rather than copied, for dumps too large to queue
+  bool in_place;
+} mqtt_topic_t;
 
 void start_mqtt_client(esp_event_handler_t event_handler);
 void stop_mqtt_client(void);
+// Copies the message for the publish task and returns without waiting for
+// the client, so it is safe from timers and MQTT event handlers. -1 when not
+// connected or too much is already waiting; the topic name must be static.
+int mqtt_enqueue(const char *topic, const char *data, int len, int qos,
+                 int retain);
+// mqtt_enqueue() with the topic's properties
+int mqtt_enqueue_to(const mqtt_topic_t *topic, const char *data, int len,
+                    int qos, int retain);
+
+typedef struct {
+  uint32_t connects;
+  uint32_t sessions_resumed; // broker kept our subscription and queue
+  uint32_t last_connect_ms;  // TCP + TLS + CONNACK of the latest connect
+  uint32_t alias_publishes;  // sent with the topic name left out
+  uint32_t alias_bytes_saved;
+} mqtt_stats_t;
+void mqtt_get_stats(mqtt_stats_t *stats);
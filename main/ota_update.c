@@ -0,0 +1,404 @@
+#include "ota_update.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "power.h"
+#include "rom/miniz.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODULE_TAG "OTA"
+#define OTA_CHUNK_SIZE 4096
+#define OTA_COPY_CHUNK_SIZE 1024
+#define OTA_URL_MAX_LEN 256
+#define OTA_ZLIB_CMF 0x78
+// Delta stream: "LDLT", SHA-256 of the base image, then ops until OTA_OP_END
+#define DELTA_MAGIC "LDLT"
+#define DELTA_MAGIC_LEN 4
+#define DELTA_HEADER_LEN (DELTA_MAGIC_LEN + 32)
+#define OTA_OP_END 0x00
+#define OTA_OP_COPY 0x01 // uint32 base offset, uint32 length
+#define OTA_OP_ADD 0x02  // uint32 length, then that many literal bytes
+
+typedef enum {
+  PAYLOAD_UNKNOWN,
+  PAYLOAD_RAW,
+  PAYLOAD_DELTA_HEADER,
+  PAYLOAD_DELTA_OP,
+  PAYLOAD_DELTA_ARGS,
+  PAYLOAD_DELTA_ADD,
+  PAYLOAD_DELTA_END,
+} payload_mode_t;
+
+typedef struct {
+  esp_ota_handle_t handle;
+  const esp_partition_t *base; // running app, source of delta copies
+  tinfl_decompressor *tinfl;   // NULL unless the download is zlib
+  uint8_t *dict;               // inflate window, written out as it fills
+  size_t dict_ofs;
+  bool inflate_done;
+  payload_mode_t mode;
+  uint8_t header[DELTA_HEADER_LEN];
+  size_t header_len;
+  uint8_t op;
+  uint8_t args[8];
+  size_t args_len;
+  uint32_t add_left;
+} ota_ctx_t;
+
+static char ota_url[OTA_URL_MAX_LEN];
+static ota_update_status_t status;
+static esp_timer_handle_t confirm_timer = NULL;
+
+static uint32_t read_le32(const uint8_t *p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static esp_err_t image_write(ota_ctx_t *ctx, const void *data, size_t len) {
+  esp_err_t err = esp_ota_write(ctx->handle, data, len);
+  if (err == ESP_OK) {
+    status.bytes_written += len;
+  }
+  return err;
+}
+
+static esp_err_t copy_from_base(ota_ctx_t *ctx, uint32_t offset,
+                                uint32_t len) {
+  uint8_t buf[OTA_COPY_CHUNK_SIZE];
+  if (offset > ctx->base->size || len > ctx->base->size - offset) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  while (len) {
+    size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    esp_err_t err = esp_partition_read(ctx->base, offset, buf, n);
+    if (err == ESP_OK) {
+      err = image_write(ctx, buf, n);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+    offset += n;
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+// The delta is only valid against the exact image it was made from
+static esp_err_t check_delta_base(ota_ctx_t *ctx) {
+  uint8_t sha[32];
+  esp_err_t err = esp_partition_get_sha256(ctx->base, sha);
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (memcmp(sha, ctx->header + DELTA_MAGIC_LEN, sizeof(sha)) != 0) {
+    status.error = "delta base mismatch";
+    return ESP_ERR_INVALID_VERSION;
+  }
+  return ESP_OK;
+}
+
+// Consumes the (already inflated) payload: plain image bytes go straight to
+// the slot, delta ops are applied as they complete. Ops may be split across
+// calls at any byte.
+static esp_err_t payload_write(ota_ctx_t *ctx, const uint8_t *data,
+                               size_t len) {
+  esp_err_t err = ESP_OK;
+
+  while (len && err == ESP_OK) {
+    switch (ctx->mode) {
+    case PAYLOAD_UNKNOWN:
+    case PAYLOAD_DELTA_HEADER: {
+      size_t want = ctx->mode == PAYLOAD_UNKNOWN ? DELTA_MAGIC_LEN
+                                                 : DELTA_HEADER_LEN;
+      size_t n = want - ctx->header_len;
+      n = n < len ? n : len;
+      memcpy(ctx->header + ctx->header_len, data, n);
+      ctx->header_len += n;
+      data += n;
+      len -= n;
+      if (ctx->header_len < want) {
+        break;
+      }
+      if (ctx->mode == PAYLOAD_DELTA_HEADER) {
+        err = check_delta_base(ctx);
+        ctx->mode = PAYLOAD_DELTA_OP;
+      } else if (memcmp(ctx->header, DELTA_MAGIC, DELTA_MAGIC_LEN) == 0) {
+        ctx->mode = PAYLOAD_DELTA_HEADER;
+      } else {
+        ctx->mode = PAYLOAD_RAW;
+        err = image_write(ctx, ctx->header, ctx->header_len);
+      }
+      break;
+    }
+    case PAYLOAD_RAW:
+      err = image_write(ctx, data, len);
+      len = 0;
+      break;
+    case PAYLOAD_DELTA_OP:
+      ctx->op = *data++;
+      len--;
+      ctx->args_len = 0;
+      if (ctx->op == OTA_OP_END) {
+        ctx->mode = PAYLOAD_DELTA_END;
+      } else if (ctx->op == OTA_OP_COPY || ctx->op == OTA_OP_ADD) {
+        ctx->mode = PAYLOAD_DELTA_ARGS;
+      } else {
+        status.error = "bad delta op";
+        err = ESP_ERR_INVALID_RESPONSE;
+      }
+      break;
+    case PAYLOAD_DELTA_ARGS: {
+      size_t want = ctx->op == OTA_OP_COPY ? 8 : 4;
+      size_t n = want - ctx->args_len;
+      n = n < len ? n : len;
+      memcpy(ctx->args + ctx->args_len, data, n);
+      ctx->args_len += n;
+      data += n;
+      len -= n;
+      if (ctx->args_len < want) {
+        break;
+      }
+      if (ctx->op == OTA_OP_COPY) {
+        err = copy_from_base(ctx, read_le32(ctx->args),
+                             read_le32(ctx->args + 4));
+        ctx->mode = PAYLOAD_DELTA_OP;
+      } else {
+        ctx->add_left = read_le32(ctx->args);
+        ctx->mode = ctx->add_left ? PAYLOAD_DELTA_ADD : PAYLOAD_DELTA_OP;
+      }
+      break;
+    }
+    case PAYLOAD_DELTA_ADD: {
+      size_t n = len < ctx->add_left ? len : ctx->add_left;
+      err = image_write(ctx, data, n);
+      data += n;
+      len -= n;
+      ctx->add_left -= n;
+      if (ctx->add_left == 0) {
+        ctx->mode = PAYLOAD_DELTA_OP;
+      }
+      break;
+    }
+    case PAYLOAD_DELTA_END:
+      status.error = "data after delta end";
+      err = ESP_ERR_INVALID_RESPONSE;
+      break;
+    }
+  }
+  return err;
+}
+
+// Feeds one downloaded chunk through the inflater (if any) into the payload
+static esp_err_t download_write(ota_ctx_t *ctx, const uint8_t *data,
+                                size_t len) {
+  if (!ctx->tinfl) {
+    return payload_write(ctx, data, len);
+  }
+  tinfl_status st;
+  do {
+    size_t in_bytes = len;
+    size_t out_bytes = TINFL_LZ_DICT_SIZE - ctx->dict_ofs;
+    st = tinfl_decompress(
+        ctx->tinfl, data, &in_bytes, ctx->dict, ctx->dict + ctx->dict_ofs,
+        &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+    data += in_bytes;
+    len -= in_bytes;
+    if (out_bytes) {
+      esp_err_t err = payload_write(ctx, ctx->dict + ctx->dict_ofs, out_bytes);
+      if (err != ESP_OK) {
+        return err;
+      }
+      ctx->dict_ofs = (ctx->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+    }
+    if (st < TINFL_STATUS_DONE) {
+      status.error = "corrupt zlib stream";
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    ctx->inflate_done = st == TINFL_STATUS_DONE;
+    // A full window can leave output pending after the input is used up
+  } while (!ctx->inflate_done && (len || st == TINFL_STATUS_HAS_MORE_OUTPUT));
+  return ESP_OK;
+}
+
+static esp_err_t download_finish(ota_ctx_t *ctx) {
+  if (ctx->tinfl && !ctx->inflate_done) {
+    status.error = "truncated zlib stream";
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (ctx->mode != PAYLOAD_RAW && ctx->mode != PAYLOAD_DELTA_END) {
+    status.error = "truncated image";
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t ota_download(esp_http_client_handle_t client,
+                              ota_ctx_t *ctx, uint8_t *buf) {
+  esp_err_t err = esp_http_client_open(client, 0);
+  if (err != ESP_OK) {
+    return err;
+  }
+  esp_http_client_fetch_headers(client);
+  int code = esp_http_client_get_status_code(client);
+  if (code != 200) {
+    ESP_LOGE(MODULE_TAG, "HTTP %d", code);
+    status.error = "HTTP error";
+    return ESP_FAIL;
+  }
+
+  bool first = true;
+  while (1) {
+    int n = esp_http_client_read(client, (char *)buf, OTA_CHUNK_SIZE);
+    if (n < 0) {
+      status.error = "read failed";
+      return ESP_FAIL;
+    }
+    if (n == 0) {
+      break;
+    }
+    status.bytes_received += n;
+    if (first) {
+      first = false;
+      if (buf[0] == OTA_ZLIB_CMF) {
+        ctx->tinfl = malloc(sizeof(tinfl_decompressor));
+        ctx->dict = malloc(TINFL_LZ_DICT_SIZE);
+        if (!ctx->tinfl || !ctx->dict) {
+          return ESP_ERR_NO_MEM;
+        }
+        tinfl_init(ctx->tinfl);
+      }
+    }
+    err = download_write(ctx, buf, n);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  if (!esp_http_client_is_complete_data_received(client)) {
+    status.error = "connection closed early";
+    return ESP_FAIL;
+  }
+  return download_finish(ctx);
+}
+
+static void ota_task(void *arg) {
+  ota_ctx_t ctx = {.base = esp_ota_get_running_partition()};
+  const esp_partition_t *slot = esp_ota_get_next_update_partition(NULL);
+  uint8_t *buf = malloc(OTA_CHUNK_SIZE);
+  int64_t start_us = esp_timer_get_time();
+  esp_err_t err = ESP_ERR_NO_MEM;
+  power_acquire(POWER_LOCK_TRANSFER);
+
+  esp_http_client_config_t config = {
+      .url = ota_url,
+      .crt_bundle_attach = esp_crt_bundle_attach,
+      .timeout_ms = 10000,
+      .keep_alive_enable = true,
+  };
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+
+  if (buf && client && slot) {
+    ESP_LOGI(MODULE_TAG, "Updating %s from %s", slot->label, ota_url);
+    err = esp_ota_begin(slot, OTA_WITH_SEQUENTIAL_WRITES, &ctx.handle);
+    if (err == ESP_OK) {
+      err = ota_download(client, &ctx, buf);
+      if (err == ESP_OK) {
+        // Checks the image header, segments and appended SHA-256
+        err = esp_ota_end(ctx.handle);
+      } else {
+        esp_ota_abort(ctx.handle);
+      }
+    }
+    if (err == ESP_OK) {
+      err = esp_ota_set_boot_partition(slot);
+    }
+  }
+  if (client) {
+    esp_http_client_cleanup(client);
+  }
+  free(ctx.tinfl);
+  free(ctx.dict);
+  free(buf);
+  power_release(POWER_LOCK_TRANSFER);
+
+  uint32_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+  if (err != ESP_OK) {
+    if (!status.error) {
+      status.error = esp_err_to_name(err);
+    }
+    ESP_LOGE(MODULE_TAG, "Update failed: %s", status.error);
+    status.state = OTA_UPDATE_FAILED;
+    vTaskDelete(NULL);
+    return;
+  }
+
+  ESP_LOGI(MODULE_TAG,
+           "Wrote %" PRIu32 " bytes from %" PRIu32 " downloaded in %" PRIu32
+           " ms, rebooting",
+           status.bytes_written, status.bytes_received, elapsed_ms);
+  status.state = OTA_UPDATE_DONE;
+  // Give a polling client the chance to see DONE
+  vTaskDelay(pdMS_TO_TICKS(1000));
+  esp_restart();
+}
+
+esp_err_t ota_update_start(const char *url) {
+  if (status.state == OTA_UPDATE_RUNNING || status.state == OTA_UPDATE_DONE) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (strlen(url) >= sizeof(ota_url)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  strcpy(ota_url, url);
+  status = (ota_update_status_t){.state = OTA_UPDATE_RUNNING};
+  // TLS and the HTTP client need the larger stack
+  if (xTaskCreate(ota_task, "ota", 8192, NULL, 5, NULL) != pdPASS) {
+    status.state = OTA_UPDATE_IDLE;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+void ota_update_get_status(ota_update_status_t *out) { *out = status; }
+
+static void confirm_timeout_cb(void *arg) {
+  ESP_LOGE(MODULE_TAG, "New image never reached the broker, rolling back");
+  esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void ota_update_init(void) {
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  esp_ota_img_states_t state;
+
+  if (esp_ota_get_state_partition(running, &state) != ESP_OK ||
+      state != ESP_OTA_IMG_PENDING_VERIFY) {
+    return;
+  }
+  ESP_LOGW(MODULE_TAG, "First boot of %s, waiting for confirmation",
+           running->label);
+  const esp_timer_create_args_t timer_args = {
+      .callback = confirm_timeout_cb,
+      .name = "ota_confirm",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &confirm_timer));
+  esp_timer_start_once(confirm_timer,
+                       (uint64_t)CONFIG_LAMP_OTA_CONFIRM_TIMEOUT_S * 1000000);
+}
+
+void ota_update_confirm(void) {
+  if (!confirm_timer) {
+    return;
+  }
+  esp_timer_stop(confirm_timer);
+  esp_timer_delete(confirm_timer);
+  confirm_timer = NULL;
+  esp_ota_mark_app_valid_cancel_rollback();
+  ESP_LOGI(MODULE_TAG, "Image confirmed");
+}
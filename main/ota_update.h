@@ -0,0 +1,33 @@
+#pragma once
+#include "esp_err.h"
+#include <stdint.h>
+
+// Pulls a firmware image over HTTP(S) and streams it into the inactive OTA
+// slot. The download may be a plain app image, a zlib stream (inflated in
+// place with the ROM inflater) or a delta against the running app, see
+// bin/ota_pack.mjs for the formats. Nothing is buffered beyond one chunk and
+// the 32 KB inflate window.
+
+typedef enum {
+  OTA_UPDATE_IDLE,
+  OTA_UPDATE_RUNNING,
+  OTA_UPDATE_FAILED,
+  OTA_UPDATE_DONE, // new slot selected, rebooting
+} ota_update_state_t;
+
+typedef struct {
+  ota_update_state_t state;
+  uint32_t bytes_received; // over the wire
+  uint32_t bytes_written;  // into the OTA slot
+  const char *error;       // set when FAILED
+} ota_update_status_t;
+
+// Call once at boot. If this is the first boot of a new image, arms a timer
+// that rolls back unless ota_update_confirm() is called in time.
+void ota_update_init(void);
+// The running image proved it can reach the broker; cancels the rollback
+void ota_update_confirm(void);
+// Starts the download on its own task; ESP_ERR_INVALID_STATE if one is
+// already running
+esp_err_t ota_update_start(const char *url);
+void ota_update_get_status(ota_update_status_t *status);
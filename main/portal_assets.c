@@ -0,0 +1,63 @@
+#include "portal_assets.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
+extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
+
+typedef struct {
+  const char *path;
+  const char *content_type;
+  const uint8_t *start;
+  const uint8_t *end;
+  char etag[11]; // "xxxxxxxx", filled on first use
+} portal_asset_t;
+
+static portal_asset_t assets[] = {
+    {"/", "text/html", index_html_gz_start, index_html_gz_end},
+    {"/index.html", "text/html", index_html_gz_start, index_html_gz_end},
+};
+
+// The content is fixed for the lifetime of the firmware, so a hash of it is
+// a valid strong validator
+static void compute_etag(portal_asset_t *asset) {
+  uint32_t hash = 2166136261u;
+  for (const uint8_t *p = asset->start; p < asset->end; p++) {
+    hash = (hash ^ *p) * 16777619u;
+  }
+  snprintf(asset->etag, sizeof(asset->etag), "\"%08" PRIx32 "\"", hash);
+}
+
+bool portal_assets_serve(portal_conn_t *conn, const portal_request_t *req) {
+  if (req->method != PORTAL_GET) {
+    return false;
+  }
+
+  for (size_t i = 0; i < sizeof(assets) / sizeof(assets[0]); i++) {
+    portal_asset_t *asset = &assets[i];
+    if (strcmp(asset->path, req->path) != 0) {
+      continue;
+    }
+    if (asset->etag[0] == '\0') {
+      compute_etag(asset);
+    }
+
+    char headers[96];
+    snprintf(headers, sizeof(headers),
+             "ETag: %s\r\n"
+             "Cache-Control: no-cache\r\n",
+             asset->etag);
+    if (req->if_none_match && strstr(req->if_none_match, asset->etag)) {
+      portal_send(conn, "304 Not Modified", asset->content_type, headers,
+                  NULL, 0);
+      return true;
+    }
+
+    strlcat(headers, "Content-Encoding: gzip\r\n", sizeof(headers));
+    portal_send(conn, "200 OK", asset->content_type, headers, asset->start,
+                asset->end - asset->start);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "portal_server.h"
+#include <stdbool.h>
+
+// Serves the build-time gzipped portal assets straight from flash, with an
+// ETag so repeat probes get a bodiless 304. Returns false if `req` isn't for
+// a known asset.
+bool portal_assets_serve(portal_conn_t *conn, const portal_request_t *req);
@@ -0,0 +1,448 @@
+#include "portal_server.h"
+#include "mem_plan.h"
+#include "trace.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+
+#define MODULE_TAG "PORTAL"
+
+#define PORTAL_HTTP_PORT 80
+#define PORTAL_MAX_CONNS 5 // + listen + DNS socket, within LWIP_MAX_SOCKETS
+#define PORTAL_RX_LEN 1024 // request line, headers and the credentials form
+#define PORTAL_TX_HEADER_LEN 384
+// The request, then the response header and a copied body
+#define PORTAL_BUF_LEN (PORTAL_TX_HEADER_LEN + PORTAL_MAX_COPIED_BODY)
+#define PORTAL_DNS_BUF_LEN 512
+#define PORTAL_IDLE_TIMEOUT_US (10 * 1000 * 1000)
+#define PORTAL_EVICT_IDLE_US (1000 * 1000)
+#define PORTAL_STATS_INTERVAL_US (10 * 1000 * 1000)
+
+_Static_assert(PORTAL_RX_LEN < PORTAL_BUF_LEN, "request must fit the slot");
+
+struct portal_conn {
+  int fd; // -1 when the slot is free
+  size_t len;
+  int64_t last_active_us;
+  // Response still being written, once portal_send() has been called: the
+  // header (and a copied body) in buf, then a body sent from where it lives
+  bool responding;
+  const char *out[2];
+  size_t out_len[2];
+  int out_part;
+  size_t out_sent;
+  char buf[PORTAL_BUF_LEN];
+};
+
+static portal_server_config_t config;
+static portal_conn_t conns[PORTAL_MAX_CONNS];
+static uint8_t dns_buf[PORTAL_DNS_BUF_LEN];
+static portal_server_stats_t stats;
+
+static StaticTask_t task_tcb;
+static StackType_t task_stack[MEM_PLAN_PORTAL_TASK_STACK];
+static TaskHandle_t task = NULL;
+static volatile bool running = false;
+
+static void close_conn(portal_conn_t *conn) {
+  if (conn->fd >= 0) {
+    close(conn->fd);
+  }
+  conn->fd = -1;
+  conn->len = 0;
+  conn->responding = false;
+}
+
+// Writes as much of the response as the socket takes now; the rest goes out
+// when select() reports the socket writable again
+static void flush_conn(portal_conn_t *conn) {
+  while (conn->out_part < 2) {
+    int part = conn->out_part;
+    if (conn->out_sent == conn->out_len[part]) {
+      conn->out_part++;
+      conn->out_sent = 0;
+      continue;
+    }
+    int ret = send(conn->fd, conn->out[part] + conn->out_sent,
+                   conn->out_len[part] - conn->out_sent, 0);
+    if (ret < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        close_conn(conn);
+      }
+      return;
+    }
+    conn->out_sent += ret;
+    conn->last_active_us = esp_timer_get_time();
+  }
+  close_conn(conn);
+}
+
+void portal_send(portal_conn_t *conn, const char *status,
+                 const char *content_type, const char *headers,
+                 const void *body, size_t len) {
+  if (!body) {
+    len = 0;
+  }
+  // Small bodies are copied behind the header, so handlers may answer from
+  // their stack; the body can live in buf itself, hence the moves
+  bool copy = len <= PORTAL_MAX_COPIED_BODY;
+  if (copy && len) {
+    memmove(conn->buf + PORTAL_TX_HEADER_LEN, body, len);
+  }
+  int hdr_len = snprintf(conn->buf, PORTAL_TX_HEADER_LEN,
+                         "HTTP/1.1 %s\r\n"
+                         "Content-Type: %s\r\n"
+                         "Content-Length: %u\r\n"
+                         "%s"
+                         "Connection: close\r\n\r\n",
+                         status, content_type ? content_type : "text/plain",
+                         (unsigned)len, headers ? headers : "");
+  if (hdr_len <= 0 || hdr_len >= PORTAL_TX_HEADER_LEN) {
+    ESP_LOGE(MODULE_TAG, "Response headers too long");
+    close_conn(conn);
+    return;
+  }
+
+  conn->out[0] = conn->buf;
+  conn->out_len[0] = hdr_len;
+  conn->out[1] = body;
+  conn->out_len[1] = len;
+  if (copy && len) {
+    memmove(conn->buf + hdr_len, conn->buf + PORTAL_TX_HEADER_LEN, len);
+  }
+  if (copy) {
+    conn->out_len[0] += len;
+    conn->out_len[1] = 0;
+  }
+  conn->out_part = 0;
+  conn->out_sent = 0;
+  conn->responding = true;
+  flush_conn(conn);
+}
+
+// Looks up header `name` in [start, end) without modifying the buffer
+static char *header_value(char *start, const char *end, const char *name,
+                          size_t *len) {
+  size_t name_len = strlen(name);
+  for (char *line = start; line < end;) {
+    char *eol = strstr(line, "\r\n");
+    if (!eol || eol > end) {
+      eol = (char *)end;
+    }
+    if (eol - line > name_len && strncasecmp(line, name, name_len) == 0 &&
+        line[name_len] == ':') {
+      char *value = line + name_len + 1;
+      while (*value == ' ') {
+        value++;
+      }
+      *len = eol - value;
+      return value;
+    }
+    line = eol + 2;
+  }
+  return NULL;
+}
+
+static void dispatch(portal_conn_t *conn, char *header_end) {
+  portal_request_t req = {0};
+  char *line = conn->buf;
+
+  if (strncmp(line, "GET ", 4) == 0) {
+    req.method = PORTAL_GET;
+    line += 4;
+  } else if (strncmp(line, "POST ", 5) == 0) {
+    req.method = PORTAL_POST;
+    line += 5;
+  } else {
+    portal_send(conn, "405 Method Not Allowed", NULL, NULL, NULL, 0);
+    return;
+  }
+
+  // Request target, up to the next space
+  char *target_end = strchr(line, ' ');
+  char *line_end = strstr(line, "\r\n");
+  if (!target_end || !line_end || target_end > line_end) {
+    portal_send(conn, "400 Bad Request", NULL, NULL, NULL, 0);
+    return;
+  }
+  *target_end = '\0';
+  req.path = line;
+  char *query = strchr(line, '?');
+  if (query) {
+    *query = '\0';
+    req.query = query + 1;
+  }
+
+  // Header block: between the request line and the blank line
+  req.body = header_end + 4;
+  req.body_len = conn->len - (req.body - conn->buf);
+  size_t inm_len;
+  char *inm = header_value(line_end + 2, header_end, "If-None-Match", &inm_len);
+  if (inm) {
+    inm[inm_len] = '\0'; // overwrites the '\r', headers are done with
+    req.if_none_match = inm;
+  }
+
+  stats.http_requests++;
+  for (size_t i = 0; i < config.num_routes; i++) {
+    const portal_route_t *route = &config.routes[i];
+    if (route->method == req.method && strcmp(route->path, req.path) == 0) {
+      trace_event(TRACE_HTTP_REQUEST, req.method, i, 0);
+      route->handler(conn, &req);
+      return;
+    }
+  }
+  trace_event(TRACE_HTTP_REQUEST, req.method, -1, 0);
+  config.fallback(conn, &req);
+}
+
+// Returns true once a full request (headers + Content-Length body) is in
+static bool request_complete(portal_conn_t *conn, char **header_end) {
+  conn->buf[conn->len] = '\0';
+  char *end = strstr(conn->buf, "\r\n\r\n");
+  if (!end) {
+    return false;
+  }
+  *header_end = end;
+
+  size_t content_len = 0, cl_len;
+  const char *cl = header_value(conn->buf, end, "Content-Length", &cl_len);
+  if (cl) {
+    content_len = strtoul(cl, NULL, 10);
+  }
+  return conn->len >= (end + 4 - conn->buf) + content_len;
+}
+
+static void handle_readable(portal_conn_t *conn) {
+  if (conn->len >= PORTAL_RX_LEN) {
+    portal_send(conn, "413 Payload Too Large", NULL, NULL, NULL, 0);
+    return;
+  }
+  int ret = recv(conn->fd, conn->buf + conn->len, PORTAL_RX_LEN - conn->len,
+                 0);
+  if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  if (ret <= 0) {
+    close_conn(conn);
+    return;
+  }
+  conn->len += ret;
+  conn->last_active_us = esp_timer_get_time();
+
+  char *header_end;
+  if (request_complete(conn, &header_end)) {
+    dispatch(conn, header_end);
+  } else if (conn->len >= PORTAL_RX_LEN) {
+    portal_send(conn, "413 Payload Too Large", NULL, NULL, NULL, 0);
+  }
+}
+
+// Free slot, or the least recently active connection if it has been quiet
+// long enough to evict: a phone that opened a socket and went silent
+// shouldn't lock others out. NULL while every slot is genuinely busy; new
+// clients then wait in the listen backlog.
+static portal_conn_t *claimable_slot(int64_t now) {
+  portal_conn_t *lru = NULL;
+  for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+    if (conns[i].fd < 0) {
+      return &conns[i];
+    }
+    if (!lru || conns[i].last_active_us < lru->last_active_us) {
+      lru = &conns[i];
+    }
+  }
+  return now - lru->last_active_us > PORTAL_EVICT_IDLE_US ? lru : NULL;
+}
+
+static void accept_conn(int listen_fd, portal_conn_t *slot) {
+  int fd = accept(listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  if (slot->fd >= 0) {
+    stats.evicted++;
+    close_conn(slot);
+  }
+
+  // Never block the task that serves everyone else on one slow phone
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  slot->fd = fd;
+  slot->len = 0;
+  slot->responding = false;
+  slot->last_active_us = esp_timer_get_time();
+}
+
+static int open_listen_socket(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(PORTAL_HTTP_PORT),
+      .sin_addr.s_addr = htonl(INADDR_ANY),
+  };
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, PORTAL_MAX_CONNS) < 0) {
+    ESP_LOGE(MODULE_TAG, "HTTP socket bind/listen failed: errno %d", errno);
+    close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+static void portal_task(void *arg) {
+  dns_server_handle_t dns = dns_server_create(config.dns);
+  int dns_fd = dns ? dns_server_open_socket() : -1;
+  int listen_fd = open_listen_socket();
+  if (dns_fd >= 0) {
+    fcntl(dns_fd, F_SETFL, O_NONBLOCK);
+  }
+
+  int64_t window_start_us = esp_timer_get_time();
+  uint32_t window_requests = 0;
+
+  while (running) {
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    int max_fd = -1;
+    if (dns_fd >= 0) {
+      FD_SET(dns_fd, &readable);
+      max_fd = dns_fd;
+    }
+    portal_conn_t *free_slot = claimable_slot(esp_timer_get_time());
+    if (listen_fd >= 0 && free_slot) {
+      FD_SET(listen_fd, &readable);
+      max_fd = MAX(max_fd, listen_fd);
+    }
+    for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+      if (conns[i].fd >= 0) {
+        // Requests are read to the end before the response starts
+        FD_SET(conns[i].fd, conns[i].responding ? &writable : &readable);
+        max_fd = MAX(max_fd, conns[i].fd);
+      }
+    }
+
+    // Bounded wait so stop requests and idle timeouts are noticed
+    struct timeval tv = {.tv_sec = 1};
+    int ready = select(max_fd + 1, &readable, &writable, NULL, &tv);
+    if (ready < 0) {
+      ESP_LOGE(MODULE_TAG, "select failed: errno %d", errno);
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+
+    uint32_t before = stats.http_requests + stats.dns_queries;
+    if (dns_fd >= 0 && FD_ISSET(dns_fd, &readable)) {
+      // Drain everything queued: phones fire several lookups at once
+      while (dns_server_handle_request(dns, dns_fd, dns_buf,
+                                       sizeof(dns_buf)) > 0) {
+        stats.dns_queries++;
+      }
+    }
+    for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+      if (conns[i].fd < 0) {
+        continue;
+      }
+      if (FD_ISSET(conns[i].fd, &writable)) {
+        flush_conn(&conns[i]);
+      } else if (FD_ISSET(conns[i].fd, &readable)) {
+        handle_readable(&conns[i]);
+      }
+    }
+    if (listen_fd >= 0 && free_slot && FD_ISSET(listen_fd, &readable)) {
+      // Re-check: the slot may have been freed or reused above
+      free_slot = claimable_slot(esp_timer_get_time());
+      if (free_slot) {
+        accept_conn(listen_fd, free_slot);
+      }
+    }
+    window_requests += stats.http_requests + stats.dns_queries - before;
+
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+      if (conns[i].fd >= 0 &&
+          now - conns[i].last_active_us > PORTAL_IDLE_TIMEOUT_US) {
+        close_conn(&conns[i]);
+      }
+    }
+    if (now - window_start_us >= PORTAL_STATS_INTERVAL_US) {
+      stats.requests_per_s =
+          window_requests * 1000000LL / (now - window_start_us);
+      if (window_requests) {
+        ESP_LOGI(MODULE_TAG, "%" PRIu32 " req/s (http %" PRIu32
+                             ", dns %" PRIu32 " total)",
+                 stats.requests_per_s, stats.http_requests,
+                 stats.dns_queries);
+      }
+      window_start_us = now;
+      window_requests = 0;
+    }
+  }
+
+  for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+    close_conn(&conns[i]);
+  }
+  if (listen_fd >= 0) {
+    close(listen_fd);
+  }
+  if (dns_fd >= 0) {
+    close(dns_fd);
+  }
+  dns_server_destroy(dns);
+  ESP_LOGI(MODULE_TAG, "Stopped, stack high water mark %u bytes",
+           (unsigned)uxTaskGetStackHighWaterMark(NULL) * sizeof(StackType_t));
+  task = NULL;
+  vTaskDelete(NULL);
+}
+
+bool portal_server_start(const portal_server_config_t *cfg) {
+  if (task) {
+    return true;
+  }
+  config = *cfg;
+  memset(&stats, 0, sizeof(stats));
+  for (int i = 0; i < PORTAL_MAX_CONNS; i++) {
+    conns[i].fd = -1;
+    conns[i].len = 0;
+    conns[i].responding = false;
+  }
+
+  running = true;
+  task = xTaskCreateStatic(portal_task, "portal", MEM_PLAN_PORTAL_TASK_STACK,
+                           NULL, MEM_PLAN_PORTAL_TASK_PRIO, task_stack,
+                           &task_tcb);
+  // What this replaces: a 4096 B DNS task, the httpd task (4096 B) and its
+  // per-connection heap allocations
+  ESP_LOGI(MODULE_TAG,
+           "Started: 1 task, %u B static (stack %u, %d conns x %u B), "
+           "free heap %" PRIu32,
+           (unsigned)(sizeof(task_stack) + sizeof(conns) + sizeof(dns_buf)),
+           (unsigned)sizeof(task_stack), PORTAL_MAX_CONNS,
+           (unsigned)sizeof(conns[0]), esp_get_free_heap_size());
+  return task != NULL;
+}
+
+void portal_server_stop(void) {
+  running = false;
+  // The task notices within one select() timeout and cleans up itself
+  while (task) {
+    vTaskDelay(pdMS_TO_TICKS(50));
+  }
+}
+
+void portal_server_get_stats(portal_server_stats_t *out) { *out = stats; }
@@ -0,0 +1,63 @@
+#pragma once
+#include "dns_server.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Provisioning service: captive DNS and the portal's HTTP server multiplexed
+// with select() in a single task. All buffers (connection slots, DNS packet,
+// task stack) are allocated statically, so serving many phones at once does
+// not touch the heap.
+
+typedef enum {
+  PORTAL_GET,
+  PORTAL_POST,
+} portal_method_t;
+
+typedef struct {
+  portal_method_t method;
+  const char *path;          // without query string
+  const char *query;         // after '?', or NULL
+  const char *if_none_match; // header value, or NULL
+  const char *body;          // not null-terminated
+  size_t body_len;
+} portal_request_t;
+
+typedef struct portal_conn portal_conn_t;
+typedef void (*portal_handler_t)(portal_conn_t *conn,
+                                 const portal_request_t *req);
+
+typedef struct {
+  portal_method_t method;
+  const char *path; // exact match
+  portal_handler_t handler;
+} portal_route_t;
+
+typedef struct {
+  const portal_route_t *routes;
+  size_t num_routes;
+  portal_handler_t fallback; // anything no route matched
+  dns_server_config_t *dns;
+} portal_server_config_t;
+
+typedef struct {
+  uint32_t http_requests;
+  uint32_t dns_queries;
+  uint32_t evicted; // connections dropped to make room for a new one
+  uint32_t requests_per_s; // HTTP + DNS over the last report interval
+} portal_server_stats_t;
+
+bool portal_server_start(const portal_server_config_t *config);
+void portal_server_stop(void);
+void portal_server_get_stats(portal_server_stats_t *stats);
+
+// Bodies up to this size are copied; larger ones (embedded assets) are sent
+// from where they are and must stay unchanged until the connection closes
+#define PORTAL_MAX_COPIED_BODY 1536
+
+// Starts a response and closes the connection once it is written; sockets
+// are non-blocking, so what a slow client has not taken yet goes out as it
+// drains. `headers` are extra CRLF-terminated header lines, or NULL.
+void portal_send(portal_conn_t *conn, const char *status,
+                 const char *content_type, const char *headers,
+                 const void *body, size_t len);
@@ -0,0 +1,56 @@
+#include "power.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#define MODULE_TAG "POWER"
+
+#if CONFIG_PM_ENABLE
+// Named for esp_pm_dump_locks() (CONFIG_PM_PROFILING)
+static const char *const lock_names[POWER_LOCK_COUNT] = {
+    [POWER_LOCK_RENDER] = "render",
+    [POWER_LOCK_TRANSFER] = "transfer",
+};
+static esp_pm_lock_handle_t locks[POWER_LOCK_COUNT];
+#endif
+
+void power_init(void) {
+#if CONFIG_PM_ENABLE
+  esp_pm_config_t config = {
+      .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = CONFIG_LAMP_PM_MIN_CPU_FREQ_MHZ,
+#if CONFIG_LAMP_PM_LIGHT_SLEEP
+      .light_sleep_enable = true,
+#endif
+  };
+  ESP_ERROR_CHECK(esp_pm_configure(&config));
+  // Full speed also keeps the chip out of light sleep. WiFi and the RMT
+  // channel hold their own locks while they are active.
+  for (int i = 0; i < POWER_LOCK_COUNT; i++) {
+    ESP_ERROR_CHECK(
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, lock_names[i], &locks[i]));
+  }
+  ESP_LOGI(MODULE_TAG, "CPU %d-%d MHz, light sleep %s",
+           CONFIG_LAMP_PM_MIN_CPU_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+           config.light_sleep_enable ? "on" : "off");
+#endif
+}
+
+void power_acquire(power_lock_t lock) {
+#if CONFIG_PM_ENABLE
+  if (locks[lock]) {
+    esp_pm_lock_acquire(locks[lock]);
+  }
+#endif
+}
+
+void power_release(power_lock_t lock) {
+#if CONFIG_PM_ENABLE
+  if (locks[lock]) {
+    esp_pm_lock_release(locks[lock]);
+  }
+#endif
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// Frequency scaling and automatic light sleep (CONFIG_PM_ENABLE), and the
+// locks that hold the CPU at full speed while there is work. Without PM,
+// as in the simulator, these do nothing.
+
+typedef enum {
+  POWER_LOCK_RENDER,   // building a frame and sending it to the strip
+  POWER_LOCK_TRANSFER, // clip upload or OTA: flash writes, TLS, inflate
+  POWER_LOCK_COUNT,
+} power_lock_t;
+
+void power_init(void);
+// Counted: every acquire needs its release
+void power_acquire(power_lock_t lock);
+void power_release(power_lock_t lock);
@@ -0,0 +1,85 @@
+#include "preview.h"
+#include "sdkconfig.h"
+
+#if CONFIG_LAMP_PREVIEW
+#include "esp_log.h"
+#include "frame_delta.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "led.h"
+#include "mem_plan.h"
+#include "mqtt.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define MODULE_TAG "PREVIEW"
+#define PREVIEW_MAX_LEDS 256
+
+static const mqtt_topic_t preview_topic = {
+    .name = CONFIG_LAMP_PREVIEW_TOPIC,
+    .content_type = "application/x-lamp-frame-delta",
+    .alias = true,
+};
+
+static StaticTask_t preview_task_tcb;
+static StackType_t preview_task_stack[MEM_PLAN_PREVIEW_TASK_STACK];
+
+static rgb8_t sent[PREVIEW_MAX_LEDS];
+static rgb8_t cur[PREVIEW_MAX_LEDS];
+static uint8_t msg[FRAME_DELTA_MAX_LEN(PREVIEW_MAX_LEDS)];
+
+static void preview_task(void *arg) {
+  const uint16_t count = led_count();
+  const TickType_t period = pdMS_TO_TICKS(1000 / CONFIG_LAMP_PREVIEW_FPS);
+  const TickType_t keyframe_period =
+      pdMS_TO_TICKS(CONFIG_LAMP_PREVIEW_KEYFRAME_S * 1000);
+  bool have_sent = false; // viewers hold `sent`
+  bool settled = false;   // the last message was a keyframe
+  TickType_t last_keyframe = 0;
+  uint8_t seq = 0;
+  TickType_t wake = xTaskGetTickCount();
+
+  while (1) {
+    vTaskDelayUntil(&wake, period);
+    led_snapshot(cur);
+    bool changed = !have_sent || memcmp(cur, sent, count * sizeof(rgb8_t));
+    if (!changed && settled) {
+      continue;
+    }
+    // Keyframes go out periodically while the scene moves, and once more
+    // when it settles, so the retained copy is never stale for long
+    TickType_t now = xTaskGetTickCount();
+    bool keyframe = !have_sent || !changed ||
+                    now - last_keyframe >= keyframe_period;
+
+    size_t len =
+        frame_delta_encode(keyframe ? NULL : sent, cur, count, seq, msg);
+    if (mqtt_enqueue_to(&preview_topic, (const char *)msg, len, 0,
+                        keyframe) < 0) {
+      // Not connected; viewers may have missed anything from here on
+      have_sent = false;
+      continue;
+    }
+    memcpy(sent, cur, count * sizeof(rgb8_t));
+    have_sent = true;
+    settled = keyframe;
+    if (keyframe) {
+      last_keyframe = now;
+    }
+    seq++;
+  }
+}
+
+void preview_start(void) {
+  if (led_count() > PREVIEW_MAX_LEDS) {
+    ESP_LOGE(MODULE_TAG, "%u LEDs, preview supports %d", led_count(),
+             PREVIEW_MAX_LEDS);
+    return;
+  }
+  xTaskCreateStatic(preview_task, "preview", MEM_PLAN_PREVIEW_TASK_STACK,
+                    NULL, MEM_PLAN_PREVIEW_TASK_PRIO, preview_task_stack,
+                    &preview_task_tcb);
+}
+#else
+void preview_start(void) {}
+#endif
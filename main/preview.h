@@ -0,0 +1,7 @@
+#pragma once
+
+// Optional live mirror of the strip (CONFIG_LAMP_PREVIEW): the frame is
+// sampled at a reduced rate and published delta-coded (frame_delta.h), so a
+// static scene costs nothing after its keyframe. Keyframes are retained
+// for viewers that subscribe later.
+void preview_start(void);
@@ -0,0 +1,38 @@
+#include "schedule.h"
+#include <string.h>
+
+bool schedule_push(schedule_t *s, uint64_t due_ms, const char *cmd,
+                   size_t len) {
+  if (s->count == SCHEDULE_MAX_ENTRIES || len > SCHEDULE_MAX_CMD_LEN) {
+    return false;
+  }
+  int i = s->count;
+  // Insertion from the back: a handful of entries, mostly arriving in order
+  while (i > 0 && s->entries[i - 1].due_ms > due_ms) {
+    s->entries[i] = s->entries[i - 1];
+    i--;
+  }
+  s->entries[i].due_ms = due_ms;
+  s->entries[i].len = len;
+  memcpy(s->entries[i].cmd, cmd, len);
+  s->count++;
+  return true;
+}
+
+bool schedule_pop_due(schedule_t *s, uint64_t now_ms, schedule_entry_t *out) {
+  if (s->count == 0 || s->entries[0].due_ms > now_ms) {
+    return false;
+  }
+  *out = s->entries[0];
+  s->count--;
+  memmove(&s->entries[0], &s->entries[1], s->count * sizeof(s->entries[0]));
+  return true;
+}
+
+bool schedule_next_due(const schedule_t *s, uint64_t *due_ms) {
+  if (s->count == 0) {
+    return false;
+  }
+  *due_ms = s->entries[0].due_ms;
+  return true;
+}
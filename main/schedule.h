@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Time-ordered queue of commands waiting for their execute-at time. Plain
+// data with no locking or clock of its own, so it runs the same on the host.
+
+#define SCHEDULE_MAX_ENTRIES 8
+#define SCHEDULE_MAX_CMD_LEN 64
+
+typedef struct {
+  uint64_t due_ms; // lamp clock, ms since the epoch
+  uint16_t len;
+  char cmd[SCHEDULE_MAX_CMD_LEN];
+} schedule_entry_t;
+
+typedef struct {
+  schedule_entry_t entries[SCHEDULE_MAX_ENTRIES]; // earliest first
+  int count;
+} schedule_t;
+
+// False when full or the command is too long. Entries due at the same time
+// keep their arrival order.
+bool schedule_push(schedule_t *s, uint64_t due_ms, const char *cmd,
+                   size_t len);
+// Removes and returns the earliest entry if it is due by now_ms
+bool schedule_pop_due(schedule_t *s, uint64_t now_ms, schedule_entry_t *out);
+// Due time of the earliest entry; false when empty
+bool schedule_next_due(const schedule_t *s, uint64_t *due_ms);
@@ -0,0 +1,355 @@
+#include "settings.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mem_plan.h"
+#include "nvs.h"
+#include <string.h>
+
+#define MODULE_TAG "SETTINGS"
+
+typedef enum {
+  SETTING_U8,
+  SETTING_U32,
+  SETTING_STR,
+  SETTING_BLOB,
+} setting_type_t;
+
+typedef struct {
+  const char *ns;
+  const char *key;
+  setting_type_t type;
+  uint8_t max_len; // strings and blobs; strings count their NUL
+  uint32_t def;    // integers
+} setting_desc_t;
+
+// The wifi keys predate this store and keep their names and types
+static const setting_desc_t descs[SETTING_COUNT] = {
+    [SETTING_WIFI_SSID] = {"wifi", "ssid", SETTING_STR, 33},
+    [SETTING_WIFI_PASS] = {"wifi", "pass", SETTING_STR, 65},
+    [SETTING_WIFI_VALID] = {"wifi", "valid", SETTING_U8},
+    [SETTING_WIFI_AP_CACHE] = {"wifi", "ap_cache", SETTING_BLOB, 7},
+    [SETTING_LAST_COMMAND] = {"lamp", "last_cmd", SETTING_STR, 65},
+};
+
+typedef struct {
+  bool present; // unset strings and blobs are erased when written
+  bool dirty;   // differs from flash
+  uint8_t len;  // used bytes of data; strings include the NUL
+  uint8_t data[SETTINGS_MAX_LEN];
+} setting_value_t;
+
+// The cache; values, pending and stats are guarded by values_lock
+static portMUX_TYPE values_lock = portMUX_INITIALIZER_UNLOCKED;
+static setting_value_t values[SETTING_COUNT];
+static bool pending = false; // writer notified
+static settings_stats_t stats;
+
+// One writer at a time: the task or settings_flush()
+static SemaphoreHandle_t write_lock = NULL;
+static StaticSemaphore_t write_lock_buf;
+static TaskHandle_t writer = NULL;
+static StaticTask_t writer_tcb;
+static StackType_t writer_stack[MEM_PLAN_SETTINGS_TASK_STACK];
+
+static void load(setting_id_t id, nvs_handle_t nvs) {
+  const setting_desc_t *d = &descs[id];
+  setting_value_t *v = &values[id];
+  size_t len = d->max_len;
+  esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+  switch (d->type) {
+  case SETTING_U8:
+    v->data[0] = d->def;
+    v->len = 1;
+    if (nvs) {
+      err = nvs_get_u8(nvs, d->key, &v->data[0]);
+    }
+    break;
+  case SETTING_U32: {
+    uint32_t value = d->def;
+    if (nvs) {
+      err = nvs_get_u32(nvs, d->key, &value);
+    }
+    memcpy(v->data, &value, sizeof(value));
+    v->len = sizeof(value);
+    break;
+  }
+  case SETTING_STR:
+    if (nvs) {
+      err = nvs_get_str(nvs, d->key, (char *)v->data, &len);
+    }
+    v->len = err == ESP_OK ? len : 0;
+    break;
+  case SETTING_BLOB:
+    if (nvs) {
+      err = nvs_get_blob(nvs, d->key, v->data, &len);
+    }
+    v->len = err == ESP_OK ? len : 0;
+    break;
+  }
+  v->present = err == ESP_OK;
+  if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+    ESP_LOGW(MODULE_TAG, "%s/%s unreadable (%s), using the default", d->ns,
+             d->key, esp_err_to_name(err));
+  }
+}
+
+static esp_err_t write_one(nvs_handle_t nvs, setting_id_t id,
+                           const setting_value_t *v) {
+  const setting_desc_t *d = &descs[id];
+  if (!v->present) {
+    esp_err_t err = nvs_erase_key(nvs, d->key);
+    return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+  }
+  switch (d->type) {
+  case SETTING_U8:
+    return nvs_set_u8(nvs, d->key, v->data[0]);
+  case SETTING_U32: {
+    uint32_t value;
+    memcpy(&value, v->data, sizeof(value));
+    return nvs_set_u32(nvs, d->key, value);
+  }
+  case SETTING_STR:
+    return nvs_set_str(nvs, d->key, (const char *)v->data);
+  case SETTING_BLOB:
+    return nvs_set_blob(nvs, d->key, v->data, v->len);
+  }
+  return ESP_ERR_INVALID_ARG;
+}
+
+// Writes a snapshot of the dirty settings, one commit per namespace
+static esp_err_t write_pending(void) {
+  setting_value_t snap[SETTING_COUNT];
+  bool todo[SETTING_COUNT];
+  esp_err_t result = ESP_OK;
+
+  xSemaphoreTake(write_lock, portMAX_DELAY);
+  taskENTER_CRITICAL(&values_lock);
+  pending = false;
+  for (int i = 0; i < SETTING_COUNT; i++) {
+    todo[i] = values[i].dirty;
+    if (todo[i]) {
+      snap[i] = values[i];
+      values[i].dirty = false;
+    }
+  }
+  taskEXIT_CRITICAL(&values_lock);
+
+  for (int first = 0; first < SETTING_COUNT; first++) {
+    if (!todo[first]) {
+      continue;
+    }
+    const char *ns = descs[first].ns;
+    nvs_handle_t nvs;
+    esp_err_t open_err = nvs_open(ns, NVS_READWRITE, &nvs);
+    uint32_t written = 0;
+    for (int i = first; i < SETTING_COUNT; i++) {
+      if (!todo[i] || strcmp(descs[i].ns, ns) != 0) {
+        continue;
+      }
+      todo[i] = false;
+      esp_err_t err =
+          open_err == ESP_OK ? write_one(nvs, i, &snap[i]) : open_err;
+      if (err == ESP_OK) {
+        written++;
+        continue;
+      }
+      // Still differs from flash, so it goes out with the next commit
+      ESP_LOGW(MODULE_TAG, "%s/%s not written: %s", ns, descs[i].key,
+               esp_err_to_name(err));
+      result = err;
+      taskENTER_CRITICAL(&values_lock);
+      values[i].dirty = true;
+      stats.failures++;
+      taskEXIT_CRITICAL(&values_lock);
+    }
+    if (open_err != ESP_OK) {
+      continue;
+    }
+    if (written) {
+      esp_err_t err = nvs_commit(nvs);
+      taskENTER_CRITICAL(&values_lock);
+      if (err == ESP_OK) {
+        stats.commits++;
+        stats.keys_written += written;
+      } else {
+        stats.failures++;
+      }
+      taskEXIT_CRITICAL(&values_lock);
+      if (err != ESP_OK) {
+        result = err;
+      }
+    }
+    nvs_close(nvs);
+  }
+  xSemaphoreGive(write_lock);
+  return result;
+}
+
+static void writer_task(void *arg) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Whatever else changes meanwhile joins this commit
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_LAMP_SETTINGS_COMMIT_DELAY_MS));
+    write_pending();
+  }
+}
+
+void settings_init(void) {
+  if (writer) {
+    return;
+  }
+  for (int first = 0; first < SETTING_COUNT; first++) {
+    if (first > 0 && strcmp(descs[first - 1].ns, descs[first].ns) == 0) {
+      continue; // loaded with the namespace's first setting
+    }
+    nvs_handle_t nvs = 0;
+    if (nvs_open(descs[first].ns, NVS_READONLY, &nvs) != ESP_OK) {
+      nvs = 0; // namespace not created yet: every default applies
+    }
+    for (int i = first; i < SETTING_COUNT; i++) {
+      if (strcmp(descs[i].ns, descs[first].ns) == 0) {
+        load(i, nvs);
+      }
+    }
+    if (nvs) {
+      nvs_close(nvs);
+    }
+  }
+  write_lock = xSemaphoreCreateMutexStatic(&write_lock_buf);
+  writer = xTaskCreateStatic(writer_task, "settings",
+                             MEM_PLAN_SETTINGS_TASK_STACK, NULL,
+                             MEM_PLAN_SETTINGS_TASK_PRIO, writer_stack,
+                             &writer_tcb);
+}
+
+// Copies a new value into the cache and wakes the writer if it changed
+static void store(setting_id_t id, const void *data, size_t len,
+                  bool present) {
+  bool wake = false;
+  taskENTER_CRITICAL(&values_lock);
+  setting_value_t *v = &values[id];
+  stats.sets++;
+  if (v->present == present && v->len == len &&
+      memcmp(v->data, data, len) == 0) {
+    stats.unchanged++;
+  } else {
+    if (v->dirty) {
+      stats.coalesced++;
+    }
+    memcpy(v->data, data, len);
+    v->len = len;
+    v->present = present;
+    v->dirty = true;
+    wake = !pending;
+    pending = true;
+  }
+  taskEXIT_CRITICAL(&values_lock);
+  if (wake && writer) {
+    xTaskNotifyGive(writer);
+  }
+}
+
+uint32_t settings_get_u32(setting_id_t id) {
+  uint32_t value = 0;
+  taskENTER_CRITICAL(&values_lock);
+  if (descs[id].type == SETTING_U8) {
+    value = values[id].data[0];
+  } else if (descs[id].type == SETTING_U32) {
+    memcpy(&value, values[id].data, sizeof(value));
+  }
+  taskEXIT_CRITICAL(&values_lock);
+  return value;
+}
+
+void settings_get_str(setting_id_t id, char *buf, size_t size) {
+  if (size == 0) {
+    return;
+  }
+  buf[0] = '\0';
+  if (descs[id].type != SETTING_STR) {
+    return;
+  }
+  taskENTER_CRITICAL(&values_lock);
+  const setting_value_t *v = &values[id];
+  if (v->present && v->len > 0) {
+    size_t n = (size_t)v->len - 1;
+    if (n > size - 1) {
+      n = size - 1;
+    }
+    memcpy(buf, v->data, n);
+    buf[n] = '\0';
+  }
+  taskEXIT_CRITICAL(&values_lock);
+}
+
+bool settings_get_blob(setting_id_t id, void *buf, size_t len) {
+  bool found = false;
+  if (descs[id].type != SETTING_BLOB) {
+    return false;
+  }
+  taskENTER_CRITICAL(&values_lock);
+  if (values[id].present && values[id].len == len) {
+    memcpy(buf, values[id].data, len);
+    found = true;
+  }
+  taskEXIT_CRITICAL(&values_lock);
+  return found;
+}
+
+bool settings_set_u32(setting_id_t id, uint32_t value) {
+  if (descs[id].type == SETTING_U8 && value <= UINT8_MAX) {
+    uint8_t byte = value;
+    store(id, &byte, 1, true);
+    return true;
+  }
+  if (descs[id].type == SETTING_U32) {
+    store(id, &value, sizeof(value), true);
+    return true;
+  }
+  return false;
+}
+
+bool settings_set_str(setting_id_t id, const char *s, size_t len) {
+  if (descs[id].type != SETTING_STR || len + 1 > descs[id].max_len ||
+      memchr(s, '\0', len)) {
+    return false;
+  }
+  char buf[SETTINGS_MAX_LEN];
+  memcpy(buf, s, len);
+  buf[len] = '\0';
+  store(id, buf, len + 1, true);
+  return true;
+}
+
+bool settings_set_blob(setting_id_t id, const void *data, size_t len) {
+  if (descs[id].type != SETTING_BLOB || len > descs[id].max_len) {
+    return false;
+  }
+  store(id, data, len, true);
+  return true;
+}
+
+void settings_reset(setting_id_t id) {
+  const setting_desc_t *d = &descs[id];
+  if (d->type == SETTING_U8 || d->type == SETTING_U32) {
+    settings_set_u32(id, d->def);
+  } else {
+    store(id, "", 0, false);
+  }
+}
+
+esp_err_t settings_flush(void) {
+  if (!writer) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return write_pending();
+}
+
+void settings_get_stats(settings_stats_t *out) {
+  taskENTER_CRITICAL(&values_lock);
+  *out = stats;
+  taskEXIT_CRITICAL(&values_lock);
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Typed runtime settings, cached in RAM and written back to NVS behind the
+// callers. Reads and sets only touch the cache, so they are safe on the
+// command path; a change starts a short delay (Kconfig) after which
+// everything changed meanwhile goes out in one commit. A value set to what
+// it already was, or changed again before its write, costs no flash write.
+
+typedef enum {
+  SETTING_WIFI_SSID,     // string
+  SETTING_WIFI_PASS,     // string
+  SETTING_WIFI_VALID,    // u8: the credentials are worth trying
+  SETTING_WIFI_AP_CACHE, // blob: BSSID and channel we last got an IP from
+  SETTING_LAST_COMMAND,  // string: restored at boot
+  SETTING_COUNT,
+} setting_id_t;
+
+// Largest value, a WiFi password and its NUL
+#define SETTINGS_MAX_LEN 65
+
+// After nvs_flash_init(): loads every setting and starts the writer
+void settings_init(void);
+
+uint32_t settings_get_u32(setting_id_t id);
+// Copies the string into buf, NUL-terminated and truncated to size; ""
+// when unset
+void settings_get_str(setting_id_t id, char *buf, size_t size);
+// False when unset or stored with another length
+bool settings_get_blob(setting_id_t id, void *buf, size_t len);
+
+// False when the setting is of another type or the value does not fit
+bool settings_set_u32(setting_id_t id, uint32_t value);
+bool settings_set_str(setting_id_t id, const char *s, size_t len);
+bool settings_set_blob(setting_id_t id, const void *data, size_t len);
+// Back to the default; strings and blobs are erased from flash
+void settings_reset(setting_id_t id);
+
+// Writes whatever is pending now and waits for it, for changes that must
+// survive an imminent reboot. Blocks on flash; not for the command path.
+esp_err_t settings_flush(void);
+
+typedef struct {
+  uint32_t sets;
+  uint32_t unchanged; // set to the value it had: nothing to write
+  uint32_t coalesced; // changed again before its write: one write saved
+  uint32_t commits;
+  uint32_t keys_written;
+  uint32_t failures; // left pending for the next commit
+} settings_stats_t;
+void settings_get_stats(settings_stats_t *stats);
@@ -0,0 +1,170 @@
+#include "state_publisher.h"
+#include "clips.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "mqtt.h"
+#include "trace.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MODULE_TAG "STATE_PUB"
+
+// Retained and small; aliases are no use for QoS 1
+static const mqtt_topic_t state_topic = {
+    .name = CONFIG_LAMP_STATE_TOPIC,
+    .utf8 = true,
+};
+
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t publish_timer = NULL;
+
+// All fields below are guarded by state_lock
+static led_command_t current_state;
+static led_command_t published_state;
+static bool have_published = false;
+static bool pending = false; // publish_timer armed
+static bool dirty = false;   // current_state not yet on the broker
+static int64_t last_publish_us = 0;
+static state_publisher_stats_t stats;
+
+// Field by field: memcmp would also compare the padding after b, which
+// commands built as compound literals leave unspecified
+static bool same_state(const led_command_t *a, const led_command_t *b) {
+  return a->state == b->state && a->r == b->r && a->g == b->g && a->b == b->b;
+}
+
+static int format_state(const led_command_t *cmd, char *buf, size_t len) {
+  switch (cmd->state) {
+  case STATE_COLOR:
+    return snprintf(buf, len, "COLOR#%02X%02X%02X", cmd->r, cmd->g, cmd->b);
+  case STATE_PULSE_WAVE:
+    return snprintf(buf, len, "PULSE#%02X%02X%02X", cmd->r, cmd->g, cmd->b);
+  case STATE_RAINBOW_CHASE:
+    return snprintf(buf, len, "CHASE");
+  case STATE_CLIP: {
+    char name[CLIPS_NAME_LEN];
+    if (!clips_name(cmd->r, name, sizeof(name))) {
+      return -1;
+    }
+    return snprintf(buf, len, "CLIP#%s", name);
+  }
+  }
+  return -1;
+}
+
+static void publish_timer_cb(void *arg) {
+  led_command_t state;
+  bool changed;
+
+  taskENTER_CRITICAL(&state_lock);
+  pending = false;
+  state = current_state;
+  changed = !have_published || !same_state(&state, &published_state);
+  if (!changed) {
+    dirty = false;
+    stats.suppressed++;
+  }
+  taskEXIT_CRITICAL(&state_lock);
+
+  if (!changed) {
+    return;
+  }
+
+  // Longest is CLIP# and a clip name
+  char payload[8 + CLIPS_NAME_LEN];
+  int len = format_state(&state, payload, sizeof(payload));
+  if (len < 0) {
+    return;
+  }
+  // Enqueue rather than publish: never block the timer task on the network
+  if (mqtt_enqueue_to(&state_topic, payload, len, 1, 1) < 0) {
+    // Not connected; state_publisher_on_connected() will retry
+    return;
+  }
+
+  taskENTER_CRITICAL(&state_lock);
+  published_state = state;
+  have_published = true;
+  last_publish_us = esp_timer_get_time();
+  dirty = !same_state(&current_state, &state);
+  stats.published++;
+  taskEXIT_CRITICAL(&state_lock);
+  trace_event(TRACE_STATE_PUBLISH, state.state,
+              state.r << 16 | state.g << 8 | state.b, 0);
+}
+
+// Must be called with state_lock held; returns true if the caller has to arm
+// the timer
+static bool mark_dirty_locked(void) {
+  dirty = true;
+  if (pending) {
+    stats.suppressed++;
+    return false;
+  }
+  pending = true;
+  return true;
+}
+
+static void arm_publish_timer(void) {
+  int64_t since_us = esp_timer_get_time() - last_publish_us;
+  int64_t delay_us = CONFIG_LAMP_STATE_PUBLISH_DEBOUNCE_MS * 1000LL;
+  int64_t min_interval_us = CONFIG_LAMP_STATE_PUBLISH_MIN_INTERVAL_MS * 1000LL;
+
+  if (since_us + delay_us < min_interval_us) {
+    delay_us = min_interval_us - since_us;
+  }
+  esp_timer_start_once(publish_timer, delay_us);
+}
+
+void state_publisher_init(void) {
+  if (publish_timer) {
+    return;
+  }
+  const esp_timer_create_args_t timer_args = {
+      .callback = publish_timer_cb,
+      .name = "state_pub",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &publish_timer));
+  // The strip boots dark; report that on the first connect
+  current_state = (led_command_t){STATE_COLOR, 0, 0, 0};
+  dirty = true;
+}
+
+void state_publisher_notify(const led_command_t *cmd) {
+  if (!publish_timer) {
+    return;
+  }
+  bool arm;
+  taskENTER_CRITICAL(&state_lock);
+  current_state = *cmd;
+  arm = mark_dirty_locked();
+  taskEXIT_CRITICAL(&state_lock);
+
+  if (arm) {
+    arm_publish_timer();
+  }
+}
+
+void state_publisher_on_connected(void) {
+  if (!publish_timer) {
+    return;
+  }
+  bool arm = false;
+  taskENTER_CRITICAL(&state_lock);
+  if (dirty && !pending) {
+    pending = true;
+    arm = true;
+  }
+  taskEXIT_CRITICAL(&state_lock);
+
+  if (arm) {
+    arm_publish_timer();
+  }
+}
+
+void state_publisher_get_stats(state_publisher_stats_t *out) {
+  taskENTER_CRITICAL(&state_lock);
+  *out = stats;
+  taskEXIT_CRITICAL(&state_lock);
+}
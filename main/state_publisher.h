@@ -0,0 +1,15 @@
+#pragma once
+#include "led.h"
+#include <stdint.h>
+
+typedef struct {
+  uint32_t published;  // messages handed to the MQTT client
+  uint32_t suppressed; // changes coalesced away or identical to last publish
+} state_publisher_stats_t;
+
+void state_publisher_init(void);
+// Record a new effective state; publishing is deferred and coalesced
+void state_publisher_notify(const led_command_t *cmd);
+// Re-sends the current state if it changed while the broker was unreachable
+void state_publisher_on_connected(void);
+void state_publisher_get_stats(state_publisher_stats_t *stats);
@@ -0,0 +1,103 @@
+#include "trace.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "mqtt.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_TAG "TRACE"
+#define TRACE_EVENTS CONFIG_LAMP_TRACE_RING_EVENTS
+#define TRACE_TOPIC "esp001/trace"
+#define TRACE_DUMP_VERSION 1
+#define TRACE_LINE_BYTES 32
+
+_Static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0,
+               "LAMP_TRACE_RING_EVENTS must be a power of two");
+
+// Dump layout, little-endian (same as the in-memory structs on the ESP32):
+//   "LTRC", u8 version, u8 cores, u16 events per core, u32 time_us now,
+//   then per core: u32 head, events_per_core * trace_event_t
+typedef struct {
+  char magic[4];
+  uint8_t version;
+  uint8_t cores;
+  uint16_t events_per_core;
+  uint32_t time_us;
+} trace_dump_header_t;
+
+// Each core writes only its own ring. Tasks on the same core can still
+// preempt each other mid-event, so slots are claimed with an atomic
+// increment; an event being written during a dump may come out torn.
+typedef struct {
+  uint32_t head; // total events ever written; slot = head % TRACE_EVENTS
+  trace_event_t events[TRACE_EVENTS];
+} trace_ring_t;
+
+// Header and rings are laid out back to back so a dump can be published
+// straight from here without a heap copy
+static struct {
+  trace_dump_header_t header;
+  trace_ring_t rings[portNUM_PROCESSORS];
+} trace;
+
+void trace_event(trace_id_t id, uint16_t a0, uint32_t a1, uint32_t a2) {
+#if portNUM_PROCESSORS > 1
+  trace_ring_t *ring = &trace.rings[xPortGetCoreID()];
+#else
+  trace_ring_t *ring = &trace.rings[0];
+#endif
+  uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  trace_event_t *e = &ring->events[slot & (TRACE_EVENTS - 1)];
+
+  e->time_us = (uint32_t)esp_timer_get_time();
+  e->id = id;
+  e->a0 = a0;
+  e->a1 = a1;
+  e->a2 = a2;
+}
+
+static const mqtt_topic_t trace_topic = {
+    .name = TRACE_TOPIC,
+    .content_type = "application/octet-stream",
+    .in_place = true, // the rings themselves, far too big to queue a copy
+};
+
+static void stamp_header(void) {
+  trace.header = (trace_dump_header_t){
+      .magic = {'L', 'T', 'R', 'C'},
+      .version = TRACE_DUMP_VERSION,
+      .cores = portNUM_PROCESSORS,
+      .events_per_core = TRACE_EVENTS,
+      .time_us = (uint32_t)esp_timer_get_time(),
+  };
+}
+
+bool trace_publish(void) {
+  stamp_header();
+  if (mqtt_enqueue_to(&trace_topic, (const char *)&trace, sizeof(trace), 0,
+                      0) < 0) {
+    ESP_LOGW(MODULE_TAG, "Not published; TRACE SERIAL prints the trace");
+    return false;
+  }
+  ESP_LOGI(MODULE_TAG, "Published %zu bytes to " TRACE_TOPIC, sizeof(trace));
+  return true;
+}
+
+void trace_print(void) {
+  const uint8_t *buf = (const uint8_t *)&trace;
+  size_t len = sizeof(trace);
+  stamp_header();
+
+  // Hex lines survive the monitor and interleaved log output
+  for (size_t i = 0; i < len; i += TRACE_LINE_BYTES) {
+    char line[TRACE_LINE_BYTES * 2 + 1];
+    size_t n = len - i < TRACE_LINE_BYTES ? len - i : TRACE_LINE_BYTES;
+    for (size_t j = 0; j < n; j++) {
+      sprintf(line + j * 2, "%02x", buf[i + j]);
+    }
+    printf("TRACE:%s\n", line);
+  }
+  printf("TRACE:END\n");
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fixed-size binary events for the hot paths (per packet, per command, per
+// frame) instead of formatted log lines. Events go into a per-core ring
+// without locks or formatting; TRACE publishes the rings and TRACE SERIAL
+// prints them, bin/trace_decode.mjs
+// turns them back into text. Keep the IDs and their argument meaning in sync
+// with the decoder.
+typedef enum {
+  TRACE_MQTT_RX = 1,       // a0 topic len, a1 data len, a2 msg id
+  TRACE_COMMAND,           // a0 led_state_t, a1 0xRRGGBB
+  TRACE_COMMAND_REJECTED,  // a0 len
+  TRACE_LED_STATE,         // a0 led_state_t, a1 0xRRGGBB
+  TRACE_STATE_PUBLISH,     // a0 led_state_t, a1 0xRRGGBB
+  TRACE_BUTTON,            // a0 button_event_t
+  TRACE_DNS_QUERY,         // a0 query len, a1 reply len (0 none, -1 dropped)
+  TRACE_HTTP_REQUEST,      // a0 portal_method_t, a1 route index (-1 fallback)
+  TRACE_COMMAND_SCHEDULED, // a0 command len, a1 low 32 bits of due epoch ms
+} trace_id_t;
+
+typedef struct {
+  uint32_t time_us; // low 32 bits of esp_timer_get_time()
+  uint16_t id;
+  uint16_t a0;
+  uint32_t a1;
+  uint32_t a2;
+} trace_event_t;
+
+#ifdef CONFIG_LAMP_TRACE_ENABLE
+void trace_event(trace_id_t id, uint16_t a0, uint32_t a1, uint32_t a2);
+// Publishes the rings in one binary message to the trace topic; queued for
+// the publish task, so the caller doesn't wait. False if not connected.
+bool trace_publish(void);
+// Writes the rings to the console as TRACE: hex lines, ~16 KB of text with
+// the default ring size: the caller is held up for as long as the UART
+// takes (over a second at 115200 baud)
+void trace_print(void);
+#else
+static inline void trace_event(trace_id_t id, uint16_t a0, uint32_t a1,
+                               uint32_t a2) {}
+static inline bool trace_publish(void) { return false; }
+static inline void trace_print(void) {}
+#endif
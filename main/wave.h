@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+// 8-bit fixed-point building blocks for effects: waveforms, easing, a PRNG
+// and value noise. Angles and phases are 0-255 for one full turn, outputs are
+// 0-255; nothing here touches floats, divides per sample or keeps state
+// beyond what the caller passes in.
+
+extern const uint8_t wave_sin8_table[256];
+
+// x * a / 255, rounded, without a division
+static inline uint8_t scale8(uint8_t x, uint8_t a) {
+  uint16_t p = x * a + 128;
+  return (p + (p >> 8)) >> 8;
+}
+
+// a at t=0 to b at t=255
+static inline uint8_t lerp8(uint8_t a, uint8_t b, uint8_t t) {
+  return a + scale8(b, t) - scale8(a, t);
+}
+
+// 128 at 0, peak 255 at 64, trough 1 at 192
+static inline uint8_t sin8(uint8_t theta) { return wave_sin8_table[theta]; }
+static inline uint8_t cos8(uint8_t theta) {
+  return wave_sin8_table[(uint8_t)(theta + 64)];
+}
+
+// 0 at 0, 255 at 128, back down to 1 at 255
+static inline uint8_t tri8(uint8_t x) {
+  return x < 128 ? x * 2 : (255 - x) * 2 + 1;
+}
+
+// Smoothstep: slow at both ends, 0 -> 0, 128 -> 128, 255 -> 255
+static inline uint8_t ease8(uint8_t x) {
+  uint32_t x2 = x * x;
+  return (x2 * (768 - 2 * x)) >> 16;
+}
+
+// Phase at time ms of a period of 2^period_log2 ms (8 to 31), for driving
+// the waveforms above. A power-of-two period makes it a shift, and the
+// phase carries on smoothly across the 32-bit wrap of the lamp clock.
+static inline uint8_t beat8(uint32_t ms, uint8_t period_log2) {
+  return ms >> (period_log2 - 8);
+}
+
+// xorshift32; *state must start non-zero
+static inline uint32_t rand32(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+static inline uint8_t rand8(uint32_t *state) { return rand32(state) >> 24; }
+
+// Value noise over 8.8 fixed-point coordinates: the high byte picks the
+// lattice cell, the low byte the position inside it. Lattice values come
+// from a hash of the cell and seed, so the field is stateless and repeatable.
+uint8_t noise8_1d(uint16_t x, uint32_t seed);
+uint8_t noise8_2d(uint16_t x, uint16_t y, uint32_t seed);
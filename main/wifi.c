@@ -1,33 +1,51 @@
 #include "dns_server.h"
+#include "portal_assets.h"
+#include "portal_server.h"
+#include "wifi_scan_cache.h"
 #include "driver/gpio.h"
 #include "esp_event.h" // for wifi event
 #include "esp_http_server.h"
 #include "esp_log.h"           //for showing logs
+#include "esp_random.h"
 #include "esp_system.h"        //esp_init funtions esp_err_t
+#include "esp_timer.h"
 #include "esp_wifi.h"          //esp_wifi_init functions and wifi operations
 #include "freertos/FreeRTOS.h" //for delay,mutexs,semphrs rtos operations
 #include "freertos/task.h"
 
+#include "backoff.h"
+#include "settings.h"
+#include "wifi.h"
+
 #include "lwip/err.h"  //light weight ip packets error handling
 #include "lwip/sys.h"  //system applications for light weight ip apps
-#include "nvs_flash.h" //non volatile storage
+#include <inttypes.h>
 #include <stdio.h>     //for basic printf commands
 #include <string.h>    //for handling strings
 
-#define WIFI_RETRY_NUM 10
-#define WIFI_NS "wifi"
 #define MODULE_TAG "WIFI"
-static int retry_num = 0;
 
-typedef enum {
-  WIFI_DISCONNECTED = 0,
-  WIFI_CONNECTING,
-  WIFI_CONNECTED,
-  WIFI_GOT_IP,
-} wifi_state_t;
+// BSSID and channel of the last AP we got an IP from. Used to skip the
+// all-channel scan on the next boot; the DHCP lease itself is restored by
+// lwIP (CONFIG_LWIP_DHCP_RESTORE_LAST_IP).
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t channel;
+} wifi_ap_cache_t;
+
+static wifi_ap_cache_t ap_cache;
+static bool ap_cache_in_use = false;
+static int64_t connect_start_us = 0;
+static wifi_connect_stats_t connect_stats;
+
 static void (*on_wifi_connected_handler)(void) = NULL;
 static wifi_state_t wifi_connection_state = WIFI_DISCONNECTED;
 
+// Reconnects are scheduled from an esp_timer so the default event loop
+// (shared with MQTT) is never blocked waiting for the next attempt
+static esp_timer_handle_t reconnect_timer = NULL;
+static backoff_t reconnect_backoff;
+
 static const char *get_disconnect_reason_string(wifi_err_reason_t reason) {
   switch (reason) {
   case WIFI_REASON_UNSPECIFIED:
@@ -90,6 +108,85 @@ static const char *get_disconnect_reason_string(wifi_err_reason_t reason) {
     return "UNKNOWN";
   }
 }
+static bool load_ap_cache(wifi_ap_cache_t *cache) {
+  return settings_get_blob(SETTING_WIFI_AP_CACHE, cache, sizeof(*cache)) &&
+         cache->channel >= 1 && cache->channel <= 14;
+}
+
+// Only touches flash when the AP we ended up on differs from the cached one,
+// and then behind the caller (settings.h)
+static void save_ap_cache(void) {
+  wifi_ap_record_t ap_info;
+  if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+    return;
+
+  wifi_ap_cache_t cache = {.channel = ap_info.primary};
+  memcpy(cache.bssid, ap_info.bssid, sizeof(cache.bssid));
+  if (memcmp(&cache, &ap_cache, sizeof(cache)) == 0)
+    return;
+
+  if (settings_set_blob(SETTING_WIFI_AP_CACHE, &cache, sizeof(cache))) {
+    ap_cache = cache;
+    ESP_LOGI(MODULE_TAG, "Cached AP " MACSTR " on channel %d",
+             MAC2STR(cache.bssid), cache.channel);
+  }
+}
+
+// The cached AP was not reachable (moved channel, replaced, out of range):
+// drop the BSSID/channel lock and let the next connect scan everything
+static void wifi_fall_back_to_full_scan(void) {
+  wifi_config_t wifi_config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+    return;
+
+  ESP_LOGW(MODULE_TAG, "Cached AP unreachable, falling back to full scan");
+  wifi_config.sta.bssid_set = false;
+  wifi_config.sta.channel = 0;
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+  ap_cache_in_use = false;
+  connect_stats.cached_fallbacks++;
+}
+
+static void record_connect_time(void) {
+  uint32_t elapsed_ms = (esp_timer_get_time() - connect_start_us) / 1000;
+
+  connect_stats.last_connect_ms = elapsed_ms;
+  connect_stats.last_connect_cached = ap_cache_in_use;
+  if (ap_cache_in_use) {
+    connect_stats.cached_connects++;
+    connect_stats.last_cached_connect_ms = elapsed_ms;
+  } else {
+    connect_stats.full_scan_connects++;
+    connect_stats.last_full_scan_connect_ms = elapsed_ms;
+  }
+  ESP_LOGI(MODULE_TAG, "Connected in %" PRIu32 " ms via %s", elapsed_ms,
+           ap_cache_in_use ? "cached AP" : "full scan");
+}
+
+void wifi_get_connect_stats(wifi_connect_stats_t *stats) {
+  *stats = connect_stats;
+}
+
+wifi_state_t wifi_get_state(void) { return wifi_connection_state; }
+
+static void reconnect_timer_cb(void *arg) {
+  connect_stats.reconnect_attempts++;
+  esp_err_t err = esp_wifi_connect();
+  if (err != ESP_OK) {
+    ESP_LOGW(MODULE_TAG, "esp_wifi_connect failed: %s", esp_err_to_name(err));
+  }
+}
+
+static void schedule_reconnect(void) {
+  if (esp_timer_is_active(reconnect_timer)) {
+    return;
+  }
+  uint32_t delay_ms = backoff_next_ms(&reconnect_backoff);
+  connect_stats.next_reconnect_ms = delay_ms;
+  ESP_LOGI(MODULE_TAG, "Reconnecting in %" PRIu32 " ms", delay_ms);
+  esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+}
+
 static void wifi_event_handler(void *event_handler_arg,
                                esp_event_base_t event_base, int32_t event_id,
                                void *event_data) {
@@ -98,68 +195,105 @@ static void wifi_event_handler(void *event_handler_arg,
     wifi_connection_state = WIFI_CONNECTING;
   } else if (event_id == WIFI_EVENT_STA_CONNECTED) {
     wifi_connection_state = WIFI_CONNECTED;
-    retry_num = 0;
+    backoff_reset(&reconnect_backoff);
 
     ESP_LOGI(MODULE_TAG, "WiFi CONNECTED\n");
   } else if (event_id == WIFI_EVENT_STA_DISCONNECTED) {
     wifi_connection_state = WIFI_DISCONNECTED;
+    connect_stats.disconnects++;
     wifi_event_sta_disconnected_t *disconnected =
         (wifi_event_sta_disconnected_t *)event_data;
     ESP_LOGW(MODULE_TAG, "WiFi lost connection. Reason: %d (0x%x) - %s",
              disconnected->reason, disconnected->reason,
              get_disconnect_reason_string(disconnected->reason));
-    if (retry_num < WIFI_RETRY_NUM) {
-      vTaskDelay(pdMS_TO_TICKS(1000)); // Wait 1 second before retry
-      esp_wifi_connect();
-      retry_num++;
-      ESP_LOGI(MODULE_TAG, "Retrying to Connect... (attempt %d/%d)\n",
-               retry_num, WIFI_RETRY_NUM);
-    } else {
-      ESP_LOGE(MODULE_TAG, "WiFi connection failed after %d attempts",
-               WIFI_RETRY_NUM);
+    if (ap_cache_in_use) {
+      wifi_fall_back_to_full_scan();
     }
+    connect_stats.last_disconnect_reason = disconnected->reason;
+    schedule_reconnect();
   } else if (event_id == IP_EVENT_STA_GOT_IP) {
     wifi_connection_state = WIFI_GOT_IP;
     ESP_LOGI(MODULE_TAG, "Wifi got IP...\n\n");
+    if (connect_start_us) {
+      record_connect_time();
+      connect_start_us = 0;
+    }
+    save_ap_cache();
     if (on_wifi_connected_handler) {
       ESP_LOGI(MODULE_TAG, "Calling on_wifi_connected_callback");
       on_wifi_connected_handler();
     }
   }
 }
-void wifi_connection(const char *ssid, const char *pass,
-                     void (*on_wifi_connected_callback)(void)) {
+// Common STA settings for both the provisioning trial and normal operation
+static void fill_sta_config(wifi_config_t *wifi_config, const char *ssid,
+                            const char *pass) {
+  memset(wifi_config, 0, sizeof(*wifi_config));
+  strncpy((char *)wifi_config->sta.ssid, ssid,
+          sizeof(wifi_config->sta.ssid) - 1);
+  strncpy((char *)wifi_config->sta.password, pass,
+          sizeof(wifi_config->sta.password) - 1);
+  wifi_config->sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+  // Disable PMF initially - some routers don't support it properly
+  wifi_config->sta.pmf_cfg.capable = false;
+  wifi_config->sta.pmf_cfg.required = false;
+  // Configure scan to help find the AP
+  wifi_config->sta.scan_method = WIFI_FAST_SCAN;
+  wifi_config->sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+  wifi_config->sta.threshold.rssi = -127; // Accept any signal strength
+}
+
+// Created once; provisioning brings it up early for the trial connect
+static esp_netif_t *sta_netif = NULL;
+
+// Puts the STA side under the normal event handlers and reconnect policy
+static void wifi_take_over_sta(void (*on_wifi_connected_callback)(void)) {
   on_wifi_connected_handler = on_wifi_connected_callback;
-  retry_num = 0; // Reset retry counter
+  backoff_init(&reconnect_backoff, WIFI_RECONNECT_BASE_MS,
+               WIFI_RECONNECT_MAX_MS, esp_random());
+  if (reconnect_timer == NULL) {
+    const esp_timer_create_args_t timer_args = {
+        .callback = reconnect_timer_cb,
+        .name = "wifi_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
+  }
 
-  esp_netif_create_default_wifi_sta(); // sets up necessary data structs for
-                                       // wifi station interface
+  if (sta_netif == NULL) {
+    // sets up necessary data structs for wifi station interface
+    sta_netif = esp_netif_create_default_wifi_sta();
+  }
 
   esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler,
                              NULL); // creating event handler register for wifi
   esp_event_handler_register(
       IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler,
       NULL); // creating event handler register for ip event
-  wifi_config_t wifi_config = {0}; // Zero-initialize the structure
-  strncpy((char *)wifi_config.sta.ssid, ssid, sizeof(wifi_config.sta.ssid) - 1);
-  wifi_config.sta.ssid[sizeof(wifi_config.sta.ssid) - 1] = '\0';
-  strncpy((char *)wifi_config.sta.password, pass,
-          sizeof(wifi_config.sta.password) - 1);
-  wifi_config.sta.password[sizeof(wifi_config.sta.password) - 1] = '\0';
-  wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-  // Disable PMF initially - some routers don't support it properly
-  wifi_config.sta.pmf_cfg.capable = false;
-  wifi_config.sta.pmf_cfg.required = false;
-  // Configure scan to help find the AP
-  wifi_config.sta.scan_method = WIFI_FAST_SCAN;
-  wifi_config.sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
-  wifi_config.sta.threshold.rssi = -127; // Accept any signal strength
+}
+
+void wifi_connection(const char *ssid, const char *pass,
+                     void (*on_wifi_connected_callback)(void)) {
+  wifi_take_over_sta(on_wifi_connected_callback);
+  wifi_config_t wifi_config;
+  fill_sta_config(&wifi_config, ssid, pass);
+  // Try the AP we used last time first: a single-channel probe instead of
+  // sweeping all channels
+  ap_cache_in_use = load_ap_cache(&ap_cache);
+  if (ap_cache_in_use) {
+    ESP_LOGI(MODULE_TAG, "Using cached AP " MACSTR " on channel %d",
+             MAC2STR(ap_cache.bssid), ap_cache.channel);
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, ap_cache.bssid, sizeof(ap_cache.bssid));
+    wifi_config.sta.channel = ap_cache.channel;
+    connect_stats.cached_attempts++;
+  }
   esp_wifi_set_mode(
       WIFI_MODE_STA); // station mode selected - must be set before set_config
   esp_wifi_set_config(
       ESP_IF_WIFI_STA,
       &wifi_config); // setting up configs when event ESP_IF_WIFI_STA
-  esp_wifi_start();
+  connect_start_us = esp_timer_get_time();
+  esp_wifi_start(); // no-op when handed over from provisioning
   // start connection with configurations provided in funtion
   esp_wifi_connect(); // connect with saved ssid and pass
   ESP_LOGI(MODULE_TAG, "wifi_init_sta finished. \nSSID:%s\npassword:%s\n", ssid,
@@ -167,17 +301,15 @@ void wifi_connection(const char *ssid, const char *pass,
 }
 
 void save_wifi_credentials(const char *ssid, const char *pass) {
-  nvs_handle_t nvs;
-  nvs_open(WIFI_NS, NVS_READWRITE, &nvs);
-
-  nvs_set_str(nvs, "ssid", ssid);
-  nvs_set_str(nvs, "pass", pass);
-
-  uint8_t valid = 1;
-  nvs_set_u8(nvs, "valid", valid);
-
-  nvs_commit(nvs);
-  nvs_close(nvs);
+  settings_set_str(SETTING_WIFI_SSID, ssid, strlen(ssid));
+  settings_set_str(SETTING_WIFI_PASS, pass, strlen(pass));
+  settings_set_u32(SETTING_WIFI_VALID, 1);
+  // New network, the cached AP no longer applies
+  settings_reset(SETTING_WIFI_AP_CACHE);
+
+  // Provisioning hands over to station mode next; a restart before the
+  // deferred write must not lose the network
+  settings_flush();
 }
 
 static void start_softap(void) {
@@ -192,15 +324,21 @@ static void start_softap(void) {
     ap_config.ap.authmode = WIFI_AUTH_OPEN;
   }
 
-  esp_wifi_set_mode(WIFI_MODE_AP);
+  // STA side is used for the background network scan and to try the
+  // posted credentials before committing to them
+  esp_wifi_set_mode(WIFI_MODE_APSTA);
   esp_wifi_set_config(WIFI_IF_AP, &ap_config);
   esp_wifi_start();
 }
-esp_err_t captive_portal_redirect(httpd_req_t *req) {
-  httpd_resp_set_status(req, "302 Found");
-  httpd_resp_set_hdr(req, "Location", "http://192.168.4.1/");
-  httpd_resp_send(req, NULL, 0);
-  return ESP_OK;
+// Embedded assets, and everything else (OS connectivity probes etc.) is sent
+// to the portal page
+static void captive_portal_redirect(portal_conn_t *conn,
+                                    const portal_request_t *req) {
+  if (portal_assets_serve(conn, req)) {
+    return;
+  }
+  portal_send(conn, "302 Found", NULL, "Location: http://192.168.4.1/\r\n",
+              NULL, 0);
 }
 static void url_decode(char *dst, const char *src) {
   char a, b;
@@ -230,19 +368,136 @@ static void url_decode(char *dst, const char *src) {
   *dst = '\0';
 }
 
-static esp_err_t wifi_post_handler(httpd_req_t *req) {
-  char buf[128];
-  int remaining = req->content_len;
-  int offset = 0;
-
-  while (remaining > 0) {
-    int ret = httpd_req_recv(req, buf + offset, remaining);
-    if (ret <= 0)
-      break;
-    offset += ret;
-    remaining -= ret;
+// Credentials posted to the portal are tried live on the STA side while the
+// AP keeps serving, so the page can report the outcome. On success they are
+// saved and, after a short grace period for the page to read /status, the
+// AP and portal are torn down and normal STA operation takes over without a
+// reboot.
+#define PROV_TRIAL_TIMEOUT_MS 15000
+#define PROV_HANDOFF_DELAY_MS 3000
+
+typedef enum {
+  PROV_IDLE,
+  PROV_CONNECTING,
+  PROV_CONNECTED,
+  PROV_FAILED,
+} prov_state_t;
+
+static volatile prov_state_t prov_state = PROV_IDLE;
+static const char *prov_fail_reason = "";
+static char prov_ip[16];
+static char prov_ssid[33];
+static char prov_pass[65];
+static void (*prov_on_connected)(void) = NULL;
+static esp_netif_t *ap_netif = NULL;
+// Trial timeout while connecting, handoff delay once connected
+static esp_timer_handle_t prov_timer = NULL;
+static esp_event_handler_instance_t prov_wifi_handler;
+static esp_event_handler_instance_t prov_ip_handler;
+
+static const char *prov_state_name(prov_state_t state) {
+  switch (state) {
+  case PROV_CONNECTING:
+    return "connecting";
+  case PROV_CONNECTED:
+    return "connected";
+  case PROV_FAILED:
+    return "failed";
+  default:
+    return "idle";
+  }
+}
+
+static void prov_fail(const char *reason) {
+  ESP_LOGW(MODULE_TAG, "Provisioning trial failed: %s", reason);
+  prov_fail_reason = reason;
+  prov_state = PROV_FAILED;
+  // The scan cache was paused so it would not disturb the connect attempt
+  wifi_scan_cache_start();
+}
+
+static void provisioning_handoff_task(void *arg) {
+  // Runs on its own task: portal_server_stop() waits for the portal task
+  portal_server_stop();
+  wifi_scan_cache_stop();
+  esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                        prov_wifi_handler);
+  esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                        prov_ip_handler);
+  esp_timer_delete(prov_timer);
+  prov_timer = NULL;
+
+  // Keep the association the trial made: the normal handlers take it over
+  // before the AP goes away, so a drop from here on is theirs to retry
+  wifi_ap_record_t ap_info;
+  bool associated = esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+  if (associated) {
+    wifi_take_over_sta(prov_on_connected);
+    // The trial config scans all channels, so retries do too
+    ap_cache_in_use = false;
+    wifi_connection_state = WIFI_GOT_IP;
+  }
+  esp_wifi_set_mode(WIFI_MODE_STA);
+  esp_netif_destroy_default_wifi(ap_netif);
+  ap_netif = NULL;
+
+  ESP_LOGI(MODULE_TAG, "Provisioning done, switching to station mode");
+  if (!associated) {
+    // Lost during the grace period: connect afresh, the cached AP first
+    wifi_connection(prov_ssid, prov_pass, prov_on_connected);
+  } else if (prov_on_connected) {
+    prov_on_connected();
   }
-  buf[offset] = 0;
+  vTaskDelete(NULL);
+}
+
+static void prov_timer_cb(void *arg) {
+  if (prov_state == PROV_CONNECTING) {
+    // Leave CONNECTING first so the resulting disconnect event is ignored
+    prov_state = PROV_FAILED;
+    esp_wifi_disconnect();
+    prov_fail("TIMEOUT");
+  } else if (prov_state == PROV_CONNECTED) {
+    xTaskCreate(provisioning_handoff_task, "prov_handoff", 4096, NULL, 5,
+                NULL);
+  }
+}
+
+static void prov_event_handler(void *arg, esp_event_base_t event_base,
+                               int32_t event_id, void *event_data) {
+  if (prov_state != PROV_CONNECTING) {
+    return;
+  }
+  if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    wifi_event_sta_disconnected_t *disconnected =
+        (wifi_event_sta_disconnected_t *)event_data;
+    esp_timer_stop(prov_timer);
+    prov_fail(get_disconnect_reason_string(disconnected->reason));
+  } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+    ip_event_got_ip_t *got_ip = (ip_event_got_ip_t *)event_data;
+    esp_timer_stop(prov_timer);
+    snprintf(prov_ip, sizeof(prov_ip), IPSTR, IP2STR(&got_ip->ip_info.ip));
+    save_wifi_credentials(prov_ssid, prov_pass);
+    save_ap_cache();
+    prov_state = PROV_CONNECTED;
+    ESP_LOGI(MODULE_TAG, "Provisioning trial connected, IP %s", prov_ip);
+    esp_timer_start_once(prov_timer, (uint64_t)PROV_HANDOFF_DELAY_MS * 1000);
+  }
+}
+
+static void wifi_post_handler(portal_conn_t *conn,
+                              const portal_request_t *req) {
+  if (prov_state == PROV_CONNECTING || prov_state == PROV_CONNECTED) {
+    const char *msg = "Busy";
+    portal_send(conn, "409 Conflict", "text/plain", NULL, msg, strlen(msg));
+    return;
+  }
+
+  char buf[128];
+  size_t len = req->body_len < sizeof(buf) - 1 ? req->body_len
+                                               : sizeof(buf) - 1;
+  memcpy(buf, req->body, len);
+  buf[len] = 0;
 
   char ssid[33] = {0};
   char pass[65] = {0};
@@ -250,87 +505,101 @@ static esp_err_t wifi_post_handler(httpd_req_t *req) {
   httpd_query_key_value(buf, "ssid", ssid, sizeof(ssid));
   httpd_query_key_value(buf, "pass", pass, sizeof(pass));
 
-  char ssid_dec[33];
-  char pass_dec[65];
-
-  url_decode(ssid_dec, ssid);
-  url_decode(pass_dec, pass);
+  url_decode(prov_ssid, ssid);
+  url_decode(prov_pass, pass);
+
+  // An in-flight scan would hold off the connect attempt
+  wifi_scan_cache_stop();
+  wifi_config_t wifi_config;
+  fill_sta_config(&wifi_config, prov_ssid, prov_pass);
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+
+  prov_fail_reason = "";
+  prov_ip[0] = '\0';
+  prov_state = PROV_CONNECTING;
+  esp_timer_start_once(prov_timer, (uint64_t)PROV_TRIAL_TIMEOUT_MS * 1000);
+  esp_err_t err = esp_wifi_connect();
+  if (err != ESP_OK) {
+    esp_timer_stop(prov_timer);
+    prov_fail(esp_err_to_name(err));
+  }
 
-  save_wifi_credentials(ssid_dec, pass_dec);
-  httpd_resp_sendstr(req, "Saved. Rebooting...");
-  esp_restart();
-  return ESP_OK;
+  ESP_LOGI(MODULE_TAG, "Trying provisioned network %s", prov_ssid);
+  const char *msg = "Connecting...";
+  portal_send(conn, "202 Accepted", "text/plain", NULL, msg, strlen(msg));
 }
-static esp_err_t root_get_handler(httpd_req_t *req) {
-  const char *html =
-      "<!DOCTYPE html><html><body>"
-      "<h2>Wi-Fi Setup</h2>"
-      "<form method=\"POST\" action=\"/wifi\">"
-      "SSID:<br><input name=\"ssid\"><br>"
-      "Password:<br><input name=\"pass\" type=\"password\"><br><br>"
-      "<button type=\"submit\">Save</button>"
-      "</form></body></html>";
-
-  httpd_resp_set_type(req, "text/html");
-  httpd_resp_sendstr(req, html);
-  return ESP_OK;
+static void status_get_handler(portal_conn_t *conn,
+                               const portal_request_t *req) {
+  char json[160];
+  int len = snprintf(json, sizeof(json),
+                     "{\"state\":\"%s\",\"reason\":\"%s\",\"ip\":\"%s\"}",
+                     prov_state_name(prov_state), prov_fail_reason, prov_ip);
+  portal_send(conn, "200 OK", "application/json", "Cache-Control: no-store\r\n",
+              json, len);
 }
-
-static httpd_handle_t start_http_server(void) {
-  httpd_handle_t server = NULL;
-  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-
-  httpd_start(&server, &config);
-  httpd_uri_t redirect_uri = {.uri = "/*",
-                              .method = HTTP_GET,
-                              .handler = captive_portal_redirect,
-                              .user_ctx = NULL};
-
-  httpd_register_uri_handler(server, &redirect_uri);
-  httpd_uri_t wifi_post = {
-      .uri = "/wifi", .method = HTTP_POST, .handler = wifi_post_handler};
-  httpd_uri_t root = {
-      .uri = "/", .method = HTTP_GET, .handler = root_get_handler};
-  httpd_register_uri_handler(server, &root);
-
-  httpd_register_uri_handler(server, &wifi_post);
-  return server;
+static void networks_get_handler(portal_conn_t *conn,
+                                 const portal_request_t *req) {
+  // Portal handlers all run on the one portal task. Sized to be copied by
+  // portal_send(): the next request reuses this before a slow phone has
+  // read the last answer.
+  static char json[PORTAL_MAX_COPIED_BODY];
+  size_t len = wifi_scan_cache_to_json(json, sizeof(json));
+  portal_send(conn, "200 OK", "application/json",
+              "Cache-Control: no-store\r\n", json, len);
 }
-void start_wifi_provisioning(void) {
-  esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap(); // IMPORTANT
-  start_softap();
 
-  start_http_server();
-  // Start DNS hijack LAST
+static const portal_route_t portal_routes[] = {
+    {PORTAL_POST, "/wifi", wifi_post_handler},
+    {PORTAL_GET, "/status", status_get_handler},
+    {PORTAL_GET, "/networks.json", networks_get_handler},
+};
+
+void start_wifi_provisioning(void (*on_wifi_connected_callback)(void)) {
+  prov_on_connected = on_wifi_connected_callback;
+  ap_netif = esp_netif_create_default_wifi_ap(); // IMPORTANT
+  // The trial connect needs DHCP on the STA side
+  if (sta_netif == NULL) {
+    sta_netif = esp_netif_create_default_wifi_sta();
+  }
+  const esp_timer_create_args_t timer_args = {
+      .callback = prov_timer_cb,
+      .name = "wifi_prov",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &prov_timer));
+  esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
+                                      prov_event_handler, NULL,
+                                      &prov_wifi_handler);
+  esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                      prov_event_handler, NULL,
+                                      &prov_ip_handler);
+  start_softap();
+  wifi_scan_cache_start();
 
-  dns_server_config_t dns_cfg = {
+  // Captive DNS and the portal share one task; the config must outlive it
+  static dns_server_config_t dns_cfg;
+  dns_cfg = (dns_server_config_t){
       .num_of_entries = 1,
       .item = {{
           .name = "*",
           .if_key = esp_netif_get_ifkey(ap_netif),
       }},
   };
+  portal_server_config_t portal_cfg = {
+      .routes = portal_routes,
+      .num_routes = sizeof(portal_routes) / sizeof(portal_routes[0]),
+      .fallback = captive_portal_redirect,
+      .dns = &dns_cfg,
+  };
 
-  start_dns_server(&dns_cfg);
+  portal_server_start(&portal_cfg);
 }
 bool load_wifi_credentials(char *ssid, size_t ssid_len, char *pass,
                            size_t pass_len) {
-  nvs_handle_t nvs;
-  uint8_t valid = 0;
-
-  if (nvs_open(WIFI_NS, NVS_READONLY, &nvs) != ESP_OK)
-    return false;
-
-  nvs_get_u8(nvs, "valid", &valid);
-  if (!valid) {
-    nvs_close(nvs);
+  if (!settings_get_u32(SETTING_WIFI_VALID)) {
     return false;
   }
-
-  nvs_get_str(nvs, "ssid", ssid, &ssid_len);
-  nvs_get_str(nvs, "pass", pass, &pass_len);
-
-  nvs_close(nvs);
+  settings_get_str(SETTING_WIFI_SSID, ssid, ssid_len);
+  settings_get_str(SETTING_WIFI_PASS, pass, pass_len);
   return true;
 }
 #define RESET_BTN GPIO_NUM_12
@@ -355,12 +624,8 @@ bool wifi_reset_button_held(uint32_t ms) {
   return false;
 }
 void clear_wifi_credentials(void) {
-  nvs_handle_t nvs;
-  nvs_open(WIFI_NS, NVS_READWRITE, &nvs);
-
-  uint8_t valid = 0;
-  nvs_set_u8(nvs, "valid", valid);
-
-  nvs_commit(nvs);
-  nvs_close(nvs);
+  settings_set_u32(SETTING_WIFI_VALID, 0);
+  settings_reset(SETTING_WIFI_AP_CACHE);
+  // The caller restarts right after
+  settings_flush();
 }
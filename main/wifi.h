@@ -5,8 +5,32 @@
 void wifi_connection(const char *ssid, const char *pass,
                      void (*on_wifi_connected_handler)(void));
 void wifi_reset_button_init();
-bool wifi_reset_button_held(uint16_t ms);
+bool wifi_reset_button_held(uint32_t ms);
 void clear_wifi_credentials();
 bool load_wifi_credentials(char *ssid, size_t ssid_size, char *pass,
                            size_t pass_size);
-void start_wifi_provisioning();
+void start_wifi_provisioning(void (*on_wifi_connected_callback)(void));
+
+typedef enum {
+  WIFI_DISCONNECTED = 0,
+  WIFI_CONNECTING,
+  WIFI_CONNECTED,
+  WIFI_GOT_IP,
+} wifi_state_t;
+wifi_state_t wifi_get_state(void);
+
+typedef struct {
+  uint32_t cached_attempts;   // boots that tried the cached BSSID/channel
+  uint32_t cached_connects;   // ... and got an IP without scanning
+  uint32_t cached_fallbacks;  // cached AP failed, switched to full scan
+  uint32_t full_scan_connects;
+  uint32_t last_connect_ms; // wifi start -> got IP
+  uint32_t last_cached_connect_ms;
+  uint32_t last_full_scan_connect_ms;
+  bool last_connect_cached;
+  uint32_t disconnects;
+  uint32_t reconnect_attempts;
+  uint32_t next_reconnect_ms; // last scheduled backoff delay
+  uint16_t last_disconnect_reason;
+} wifi_connect_stats_t;
+void wifi_get_connect_stats(wifi_connect_stats_t *stats);
@@ -0,0 +1,160 @@
+#include "wifi_scan_cache.h"
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_TAG "WIFI_SCAN"
+#define SCAN_INTERVAL_US (15 * 1000 * 1000)
+#define SCAN_MAX_APS 20
+// Short dwell per channel: the AP shares the radio and its clients stall
+// while we're off-channel
+#define SCAN_DWELL_MIN_MS 50
+#define SCAN_DWELL_MAX_MS 120
+
+typedef struct {
+  char ssid[33];
+  int8_t rssi;
+  uint8_t authmode;
+} scan_entry_t;
+
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+static scan_entry_t cache[SCAN_MAX_APS]; // guarded by cache_lock
+static int cache_count = 0;
+
+static wifi_ap_record_t records[SCAN_MAX_APS];
+static scan_entry_t fresh[SCAN_MAX_APS];
+static esp_timer_handle_t scan_timer = NULL;
+static esp_event_handler_instance_t scan_done_handler = NULL;
+
+static void scan_timer_cb(void *arg) {
+  wifi_scan_config_t scan_cfg = {
+      .show_hidden = false,
+      .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+      .scan_time.active = {.min = SCAN_DWELL_MIN_MS, .max = SCAN_DWELL_MAX_MS},
+  };
+  esp_err_t err = esp_wifi_scan_start(&scan_cfg, false);
+  if (err != ESP_OK) {
+    ESP_LOGD(MODULE_TAG, "Scan not started: %s", esp_err_to_name(err));
+  }
+}
+
+static void on_scan_done(void *arg, esp_event_base_t base, int32_t event_id,
+                         void *event_data) {
+  uint16_t num = SCAN_MAX_APS;
+  if (esp_wifi_scan_get_ap_records(&num, records) != ESP_OK) {
+    return;
+  }
+
+  // Records come sorted by RSSI; keep the strongest BSS of each SSID
+  int count = 0;
+  for (int i = 0; i < num; i++) {
+    const char *ssid = (const char *)records[i].ssid;
+    if (ssid[0] == '\0') {
+      continue;
+    }
+    bool seen = false;
+    for (int j = 0; j < count && !seen; j++) {
+      seen = strcmp(fresh[j].ssid, ssid) == 0;
+    }
+    if (seen) {
+      continue;
+    }
+    strlcpy(fresh[count].ssid, ssid, sizeof(fresh[count].ssid));
+    fresh[count].rssi = records[i].rssi;
+    fresh[count].authmode = records[i].authmode;
+    count++;
+  }
+
+  taskENTER_CRITICAL(&cache_lock);
+  memcpy(cache, fresh, count * sizeof(scan_entry_t));
+  cache_count = count;
+  taskEXIT_CRITICAL(&cache_lock);
+  ESP_LOGD(MODULE_TAG, "Cached %d networks", count);
+}
+
+void wifi_scan_cache_start(void) {
+  if (scan_timer) {
+    return;
+  }
+  esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+                                      on_scan_done, NULL, &scan_done_handler);
+  const esp_timer_create_args_t timer_args = {
+      .callback = scan_timer_cb,
+      .name = "wifi_scan",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&timer_args, &scan_timer));
+  esp_timer_start_periodic(scan_timer, SCAN_INTERVAL_US);
+  scan_timer_cb(NULL); // first results as soon as possible
+}
+
+void wifi_scan_cache_stop(void) {
+  if (!scan_timer) {
+    return;
+  }
+  esp_timer_stop(scan_timer);
+  esp_timer_delete(scan_timer);
+  scan_timer = NULL;
+  esp_wifi_scan_stop();
+  esp_event_handler_instance_unregister(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+                                        scan_done_handler);
+}
+
+// JSON string body with the escapes an SSID can need
+static size_t json_escape(char *dst, size_t len, const char *src) {
+  size_t n = 0;
+  for (; *src; src++) {
+    unsigned char c = *src;
+    char esc[7];
+    int esc_len;
+    if (c == '"' || c == '\\') {
+      esc_len = snprintf(esc, sizeof(esc), "\\%c", c);
+    } else if (c < 0x20) {
+      esc_len = snprintf(esc, sizeof(esc), "\\u%04x", c);
+    } else {
+      esc[0] = c;
+      esc_len = 1;
+    }
+    if (n + esc_len >= len) {
+      break;
+    }
+    memcpy(dst + n, esc, esc_len);
+    n += esc_len;
+  }
+  dst[n] = '\0';
+  return n;
+}
+
+size_t wifi_scan_cache_to_json(char *buf, size_t len) {
+  scan_entry_t snapshot[SCAN_MAX_APS];
+  int count;
+
+  taskENTER_CRITICAL(&cache_lock);
+  count = cache_count;
+  memcpy(snapshot, cache, count * sizeof(scan_entry_t));
+  taskEXIT_CRITICAL(&cache_lock);
+
+  size_t n = 0;
+  if (len < 3) {
+    return 0;
+  }
+  buf[n++] = '[';
+  for (int i = 0; i < count; i++) {
+    char ssid[6 * 32 + 1];
+    json_escape(ssid, sizeof(ssid), snapshot[i].ssid);
+    int ret = snprintf(buf + n, len - n,
+                       "%s{\"ssid\":\"%s\",\"rssi\":%d,\"auth\":%d}",
+                       i ? "," : "", ssid, snapshot[i].rssi,
+                       snapshot[i].authmode);
+    if (ret < 0 || n + ret + 2 > len) {
+      break; // keep the array well-formed
+    }
+    n += ret;
+  }
+  buf[n++] = ']';
+  buf[n] = '\0';
+  return n;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stddef.h>
+
+// Background scanner for provisioning: refreshes a cache of nearby APs on a
+// timer while the SoftAP runs (requires AP+STA mode), so the portal can list
+// networks without ever waiting on the radio.
+void wifi_scan_cache_start(void);
+void wifi_scan_cache_stop(void);
+// Writes the cached APs as a JSON array of {"ssid","rssi","auth"} objects,
+// strongest first. Returns the length written (truncated to whole entries).
+size_t wifi_scan_cache_to_json(char *buf, size_t len);
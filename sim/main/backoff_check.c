@@ -0,0 +1,80 @@
+#include "backoff_check.h"
+#include "backoff.h"
+#define CHECK_NAME "backoffcheck"
+#include "check.h"
+
+// The schedule wifi.c uses
+#define BASE_MS WIFI_RECONNECT_BASE_MS
+#define MAX_MS WIFI_RECONNECT_MAX_MS
+
+static uint32_t step_ms(uint32_t attempt) {
+  uint64_t step = BASE_MS;
+  for (uint32_t i = 0; i < attempt && step < MAX_MS; i++) {
+    step <<= 1;
+  }
+  return step > MAX_MS ? MAX_MS : step;
+}
+
+// One lamp through an outage of outage_ms on a fake clock: each retry
+// fails until the network is back, then it connects and the schedule resets
+static bool check_outage(uint32_t seed, uint64_t outage_ms) {
+  bool ok = true;
+  backoff_t b;
+  backoff_init(&b, BASE_MS, MAX_MS, seed);
+  uint64_t now_ms = 0;
+  uint32_t attempt = 0;
+
+  while (now_ms < outage_ms) {
+    uint32_t delay = backoff_next_ms(&b);
+    uint32_t step = step_ms(attempt++);
+    EXPECT(delay >= step / 2 && delay <= step);
+    EXPECT(delay <= MAX_MS);
+    now_ms += delay;
+  }
+  // An hour out holds at the cap rather than growing or wrapping
+  if (outage_ms >= 3600 * 1000) {
+    EXPECT(step_ms(attempt) == MAX_MS);
+    EXPECT(b.attempt < 32);
+  }
+
+  backoff_reset(&b);
+  uint32_t first = backoff_next_ms(&b);
+  EXPECT(first >= BASE_MS / 2 && first <= BASE_MS);
+  uint32_t second = backoff_next_ms(&b);
+  EXPECT(second >= BASE_MS && second <= 2 * BASE_MS);
+  return ok;
+}
+
+// A router reboot drops every lamp at once; the jitter must keep their
+// retries from arriving together
+static bool check_spread(void) {
+  bool ok = true;
+  enum { LAMPS = 100 };
+  uint32_t retry_ms[LAMPS];
+  uint32_t min = UINT32_MAX, max = 0;
+  for (int i = 0; i < LAMPS; i++) {
+    backoff_t b;
+    backoff_init(&b, BASE_MS, MAX_MS, 0x1234567 + i * 2654435761u);
+    for (int n = 0; n < 8; n++) {
+      retry_ms[i] = backoff_next_ms(&b); // the 8th: a 64 s step, capped
+    }
+    min = retry_ms[i] < min ? retry_ms[i] : min;
+    max = retry_ms[i] > max ? retry_ms[i] : max;
+  }
+  EXPECT(min >= MAX_MS / 2 && max <= MAX_MS);
+  // Half the cap to spread over; most of it used
+  EXPECT(max - min > MAX_MS / 4);
+  return ok;
+}
+
+bool backoff_check(void) {
+  bool ok = true;
+  // Seed 0 falls back to a fixed non-zero state
+  for (uint32_t seed = 0; seed < 50; seed++) {
+    ok &= check_outage(seed * 0x9E3779B9u, 10 * 1000);
+    ok &= check_outage(seed * 0x9E3779B9u + 1, 3600 * 1000);
+  }
+  ok &= check_spread();
+  printf("backoffcheck %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <stdbool.h>
+
+// Replays the WiFi reconnect schedule (backoff.h) against a fake clock:
+// every delay within its equal-jitter bounds, the cap held however long the
+// outage, a reset once connected, and retries from many lamps spread out
+// rather than in step. Prints what failed; returns false if anything did.
+bool backoff_check(void);
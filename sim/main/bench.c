@@ -0,0 +1,195 @@
+#include "bench.h"
+#include "compositor.h"
+#include "effects.h"
+#include "frame_delta.h"
+#include "wave.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void report(const char *name, uint64_t elapsed_ns, unsigned n,
+                   const char *unit, uint32_t checksum) {
+  // The checksum keeps the work observable so it is not optimized away
+  printf("bench %-14s %8.1f ns/%s (checksum %" PRIu32 ")\n", name,
+         n ? (double)elapsed_ns / n : 0.0, unit, checksum);
+}
+
+void bench_frames(unsigned frames) {
+  enum { N = 24 };
+  static rgb8_t pixels[2][N];
+  static rgb8_t out[N];
+  led_command_t base_cmd = {STATE_RAINBOW_CHASE, 0, 0, 0};
+  led_command_t overlay_cmd = {STATE_PULSE_WAVE, 0xFF, 0x40, 0x00};
+  effect_t base, overlay;
+  static const char *const names[] = {"REPLACE", "ADD", "MULTIPLY", "ALPHA"};
+
+  for (int row = -1; row < 4; row++) {
+    effect_start(&base, &base_cmd, 0);
+    effect_start(&overlay, &overlay_cmd, 0);
+    compositor_layer_t stack[2] = {
+        {.start = 0, .count = N, .mode = BLEND_REPLACE, .opacity = 255,
+         .pixels = pixels[0]},
+        {.start = 4, .count = 16, .mode = row < 0 ? BLEND_REPLACE : row,
+         .opacity = 160, .pixels = pixels[1]},
+    };
+    int layers = row < 0 ? 1 : 2;
+    uint32_t checksum = 0;
+    uint64_t start = now_ns();
+    for (unsigned f = 0; f < frames; f++) {
+      uint32_t t_ms = f * 10;
+      effect_render(&base, pixels[0], N, t_ms);
+      if (layers > 1) {
+        effect_render(&overlay, pixels[1], 16, t_ms);
+      }
+      compositor_blend(stack, layers, out, N);
+      checksum += out[f % N].r + out[f % N].g + out[f % N].b;
+    }
+    report(row < 0 ? "base" : names[row], now_ns() - start, frames, "frame",
+           checksum);
+  }
+}
+
+typedef enum {
+  WAVE_SIN8,
+  WAVE_SINF,
+  WAVE_TRI8,
+  WAVE_EASE8,
+  WAVE_RAND8,
+  WAVE_RAND,
+  WAVE_NOISE1D,
+  WAVE_NOISE2D,
+} wave_kind_t;
+
+static const char *const wave_names[] = {
+    [WAVE_SIN8] = "sin8",
+    [WAVE_SINF] = "sinf",
+    [WAVE_TRI8] = "tri8",
+    [WAVE_EASE8] = "ease8",
+    [WAVE_RAND8] = "rand8",
+    [WAVE_RAND] = "rand",
+    [WAVE_NOISE1D] = "noise8_1d",
+    [WAVE_NOISE2D] = "noise8_2d",
+};
+
+void bench_wave(unsigned samples) {
+  for (int kind = WAVE_SIN8; kind <= WAVE_NOISE2D; kind++) {
+    uint32_t checksum = 0;
+    uint32_t rng = 0x2545F491;
+    srand(1);
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < samples; i++) {
+      switch (kind) {
+      case WAVE_SIN8:
+        checksum += sin8(i);
+        break;
+      case WAVE_SINF:
+        checksum += (uint8_t)(128 + 127 * sinf(i * (2 * (float)M_PI / 256)));
+        break;
+      case WAVE_TRI8:
+        checksum += tri8(i);
+        break;
+      case WAVE_EASE8:
+        checksum += ease8(i);
+        break;
+      case WAVE_RAND8:
+        checksum += rand8(&rng);
+        break;
+      case WAVE_RAND:
+        checksum += rand() & 0xFF;
+        break;
+      case WAVE_NOISE1D:
+        checksum += noise8_1d(i * 7, 1);
+        break;
+      case WAVE_NOISE2D:
+        checksum += noise8_2d(i * 7, i * 3, 1);
+        break;
+      }
+    }
+    report(wave_names[kind], now_ns() - start, samples, "sample", checksum);
+  }
+}
+
+typedef struct {
+  const char *name;
+  led_command_t base;
+  led_command_t overlay; // STATE_COLOR black: none
+} preview_scene_t;
+
+bool bench_preview(unsigned frames) {
+  enum { N = 24 };
+  static const preview_scene_t scenes[] = {
+      {"static", {STATE_COLOR, 0x20, 0x80, 0xFF}, {STATE_COLOR, 0, 0, 0}},
+      {"pulse", {STATE_PULSE_WAVE, 0xFF, 0x40, 0x00}, {STATE_COLOR, 0, 0, 0}},
+      {"chase", {STATE_RAINBOW_CHASE, 0, 0, 0}, {STATE_COLOR, 0, 0, 0}},
+      {"layered", {STATE_COLOR, 0x20, 0x80, 0xFF},
+       {STATE_RAINBOW_CHASE, 0, 0, 0}},
+  };
+  // Every LED frame, then the default preview rate
+  static const unsigned intervals_ms[] = {10, 200};
+  static rgb8_t pixels[2][N];
+  static rgb8_t prev[N], cur[N], decoded[N];
+  static uint8_t msg[FRAME_DELTA_MAX_LEN(N)];
+  bool ok = true;
+
+  for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+    for (int v = 0; v < 2; v++) {
+      effect_t base, overlay;
+      effect_start(&base, &scenes[s].base, 0);
+      effect_start(&overlay, &scenes[s].overlay, 0);
+      compositor_layer_t stack[2] = {
+          {.count = N, .mode = BLEND_REPLACE, .opacity = 255,
+           .pixels = pixels[0]},
+          {.start = 8, .count = 8, .mode = BLEND_ALPHA, .opacity = 192,
+           .pixels = pixels[1]},
+      };
+      int layers = scenes[s].overlay.state == STATE_COLOR &&
+                           scenes[s].overlay.r == 0
+                       ? 1
+                       : 2;
+      uint64_t encode_ns = 0;
+      unsigned bytes = 0;
+      size_t key_len = 0;
+
+      for (unsigned f = 0; f < frames; f++) {
+        uint32_t t_ms = f * intervals_ms[v];
+        effect_render(&base, pixels[0], N, t_ms);
+        if (layers > 1) {
+          effect_render(&overlay, pixels[1], 8, t_ms);
+        }
+        compositor_blend(stack, layers, cur, N);
+        if (f > 0 && memcmp(cur, prev, sizeof(cur)) == 0) {
+          continue; // not published
+        }
+        uint64_t start = now_ns();
+        size_t len = frame_delta_encode(f ? prev : NULL, cur, N, f, msg);
+        encode_ns += now_ns() - start;
+        bytes += len;
+        if (f == 0) {
+          key_len = len;
+        }
+        if (!frame_delta_apply(msg, len, decoded, N) ||
+            memcmp(decoded, cur, sizeof(cur)) != 0) {
+          printf("bench preview %s: frame %u does not round-trip\n",
+                 scenes[s].name, f);
+          ok = false;
+        }
+        memcpy(prev, cur, sizeof(prev));
+      }
+      printf("bench preview %-8s every %3u ms %7.1f ns/frame %6.1f B/frame "
+             "(keyframe %u B, raw %u B)\n",
+             scenes[s].name, intervals_ms[v], (double)encode_ns / frames,
+             (double)bytes / frames, (unsigned)key_len,
+             (unsigned)(FRAME_DELTA_HEADER_LEN + N * 3));
+    }
+  }
+  return ok;
+}
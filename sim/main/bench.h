@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+
+// Host timings printed to stdout. Absolute numbers are the host's; the
+// ratios between rows are what carry over to the device.
+
+// Cost of one frame as the LED loop builds it: render every layer, then
+// composite. One row for the base layer alone, one per overlay blend mode.
+void bench_frames(unsigned frames);
+// ns per sample of each wave.h generator, next to the float and libc
+// versions they replace
+void bench_wave(unsigned samples);
+// Preview coding (frame_delta.h) over a few scenes, sampled every LED frame
+// and at the default preview rate: encode time and bytes per frame, with
+// unchanged frames counted as the nothing they cost. Every message is
+// decoded again; returns false if one does not reproduce its frame.
+bool bench_preview(unsigned frames);
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+
+// For the host checks: each defines CHECK_NAME (its script command) before
+// including this, and keeps a local `bool ok` that EXPECT clears, printing
+// where the check failed
+#define EXPECT(cond)                                                           \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf(CHECK_NAME ": %s:%d: %s\n", __func__, __LINE__, #cond);           \
+      ok = false;                                                              \
+    }                                                                          \
+  } while (0)
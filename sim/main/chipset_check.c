@@ -0,0 +1,90 @@
+#include "chipset_check.h"
+#include "led_chipset.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PHASE_TOLERANCE_NS 150
+// rmt_symbol_word_t durations are 15 bits
+#define RMT_DURATION_MAX 32767
+
+static const led_chipset_t *const chipsets[] = {
+    &led_chipset_ws2812,
+    &led_chipset_sk6812_rgbw,
+    &led_chipset_ws2815,
+};
+
+static bool phase_ok(const char *chipset, const char *phase, uint32_t ticks,
+                     uint32_t want_ns, uint32_t resolution_hz) {
+  uint64_t got_ns = (uint64_t)ticks * 1000000000u / resolution_hz;
+  uint64_t err = got_ns > want_ns ? got_ns - want_ns : want_ns - got_ns;
+  if (ticks == 0 || ticks > RMT_DURATION_MAX || err > PHASE_TOLERANCE_NS) {
+    printf("chipset %s: %s is %u ticks = %llu ns, want %u ns\n", chipset,
+           phase, (unsigned)ticks, (unsigned long long)got_ns,
+           (unsigned)want_ns);
+    return false;
+  }
+  return true;
+}
+
+static bool writer_ok(const led_chipset_t *chipset) {
+  // Distinct channel values, with 0x10 in common for white to pick up
+  const rgb8_t px = {0x90, 0x50, 0x30};
+  static const char orders[LED_ORDER_COUNT][4] = {
+      [LED_ORDER_RGB] = "rgb",
+      [LED_ORDER_RBG] = "rbg",
+      [LED_ORDER_GRB] = "grb",
+      [LED_ORDER_GBR] = "gbr",
+      [LED_ORDER_BRG] = "brg",
+      [LED_ORDER_BGR] = "bgr",
+  };
+  bool ok = true;
+
+  for (int order = 0; order < LED_ORDER_COUNT; order++) {
+    led_chipset_t c = *chipset;
+    c.order = order;
+    uint8_t want[LED_CHIPSET_MAX_CHANNELS];
+    uint8_t w = c.channels == 4 ? 0x30 : 0;
+    for (int i = 0; i < 3; i++) {
+      char ch = orders[order][i];
+      want[i] = (ch == 'r' ? px.r : ch == 'g' ? px.g : px.b) - w;
+    }
+    want[3] = w;
+
+    // Two pixels, so the writer's stride is checked too
+    uint8_t got[2 * LED_CHIPSET_MAX_CHANNELS];
+    const rgb8_t src[2] = {px, px};
+    led_pixel_writer(&c)(got, src, 2);
+    if (memcmp(got, want, c.channels) != 0 ||
+        memcmp(got + c.channels, want, c.channels) != 0) {
+      printf("chipset %s: %s writer puts out %02x %02x %02x %02x\n",
+             chipset->name, orders[order], got[0], got[1], got[2],
+             c.channels == 4 ? got[3] : 0);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+bool chipset_check(uint32_t resolution_hz) {
+  bool all_ok = true;
+  for (size_t i = 0; i < sizeof(chipsets) / sizeof(chipsets[0]); i++) {
+    const led_chipset_t *c = chipsets[i];
+    led_bit_ticks_t t;
+    led_chipset_bit_ticks(c, resolution_hz, &t);
+
+    bool ok = phase_ok(c->name, "T0H", t.t0h, c->t0h_ns, resolution_hz);
+    ok &= phase_ok(c->name, "T0L", t.t0l, c->t0l_ns, resolution_hz);
+    ok &= phase_ok(c->name, "T1H", t.t1h, c->t1h_ns, resolution_hz);
+    ok &= phase_ok(c->name, "T1L", t.t1l, c->t1l_ns, resolution_hz);
+    // The encoder splits the latch over both halves of one symbol
+    ok &= phase_ok(c->name, "reset/2", t.reset / 2, c->reset_us * 500u,
+                   resolution_hz);
+    ok &= writer_ok(c);
+
+    printf("chipset %-12s @ %u Hz: T0 %u/%u T1 %u/%u reset %u ticks %s\n",
+           c->name, (unsigned)resolution_hz, t.t0h, t.t0l, t.t1h, t.t1l,
+           (unsigned)t.reset, ok ? "ok" : "FAIL");
+    all_ok &= ok;
+  }
+  return all_ok;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Checks every chipset descriptor at an RMT resolution: each encoded bit
+// phase lands within the datasheet's +-150 ns, every duration fits the RMT
+// symbol's 15-bit field, and the pixel writers put channels (and the
+// extracted white) where the color order says. Prints one line per chipset;
+// returns false if any check failed.
+bool chipset_check(uint32_t resolution_hz);
@@ -0,0 +1,120 @@
+#include "gesture_check.h"
+#include "button_gesture.h"
+#include <string.h>
+#define CHECK_NAME "gesturecheck"
+#include "check.h"
+
+// The bounce and double-press timelines below use fixed times that assume
+// timings of this order; the window and long-press edges follow the values
+#define LONG_MS BUTTON_LONG_PRESS_MS
+#define GAP_MS BUTTON_DOUBLE_PRESS_MS
+_Static_assert(BUTTON_DEBOUNCE_MS > 15 && BUTTON_DEBOUNCE_MS < 50 &&
+                   GAP_MS > 150 && LONG_MS > 600,
+               "gesturecheck timelines no longer fit the button timings");
+
+typedef struct {
+  uint32_t ms;
+  bool pressed;
+} edge_t;
+
+static void append(char *events, size_t size,
+                   const button_gesture_output_t *out) {
+  for (int i = 0; i < out->count; i++) {
+    size_t len = strlen(events);
+    snprintf(events + len, size - len, "%s%s", len ? " " : "",
+             button_event_name(out->events[i]));
+  }
+}
+
+// Feeds the edges in order, firing every deadline that falls before the
+// next one as button_task's timer would, then runs out the remaining
+// deadlines. events gets the names of what was emitted, space separated.
+static void replay(const edge_t *edges, int count, char *events,
+                   size_t size) {
+  const button_gesture_config_t cfg = {
+      .debounce_us = BUTTON_DEBOUNCE_MS * 1000,
+      .long_press_us = BUTTON_LONG_PRESS_MS * 1000,
+      .double_press_us = BUTTON_DOUBLE_PRESS_MS * 1000,
+  };
+  button_gesture_t bg;
+  button_gesture_output_t out;
+  button_gesture_init(&bg, &cfg);
+  events[0] = '\0';
+
+  for (int i = 0; i <= count; i++) {
+    int64_t next_us = i < count ? (int64_t)edges[i].ms * 1000
+                                : BUTTON_GESTURE_NO_DEADLINE;
+    int64_t deadline;
+    while ((deadline = button_gesture_deadline(&bg)) < next_us) {
+      button_gesture_timeout(&bg, deadline, &out);
+      append(events, size, &out);
+    }
+    if (i < count) {
+      button_gesture_edge(&bg, edges[i].pressed, next_us, &out);
+      append(events, size, &out);
+    }
+  }
+}
+
+static bool check(const char *name, const edge_t *edges, int count,
+                  const char *want) {
+  bool ok = true;
+  char events[128];
+  replay(edges, count, events, sizeof(events));
+  EXPECT(strcmp(events, want) == 0);
+  if (!ok) {
+    printf("gesturecheck: %s: got \"%s\", want \"%s\"\n", name, events,
+           want);
+  }
+  return ok;
+}
+
+#define CHECK(name, want, ...)                                                 \
+  do {                                                                         \
+    const edge_t edges[] = {__VA_ARGS__};                                      \
+    ok &= check(name, edges, sizeof(edges) / sizeof(edges[0]), want);          \
+  } while (0)
+
+bool gesture_check(void) {
+  bool ok = true;
+  const bool D = true, U = false;
+
+  CHECK("bounce", "PRESS RELEASE",
+        {0, D}, {2, U}, {4, D}, {7, U}, {9, D}, // bounce on press
+        {200, U}, {202, D}, {205, U}, {211, D}, {214, U});
+  // Released before the lockout ends: the release comes at its end
+  CHECK("short", "PRESS RELEASE", {0, D}, {5, U});
+  // Still down when the lockout ends, up again before the next edge
+  CHECK("bounce into release", "PRESS RELEASE", {0, D}, {15, U}, {18, D},
+        {25, U});
+  CHECK("double", "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE", {0, D},
+        {100, U}, {250, D}, {350, U});
+  // The second press bounces too; only its leading edge counts
+  CHECK("double bounce", "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE", {0, D},
+        {100, U}, {250, D}, {252, U}, {255, D}, {350, U});
+  // Pressed again while the release still bounces: the press comes at the
+  // end of the release lockout
+  CHECK("press in release lockout",
+        "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE", {0, D}, {100, U},
+        {110, D}, {200, U});
+  CHECK("slow double", "PRESS RELEASE PRESS RELEASE", {0, D}, {100, U},
+        {100 + GAP_MS + 1, D}, {200 + GAP_MS, U});
+  CHECK("long", "PRESS LONG_PRESS RELEASE", {0, D}, {LONG_MS + 200, U});
+  CHECK("just short of long", "PRESS RELEASE", {0, D}, {LONG_MS - 1, U});
+  // A long press is not the first half of a double
+  CHECK("long then press", "PRESS LONG_PRESS RELEASE PRESS RELEASE", {0, D},
+        {LONG_MS + 200, U}, {LONG_MS + 300, D}, {LONG_MS + 400, U});
+  // The third press starts a new sequence; the fourth completes it
+  CHECK("triple", "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE PRESS RELEASE",
+        {0, D}, {100, U}, {200, D}, {300, U}, {400, D}, {500, U});
+  CHECK("quadruple",
+        "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE PRESS RELEASE PRESS "
+        "DOUBLE_PRESS RELEASE",
+        {0, D}, {100, U}, {200, D}, {300, U}, {400, D}, {500, U}, {600, D},
+        {700, U});
+  // Holding the second press of a double is not also a long press
+  CHECK("double held", "PRESS RELEASE PRESS DOUBLE_PRESS RELEASE", {0, D},
+        {100, U}, {200, D}, {200 + 2 * LONG_MS, U});
+  printf("gesturecheck %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
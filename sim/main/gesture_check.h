@@ -0,0 +1,9 @@
+#pragma once
+#include <stdbool.h>
+
+// Replays synthetic edge timelines through the button gesture FSM with the
+// lamp's timings (button_gesture.h): contact bounce on press and release,
+// taps shorter than the debounce time, double presses inside and outside
+// the window, long presses, and a third press after a double. Prints what
+// failed; returns false if anything did.
+bool gesture_check(void);
@@ -0,0 +1,147 @@
+#include "schedule_check.h"
+#include "command.h"
+#include "effects.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lamp_clock.h"
+#include "led.h"
+#include "schedule.h"
+#include "sim_clock.h"
+#include <stdio.h>
+#include <string.h>
+#define CHECK_NAME "schedcheck"
+#include "check.h"
+
+#define SIM_MAX_LEDS 64
+// Used when the script has not set the clock: 2023-11-14
+#define SIM_CHECK_EPOCH_MS 1700000000000ull
+// Far enough into the pulse that a lamp starting it now looks different
+#define LATE_BY_MS 600
+// How far the strip may trail the clock: a wait is rounded up to a whole
+// 10 ms tick, and the loop then has to be scheduled
+#define FRAME_LAG_MS 40
+
+static bool check_queue(void) {
+  bool ok = true;
+  schedule_t s = {0};
+  schedule_entry_t e;
+  uint64_t due;
+
+  EXPECT(!schedule_next_due(&s, &due));
+  EXPECT(schedule_push(&s, 3000, "C", 1));
+  EXPECT(schedule_push(&s, 1000, "A", 1));
+  EXPECT(schedule_push(&s, 2000, "B1", 2));
+  EXPECT(schedule_push(&s, 2000, "B2", 2));
+  EXPECT(schedule_next_due(&s, &due) && due == 1000);
+
+  EXPECT(!schedule_pop_due(&s, 999, &e));
+  EXPECT(schedule_pop_due(&s, 1000, &e) && e.cmd[0] == 'A');
+  // Same due time: arrival order
+  EXPECT(schedule_pop_due(&s, 5000, &e) && memcmp(e.cmd, "B1", 2) == 0);
+  EXPECT(schedule_pop_due(&s, 5000, &e) && memcmp(e.cmd, "B2", 2) == 0);
+  EXPECT(schedule_pop_due(&s, 5000, &e) && e.cmd[0] == 'C' && e.len == 1);
+  EXPECT(!schedule_pop_due(&s, 5000, &e));
+
+  for (int i = 0; i < SCHEDULE_MAX_ENTRIES; i++) {
+    EXPECT(schedule_push(&s, i, "X", 1));
+  }
+  EXPECT(!schedule_push(&s, 0, "X", 1));
+  s.count = 0;
+  char long_cmd[SCHEDULE_MAX_CMD_LEN + 1] = {0};
+  EXPECT(!schedule_push(&s, 0, long_cmd, sizeof(long_cmd)));
+  return ok;
+}
+
+// Wakes after frame_ms land exactly on a step boundary of the effect's
+// timeline, and the frame is still unchanged just before it
+static bool check_steps(uint32_t start_ms, const led_command_t *cmd) {
+  bool ok = true;
+  enum { N = 24 };
+  effect_t fx;
+  rgb8_t a[N], b[N];
+  effect_start(&fx, cmd, start_ms);
+
+  for (uint32_t t = 37; t < 2000; t += 7) {
+    uint32_t now = start_ms + t;
+    effect_render(&fx, a, N, now);
+    uint32_t wait = effect_frame_ms(&fx, now);
+    if (wait) {
+      effect_render(&fx, b, N, now + wait - 1);
+      EXPECT(memcmp(a, b, sizeof(a)) == 0);
+    }
+  }
+
+  // Before the start time the effect holds its first frame
+  effect_render(&fx, a, N, start_ms);
+  effect_render(&fx, b, N, start_ms - 5);
+  EXPECT(memcmp(a, b, sizeof(a)) == 0);
+  return ok;
+}
+
+// Whether the strip shows fx as rendered at some point in the last
+// window_ms: the loop may not have drawn the newest step yet
+static bool strip_shows(const effect_t *fx, const rgb8_t *strip, uint16_t n,
+                        uint32_t now, uint32_t window_ms) {
+  rgb8_t want[SIM_MAX_LEDS];
+  for (uint32_t back = 0; back <= window_ms; back++) {
+    effect_render(fx, want, n, now - back);
+    if (memcmp(want, strip, n * sizeof(*strip)) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A lamp that gets "@<due> PULSE..." after due runs it late, through the
+// real command path, schedule timer and LED loop. It must show what a lamp
+// that started on time shows, not what one starting now would.
+static bool check_late(void) {
+  bool ok = true;
+  const led_command_t pulse = {STATE_PULSE_WAVE, 0xFF, 0xFF, 0xFF};
+  uint16_t n = led_count();
+  EXPECT(n <= SIM_MAX_LEDS);
+  if (n > SIM_MAX_LEDS) {
+    return ok;
+  }
+  if (!lamp_clock_synced()) {
+    sim_clock_set(SIM_CHECK_EPOCH_MS);
+  }
+
+  uint64_t due_ms = lamp_clock_epoch_ms() - LATE_BY_MS;
+  char line[48];
+  // A dump would run on the esp_timer task
+  int len = snprintf(line, sizeof(line), "@%llu TRACE",
+                     (unsigned long long)due_ms);
+  EXPECT(!handle_command(line, len));
+  len = snprintf(line, sizeof(line), "@%llu PULSE#FFFFFF",
+                 (unsigned long long)due_ms);
+  EXPECT(handle_command(line, len));
+  effect_t on_time, from_now;
+  effect_start(&on_time, &pulse, (uint32_t)due_ms);
+  effect_start(&from_now, &pulse, lamp_clock_ms());
+
+  rgb8_t strip[SIM_MAX_LEDS];
+  for (int i = 0; i < 5; i++) {
+    vTaskDelay(pdMS_TO_TICKS(50));
+    led_snapshot(strip);
+    uint32_t now = lamp_clock_ms();
+    EXPECT(strip_shows(&on_time, strip, n, now, FRAME_LAG_MS));
+    EXPECT(!strip_shows(&from_now, strip, n, now, FRAME_LAG_MS));
+  }
+  return ok;
+}
+
+bool schedule_check(void) {
+  const led_command_t chase = {STATE_RAINBOW_CHASE, 0, 0, 0};
+  const led_command_t pulse = {STATE_PULSE_WAVE, 0x20, 0x80, 0xFF};
+
+  bool ok = check_queue();
+  ok &= check_steps(1000, &chase);
+  ok &= check_steps(1000, &pulse);
+  // Effects that straddle the 32-bit wrap of the effect clock
+  ok &= check_steps(UINT32_MAX - 500, &chase);
+  ok &= check_steps(UINT32_MAX - 500, &pulse);
+  ok &= check_late();
+  printf("schedcheck %s\n", ok ? "ok" : "FAIL");
+  return ok;
+}
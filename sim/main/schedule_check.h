@@ -0,0 +1,10 @@
+#pragma once
+#include <stdbool.h>
+
+// Checks the command schedule's ordering and limits, and the phase math
+// that keeps lamps in step: wakes land on an effect's step boundaries, the
+// 32-bit effect clock survives its wrap, and a scheduled command that runs
+// late shows on the strip what a lamp that ran it on time shows. The last
+// part drives the real LED loop and sets the sim clock if the script has
+// not. Prints what failed; returns false if anything did.
+bool schedule_check(void);
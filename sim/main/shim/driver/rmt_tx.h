@@ -0,0 +1,27 @@
+#pragma once
+// Virtual strip stand-in for the RMT TX driver, see virtual_strip.c
+#include "driver/rmt_encoder.h"
+#include "driver/rmt_types.h"
+
+typedef struct {
+  int gpio_num;
+  rmt_clock_source_t clk_src;
+  uint32_t resolution_hz;
+  size_t mem_block_symbols;
+  size_t trans_queue_depth;
+} rmt_tx_channel_config_t;
+
+typedef struct {
+  int loop_count;
+} rmt_transmit_config_t;
+
+esp_err_t rmt_new_tx_channel(const rmt_tx_channel_config_t *config,
+                             rmt_channel_handle_t *ret_chan);
+esp_err_t rmt_enable(rmt_channel_handle_t channel);
+esp_err_t rmt_disable(rmt_channel_handle_t channel);
+esp_err_t rmt_transmit(rmt_channel_handle_t tx_channel,
+                       rmt_encoder_handle_t encoder, const void *payload,
+                       size_t payload_bytes,
+                       const rmt_transmit_config_t *config);
+esp_err_t rmt_tx_wait_all_done(rmt_channel_handle_t tx_channel,
+                               int timeout_ms);
@@ -0,0 +1,11 @@
+#pragma once
+// Just enough of the RMT driver types for led.c on the linux target
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct rmt_channel_t *rmt_channel_handle_t;
+typedef struct rmt_encoder_t *rmt_encoder_handle_t;
+
+typedef int rmt_clock_source_t;
+#define RMT_CLK_SRC_DEFAULT 0
@@ -0,0 +1,28 @@
+// Fake lamp clock for the simulator: esp_timer time on top of an epoch the
+// script sets with "clock <epoch_ms>", which also counts as a sync; the
+// first one reports its step like the first SNTP sync does
+#include "lamp_clock.h"
+#include "esp_timer.h"
+
+static uint64_t epoch_at_zero_ms = 0;
+static bool synced = false;
+static lamp_clock_step_cb_t step_cb = NULL;
+
+void sim_clock_set(uint64_t epoch_ms) {
+  uint64_t old_ms = epoch_at_zero_ms;
+  epoch_at_zero_ms = epoch_ms - esp_timer_get_time() / 1000;
+  if (!synced && step_cb) {
+    step_cb((int64_t)(epoch_at_zero_ms - old_ms));
+  }
+  synced = true;
+}
+
+void lamp_clock_on_step(lamp_clock_step_cb_t cb) { step_cb = cb; }
+
+void lamp_clock_start_sync(void) {}
+
+bool lamp_clock_synced(void) { return synced; }
+
+uint64_t lamp_clock_epoch_ms(void) {
+  return epoch_at_zero_ms + esp_timer_get_time() / 1000;
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+
+// Jumps the simulated lamp clock to epoch_ms and marks it synced
+void sim_clock_set(uint64_t epoch_ms);
@@ -0,0 +1,191 @@
+// Drives the real LED loop and command path on the linux target.
+//
+// Reads a script from LAMP_SIM_SCRIPT (default: stdin), one line each:
+//   COLOR#RRGGBB / PULSE#RRGGBB / CHASE   handed to handle_command()
+//   LAYER<n> ...                          see command.h
+//   wait <ms>                             let the loop render
+//   bench <frames>                        time frames, waveforms and preview
+//   chipsets <resolution_hz>              check chipset timings and writers
+//   clipload <path>                       upload a clip image (clip_pack.mjs)
+//   clock <epoch_ms>                      set the fake lamp clock (synced)
+//   schedcheck                            check scheduling and phase math
+//   backoffcheck                          check the reconnect backoff
+//   gesturecheck                          check the button gesture FSM
+//   # ...                                 comment
+// Frames go to LAMP_SIM_FRAMES (default: frames.bin), see virtual_strip.h.
+#include "backoff_check.h"
+#include "bench.h"
+#include "chipset_check.h"
+#include "clips.h"
+#include "command.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "gesture_check.h"
+#include "led.h"
+#include "mqtt.h"
+#include "schedule_check.h"
+#include "sim_clock.h"
+#include "state_publisher.h"
+#include "virtual_strip.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODULE_TAG "SIM"
+// Let the loop render the last command before the log is closed
+#define SIM_TAIL_MS 500
+
+// The state publisher's only link to MQTT; publishes are echoed instead
+int mqtt_enqueue_to(const mqtt_topic_t *topic, const char *data, int len,
+                    int qos, int retain) {
+  printf("publish %s %.*s\n", topic->name, len, data);
+  return 0;
+}
+
+int mqtt_enqueue(const char *topic, const char *data, int len, int qos,
+                 int retain) {
+  const mqtt_topic_t plain = {.name = topic};
+  return mqtt_enqueue_to(&plain, data, len, qos, retain);
+}
+
+// Reads all of a script up front so a blocking read never stalls the
+// simulated scheduler mid-run
+static char *read_script(const char *path) {
+  FILE *f = path ? fopen(path, "r") : stdin;
+  if (!f) {
+    ESP_LOGE(MODULE_TAG, "Cannot open %s", path);
+    return NULL;
+  }
+  size_t cap = 4096, len = 0;
+  char *buf = malloc(cap);
+  while (buf) {
+    size_t n = fread(buf + len, 1, cap - len - 1, f);
+    len += n;
+    if (n == 0) {
+      if (ferror(f) && errno == EINTR) {
+        clearerr(f);
+        continue;
+      }
+      break;
+    }
+    if (len == cap - 1) {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  if (buf) {
+    buf[len] = '\0';
+  }
+  if (f != stdin) {
+    fclose(f);
+  }
+  return buf;
+}
+
+// Set by failed checks; the sim then exits non-zero
+static bool check_failed = false;
+
+// Feeds the image to the clip store in MQTT-sized chunks
+static void load_clips(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    ESP_LOGE(MODULE_TAG, "Cannot open %s", path);
+    return;
+  }
+  fseek(f, 0, SEEK_END);
+  size_t total = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  uint8_t chunk[1024];
+  size_t offset = 0, n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    if (clips_upload_chunk(offset, chunk, n, total) != ESP_OK) {
+      break;
+    }
+    offset += n;
+  }
+  fclose(f);
+}
+
+static void run_script(char *script) {
+  char *save = NULL;
+  for (char *line = strtok_r(script, "\r\n", &save); line;
+       line = strtok_r(NULL, "\r\n", &save)) {
+    if (line[0] == '\0' || line[0] == '#') {
+      continue;
+    }
+    unsigned ms;
+    if (sscanf(line, "wait %u", &ms) == 1) {
+      vTaskDelay(pdMS_TO_TICKS(ms));
+      continue;
+    }
+    if (sscanf(line, "bench %u", &ms) == 1) {
+      bench_frames(ms);
+      bench_wave(ms * 24);
+      check_failed |= !bench_preview(ms);
+      continue;
+    }
+    if (strncmp(line, "clipload ", 9) == 0) {
+      load_clips(line + 9);
+      continue;
+    }
+    unsigned long long epoch_ms;
+    if (sscanf(line, "clock %llu", &epoch_ms) == 1) {
+      sim_clock_set(epoch_ms);
+      continue;
+    }
+    if (strcmp(line, "schedcheck") == 0) {
+      check_failed |= !schedule_check();
+      continue;
+    }
+    if (strcmp(line, "backoffcheck") == 0) {
+      check_failed |= !backoff_check();
+      continue;
+    }
+    if (strcmp(line, "gesturecheck") == 0) {
+      check_failed |= !gesture_check();
+      continue;
+    }
+    unsigned hz;
+    if (sscanf(line, "chipsets %u", &hz) == 1) {
+      check_failed |= !chipset_check(hz);
+      continue;
+    }
+    virtual_strip_mark_command(line, strlen(line));
+    if (!handle_command(line, strlen(line))) {
+      ESP_LOGW(MODULE_TAG, "Rejected: %s", line);
+    }
+  }
+}
+
+void app_main(void) {
+  const char *frames = getenv("LAMP_SIM_FRAMES");
+  if (!virtual_strip_open(frames ? frames : "frames.bin")) {
+    exit(1);
+  }
+  char *script = read_script(getenv("LAMP_SIM_SCRIPT"));
+  if (!script) {
+    exit(1);
+  }
+
+  clips_init();
+  command_init();
+  state_publisher_init();
+  init_led_strip();
+  xTaskCreate(start_led_loop, "led_loop", 2048, NULL, 3, NULL);
+  // Let the loop register itself for command notifications
+  vTaskDelay(1);
+
+  run_script(script);
+  free(script);
+  vTaskDelay(pdMS_TO_TICKS(SIM_TAIL_MS));
+
+  virtual_strip_stats_t stats;
+  virtual_strip_get_stats(&stats);
+  virtual_strip_close();
+  printf("frames %" PRIu32 " commands %" PRIu32 " wire_us %" PRIu64 "\n",
+         stats.frames, stats.commands, stats.wire_us);
+  exit(check_failed ? 1 : 0);
+}
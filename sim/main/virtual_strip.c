@@ -0,0 +1,119 @@
+#include "virtual_strip.h"
+#include "driver/rmt_tx.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "led_strip_encoder.h"
+#include <stdio.h>
+#include <string.h>
+
+#define MODULE_TAG "VSTRIP"
+
+// Handles only need to be non-NULL and distinct; nothing is behind them
+static int virtual_chan;
+static int virtual_encoder;
+
+static FILE *frame_log = NULL;
+static SemaphoreHandle_t log_lock = NULL;
+static virtual_strip_stats_t stats;
+// Bit and latch times of the configured chipset, for the wire time estimate
+static led_bit_ticks_t wire_ticks;
+static uint32_t wire_resolution_hz;
+
+static void write_record(uint8_t type, const void *data, size_t len) {
+  uint8_t hdr[11];
+  uint64_t now = esp_timer_get_time();
+  uint16_t n = len > UINT16_MAX ? UINT16_MAX : len;
+
+  hdr[0] = type;
+  for (int i = 0; i < 8; i++) {
+    hdr[1 + i] = now >> (8 * i);
+  }
+  hdr[9] = n & 0xFF;
+  hdr[10] = n >> 8;
+
+  xSemaphoreTake(log_lock, portMAX_DELAY);
+  if (frame_log) {
+    fwrite(hdr, 1, sizeof(hdr), frame_log);
+    fwrite(data, 1, n, frame_log);
+  }
+  xSemaphoreGive(log_lock);
+}
+
+bool virtual_strip_open(const char *path) {
+  log_lock = xSemaphoreCreateMutex();
+  frame_log = fopen(path, "wb");
+  if (!frame_log) {
+    ESP_LOGE(MODULE_TAG, "Cannot create %s", path);
+    return false;
+  }
+  fwrite("LAMPSIM1", 1, 8, frame_log);
+  ESP_LOGI(MODULE_TAG, "Recording frames to %s", path);
+  return true;
+}
+
+void virtual_strip_close(void) {
+  xSemaphoreTake(log_lock, portMAX_DELAY);
+  if (frame_log) {
+    fclose(frame_log);
+    frame_log = NULL;
+  }
+  xSemaphoreGive(log_lock);
+}
+
+void virtual_strip_mark_command(const char *data, size_t len) {
+  stats.commands++;
+  write_record(VIRTUAL_STRIP_REC_COMMAND, data, len);
+}
+
+void virtual_strip_get_stats(virtual_strip_stats_t *out) { *out = stats; }
+
+esp_err_t rmt_new_tx_channel(const rmt_tx_channel_config_t *config,
+                             rmt_channel_handle_t *ret_chan) {
+  *ret_chan = (rmt_channel_handle_t)&virtual_chan;
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_led_strip_encoder(const led_strip_encoder_config_t *config,
+                                    rmt_encoder_handle_t *ret_encoder) {
+  if (config == NULL || config->chipset == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  led_chipset_bit_ticks(config->chipset, config->resolution, &wire_ticks);
+  wire_resolution_hz = config->resolution;
+  *ret_encoder = (rmt_encoder_handle_t)&virtual_encoder;
+  return ESP_OK;
+}
+
+esp_err_t rmt_enable(rmt_channel_handle_t channel) { return ESP_OK; }
+
+esp_err_t rmt_disable(rmt_channel_handle_t channel) { return ESP_OK; }
+
+esp_err_t rmt_transmit(rmt_channel_handle_t tx_channel,
+                       rmt_encoder_handle_t encoder, const void *payload,
+                       size_t payload_bytes,
+                       const rmt_transmit_config_t *config) {
+  if (tx_channel == NULL || encoder == NULL || payload == NULL) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  // Ones and zeros take different times on some chipsets, so count them
+  const uint8_t *bytes = payload;
+  uint64_t ones = 0;
+  for (size_t i = 0; i < payload_bytes; i++) {
+    ones += __builtin_popcount(bytes[i]);
+  }
+  uint64_t zeros = payload_bytes * 8 - ones;
+  uint64_t ticks = ones * (wire_ticks.t1h + wire_ticks.t1l) +
+                   zeros * (wire_ticks.t0h + wire_ticks.t0l) + wire_ticks.reset;
+  stats.frames++;
+  stats.wire_us += ticks * 1000000 / wire_resolution_hz;
+  write_record(VIRTUAL_STRIP_REC_FRAME, payload, payload_bytes);
+  return ESP_OK;
+}
+
+// Frames are "on the wire" as soon as they are logged
+esp_err_t rmt_tx_wait_all_done(rmt_channel_handle_t tx_channel,
+                               int timeout_ms) {
+  return ESP_OK;
+}
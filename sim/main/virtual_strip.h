@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Frame log written by the virtual strip. All integers little-endian:
+//   header: "LAMPSIM1"
+//   record: uint8 type, uint64 time_us, uint16 len, len bytes
+// type 'F' is one rmt_transmit() payload (strip bytes as led.c lays them
+// out), type 'C' a command handed to the command path, so latency is the gap
+// from a 'C' to the next changed 'F'.
+#define VIRTUAL_STRIP_REC_FRAME 'F'
+#define VIRTUAL_STRIP_REC_COMMAND 'C'
+
+typedef struct {
+  uint32_t frames;
+  uint32_t commands;
+  uint64_t wire_us; // time the frames would have spent on the data line
+} virtual_strip_stats_t;
+
+// Returns false when the log file cannot be created
+bool virtual_strip_open(const char *path);
+void virtual_strip_close(void);
+void virtual_strip_mark_command(const char *data, size_t len);
+void virtual_strip_get_stats(virtual_strip_stats_t *stats);